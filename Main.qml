@@ -13,9 +13,15 @@ ApplicationWindow {
     title: qsTr("QtPlayer")
 
     readonly property string pathToBuffer: "file:///" + AssetsDir + "/buffer.tiff"
+    // Playback runs at fps / 60 times real time, paced by the C++ presentation scheduler
     property real fps: 60
     readonly property real timestep: 1000 / fps
     property bool play: false
+    property bool reverse: false
+
+    onPlayChanged: AssetMaker._setPlayback(play, reverse, fps / 60)
+    onReverseChanged: AssetMaker._setPlayback(play, reverse, fps / 60)
+    onFpsChanged: if (play) AssetMaker._setPlayback(play, reverse, fps / 60)
 
     // Scene Graph FPS
     property int sgFramesThisSecond: 0
@@ -44,7 +50,6 @@ ApplicationWindow {
 
         onTriggered: {
             //AssetMaker._writeBuffer()
-            if(play) AssetMaker._readAndWriteNext();
             videoView2.angle += 1 % 360
         }
     }
@@ -62,6 +67,14 @@ ApplicationWindow {
         }
     }
 
+    FileDialog {
+        id: lutDialog
+        title: "Select a .cube LUT"
+        nameFilters: [ "Cube LUTs (*.cube)", "All files (*)" ]
+        onAccepted: AssetMaker._setColor({ colorLut: String(lutDialog.selectedFile).replace("file:///", "") })
+        onRejected: lutButton.checked = false
+    }
+
     RowLayout {
         width: parent.width
         height: 32
@@ -93,7 +106,7 @@ ApplicationWindow {
             width: 180
             placeholderText: "enter frame number"
             focus: true
-            onAccepted:AssetMaker._seekTo(Number(ts.text) * timestep)
+            onAccepted:AssetMaker._seekToFrame(Number(ts.text))
             EnterKey.type: Qt.EnterKeyDone
             Keys.onReturnPressed: accepted()
             Keys.onEnterPressed: accepted()
@@ -125,12 +138,56 @@ ApplicationWindow {
                 val.value += 1
             }
         }
+        Button {
+            id: oneToOne
+            text: "1:1"
+            checkable: true
+            onToggled: videoView.oneToOne = checked
+        }
+        // Colour overrides as AVColorPrimaries/AVColorSpace/AVColorTransferCharacteristic values; the range stays as tagged
+        ComboBox {
+            id: colorInput
+            textRole: "text"
+            model: [
+                { text: "As tagged" },
+                { text: "BT.709", primaries: 1, space: 1, trc: 1 },
+                { text: "BT.601", primaries: 6, space: 6, trc: 6 },
+                { text: "BT.2020 PQ", primaries: 9, space: 9, trc: 16 },
+                { text: "BT.2020 HLG", primaries: 9, space: 9, trc: 18 }
+            ]
+            onActivated: {
+                const c = model[currentIndex]
+                AssetMaker._setColor(currentIndex === 0 ? { overrideInputColorspace: false }
+                    : { overrideInputColorspace: true, colorPrimaries: c.primaries, colorSpace: c.space, colorTrc: c.trc })
+            }
+        }
+        Button {
+            id: lutButton
+            text: "LUT"
+            checkable: true
+            onToggled: checked ? lutDialog.open() : AssetMaker._setColor({ colorLut: "" })
+        }
+        ComboBox {
+            id: scrubPolicy
+            model: ["keyframe", "nonref", "exact"]
+            onActivated: AssetMaker._setScrubPolicy(currentText)
+        }
+        Button {
+            id: reversebutt
+            text: play && reverse ? "Pause" : "Reverse"
+            anchors.right: fileDialog.left
+            onClicked: {
+                play = !(play && reverse)
+                reverse = true
+            }
+        }
         Button {
             id: playbutt
-            text: play ? "Pause" : "Play"
+            text: play && !reverse ? "Pause" : "Play"
             anchors.right: fileDialog.left
             onClicked: {
-                play = !play
+                play = !(play && !reverse)
+                reverse = false
             }
         }
     }
@@ -169,15 +226,22 @@ ApplicationWindow {
     Slider {
         anchors.top: splitPanes.bottom
         from: 0
-        to: 10000
+        // Placeholder range until the reader knows the end
+        to: AssetMaker.duration > 0 ? AssetMaker.duration : 10000
+        onPressedChanged: AssetMaker._setScrubbing(pressed)
         onValueChanged: {
-            pause = true
+            play = false
             AssetMaker._seekTo(value)
         }
 
     }
 
 
+    // JKL shuttle
+    Shortcut { sequence: "J"; onActivated: { reverse = true; play = true } }
+    Shortcut { sequence: "K"; onActivated: play = false }
+    Shortcut { sequence: "L"; onActivated: { reverse = false; play = true } }
+
     Component.onCompleted: Qt.application.style = "Fusion"
 
 }
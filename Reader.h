@@ -5,6 +5,9 @@
 #include <QObject>
 #include <QSize>
 #include <QPoint>
+#include <atomic>
+#include <memory>
+#include "intervalset.h"
 
 #define TVAI_MAX_WIDTH 7680.0
 #define TVAI_MAX_HEIGHT 4320.0
@@ -13,6 +16,13 @@ namespace videoio {
     using namespace cv;
     using namespace std;
 
+    // Output layouts for Reader::getFrameInto. YUVPlanar passes the decoded planes through untouched
+    // (tightly packed, in the stream's own pixel format and coded size). RGB10A2 packs 10 bits per channel into
+    // little-endian 32-bit words, R in the low bits, the top two bits unspecified (AV_PIX_FMT_X2BGR10LE).
+    enum class PixelLayout { RGBA8, BGRA8, RGBA16, YUVPlanar, RGB10A2 };
+
+    class AudioOutput;
+
     class Reader : public QObject {
         Q_OBJECT
     protected:
@@ -23,7 +33,11 @@ namespace videoio {
         double _adjustmentFactor;
         long long _rangeStartPts;
         long long _rangeEndPts;
-        std::vector<QPoint> _playRanges{}; // in timestamp
+        IntervalSet _playRanges; // in timestamp (ms)
+        const std::atomic<bool>* _cancel = nullptr;
+
+        // Called after every change to _playRanges
+        virtual void playRangesChanged() {}
 
         double computeAdjustedFrameSize(QSize resolution, double sar) {
             double w = resolution.width() * sar / TVAI_MAX_WIDTH;
@@ -48,22 +62,74 @@ namespace videoio {
         virtual long long readFirst() = 0;
         virtual long long readLast() = 0;
         virtual bool seekTo(long long ms, bool onFilterGraphReady = false) = 0;
+        virtual bool seekToFrame(long long frame) { return seekTo(frame * _info["timestep"].toDouble()); }
         virtual void nextFrame() = 0;
         virtual void prevFrame() = 0;
         virtual long long getLast(){return -1;}
         virtual Mat getFrame() = 0;
+        // Size of the frames produced by getFrame()/getFrameInto() (after rotation).
+        virtual QSize frameSize() { return _info["size"].toSize(); }
+        virtual size_t frameBufferSize(PixelLayout layout) {
+            QSize size = frameSize();
+            return layout == PixelLayout::YUVPlanar ? 0 : size_t(size.width()) * size.height() * (layout == PixelLayout::RGBA16 ? 8 : 4);
+        }
+        // Writes the current frame into a caller-provided buffer with the given row stride in bytes. This default
+        // goes through getFrame(), which may give RGB or RGBA at 8 or 16 bits; false for anything else, or when it
+        // does not match frameSize() (the size the buffer was made for).
+        virtual bool getFrameInto(uchar* dst, int stride, PixelLayout layout) {
+            Mat frame = getFrame();
+            const QSize size = frameSize();
+            if (frame.empty() || layout == PixelLayout::YUVPlanar || frame.cols != size.width() || frame.rows != size.height()
+                || (frame.depth() != CV_8U && frame.depth() != CV_16U) || (frame.channels() != 3 && frame.channels() != 4))
+                return false;
+            Mat rgba = frame;
+            if (frame.channels() == 3)
+                cvtColor(frame, rgba, COLOR_RGB2RGBA);
+            const bool wide = rgba.depth() == CV_16U;
+            if (layout == PixelLayout::RGB10A2) {
+                for (int y = 0; y < rgba.rows; y++) {
+                    uint32_t* packed = reinterpret_cast<uint32_t*>(dst + (size_t)y * stride);
+                    for (int x = 0; x < rgba.cols; x++) {
+                        uint32_t c[3];
+                        for (int i = 0; i < 3; i++)
+                            c[i] = wide ? rgba.ptr<ushort>(y)[4 * x + i] >> 6 : uint32_t(rgba.ptr<uchar>(y)[4 * x + i]) * 1023 / 255;
+                        packed[x] = c[0] | c[1] << 10 | c[2] << 20 | 3u << 30;
+                    }
+                }
+                return true;
+            }
+            // Written in place: the target matches in size and type, so OpenCV does not reallocate it
+            const int depth = layout == PixelLayout::RGBA16 ? CV_16U : CV_8U;
+            Mat out(rgba.rows, rgba.cols, CV_MAKETYPE(depth, 4), dst, stride);
+            rgba.convertTo(out, out.type(), rgba.depth() == depth ? 1.0 : wide ? 1 / 256.0 : 257.0);
+            if (layout == PixelLayout::BGRA8)
+                cvtColor(out, out, COLOR_RGBA2BGRA);
+            return out.data == dst;
+        }
         virtual void close() {
             _isOpen = false;
             if(_deleteOnClose) {
                 qInfo() << "Delete after close" << _path;
             }
         }
+        // Colour description to read frames with, for "colorPrimaries", "colorSpace", "colorTrc" or "colorRange"
+        // (AVColorPrimaries etc. values): the override while overrideInputColorspace is on and one is set,
+        // otherwise what the source is tagged with.
+        int colorSetting(const QString& key) {
+            if (_info.value("overrideInputColorspace").toBool() && _info.value(key, -1).toInt() >= 0)
+                return _info[key].toInt();
+            return _info.value("original" + key.at(0).toUpper() + key.mid(1)).toInt();
+        }
         virtual void setLooping(bool loop) { _looping = loop; }
         virtual bool getLooping() { return _looping; }
         virtual Mat getThumbnail(float maxWidth = 640.0f, int maxRead = 30, int startFrame = 0) = 0;
+        // count evenly spaced BGR thumbnails of the given width for a timeline strip; empty when unsupported.
+        virtual vector<Mat> getFilmstrip(int count, int width) { return {}; }
         virtual bool clearBuffers() = 0;
         virtual vector<int64_t> getFrameBufferRange() {return vector<int64_t>();}
         virtual bool canReload() = 0;
+        // Audio of the stream being played, when the reader plays any; its clock is the master clock then
+        virtual shared_ptr<AudioOutput> audioOutput() { return nullptr; }
         virtual ~Reader() {}
         virtual void cacheAndClear(bool ignorePlayHead = false) {};
 
@@ -79,52 +145,28 @@ namespace videoio {
             return std::any_of(imgSeqPathEndings.begin(), imgSeqPathEndings.end(), [&path](const QString& ending) { return path.endsWith(ending, Qt::CaseInsensitive);});
         }
 
+        // Seeks give up decoding towards their target once *cancel is set, leaving the reader on the nearest frame
+        // they got to. Used to drop seeks that a newer target has made pointless.
+        void setCancelFlag(const std::atomic<bool>* cancel) { _cancel = cancel; }
+        bool cancelled() const { return _cancel != nullptr && _cancel->load(std::memory_order_relaxed); }
+
         virtual bool getIsInstant() { return _isInstant; }
-        void clearPlayRanges(){ _playRanges.clear(); }
-
-        void deletePlayRange(QPoint range){
-            sortPlayRanges();
-            auto intersects = [](QPoint a, QPoint b){return !(a.x() > b.y() || b.x() > a.y());};
-            auto first = std::find_if(_playRanges.begin(), _playRanges.end(), [&](QPoint& other){
-                return intersects(other, range);
-            });
-            std::vector<decltype(_playRanges)::iterator> removes;
-            while(first != _playRanges.end() && intersects(range, *first)){
-                removes.push_back(first);
-                first++;
-            }
-            _debug_print();
-            if(!removes.empty()){
-                // qInfo() << "#$%@ Attempting remove";
-                // if(removes.front() != _playRanges.end() && removes.back() != _playRanges.end())
-                    // qInfo() << "#$%@ Removing " << (*removes.front()).x() << " to " << (*removes.back()).y();
-                auto last = removes.back() == _playRanges.end() ? removes.back() : std::next(removes.back());
-                _playRanges.erase(removes.front(), last);
-            }
-            _debug_print();
-        }
-        void addToPlayRanges(QPoint range) {
-            qDebug() << "#$%@ Adding range: ["<< range.x() << ", " << range.y() << "]";
-            _playRanges.push_back(range);
-            _debug_print();
-            qDebug() << "Instant Reader$ " << this << "has playranges " << _playRanges;
+        // Play ranges are the playback schedule: readers that support it skip the gaps between them.
+        void clearPlayRanges() {
+            _playRanges.clear();
+            playRangesChanged();
         }
-
-        void _debug_print(){
-            sortPlayRanges();
-            // qDebug() << "Begin print all instant reader ranges #$%@";
-            for(auto range : _playRanges){
-                // qDebug() << "#$%@ [" << range.x() << ", " << range.y() << "] " << "[" << range.x() / 40 << ", " << range.y() / 40 << "] ";
-            }
-            // qDebug() << "#$%@ end";
-
+        void deletePlayRange(QPoint range) {
+            _playRanges.remove(range.x(), range.y());
+            playRangesChanged();
         }
-
-        void sortPlayRanges() {
-            std::sort(_playRanges.begin(), _playRanges.end(), [](const QPoint& a, const QPoint& b) {
-                return a.x() < b.x();
-            });
+        void addToPlayRanges(QPoint range) {
+            qDebug() << "Adding play range [" << range.x() << "," << range.y() << "]";
+            _playRanges.add(range.x(), range.y());
+            playRangesChanged();
+            qDebug() << "Reader" << this << "has play ranges" << _playRanges;
         }
+        const IntervalSet& playRanges() const { return _playRanges; }
 
         virtual void justread(bool isPaused=  false) {};
 
@@ -136,6 +178,8 @@ namespace videoio {
     //     void setFilter(QVariantMap filterInfo);
     signals:
         void frameBufferRangeChangedoo(vector<long long> ptsList);
+        // getInfo() has new values, e.g. from discovery that finished after open()
+        void infoChanged();
         // void previewReady(const QString& filename);
         // void beginDiskCacheChanged();
         // void previewReady(const char* filename);
@@ -2,9 +2,58 @@
 layout(location = 0) in vec2 o_uv;
 layout(location = 0) out vec4 fragColor;
 
+layout(std140, binding = 0) uniform buf {
+    mat4 mvp;
+    mat4 yuvToRgb;
+    int format; // 0: RGBA, 1: Y + U + V planes, 2: Y + interleaved UV (NV12/P010), 3: RGB, alpha ignored (RGB10A2)
+    float levels; // > 0: quantize to this many steps with dithering, for frames deeper than the target
+    float lutSize; // > 1: colour LUT of this size in uLut
+};
+
 layout(binding = 1) uniform sampler2D uTex;
+layout(binding = 2) uniform sampler2D uChroma0;
+layout(binding = 3) uniform sampler2D uChroma1;
+layout(binding = 4) uniform sampler2D uLut; // lutSize^2 x lutSize: blue slices side by side, red across, green down
+
+// Trilinear lookup: the sampler interpolates red and green within a slice, blue is mixed here
+vec3 applyLut(vec3 rgb) {
+    if (lutSize < 2.0)
+        return rgb;
+    vec3 c = clamp(rgb, 0.0, 1.0) * (lutSize - 1.0);
+    float b0 = floor(c.b);
+    float b1 = min(b0 + 1.0, lutSize - 1.0);
+    vec2 uv = vec2((c.r + 0.5) / (lutSize * lutSize), (c.g + 0.5) / lutSize);
+    vec3 s0 = texture(uLut, uv + vec2(b0 / lutSize, 0.0)).rgb;
+    vec3 s1 = texture(uLut, uv + vec2(b1 / lutSize, 0.0)).rgb;
+    return mix(s0, s1, c.b - b0);
+}
+
+// Interleaved gradient noise: cheap, evenly spread over [0, 1) and without visible structure at 1:1
+float noise(vec2 p) {
+    return fract(52.9829189 * fract(dot(p, vec2(0.06711056, 0.00583715))));
+}
+
+// Rounds to the target's levels with a per-pixel threshold, so gradients finer than a step come out as
+// noise instead of bands
+vec3 quantize(vec3 rgb) {
+    if (levels <= 0.0)
+        return rgb;
+    return floor(clamp(rgb, 0.0, 1.0) * levels + noise(gl_FragCoord.xy)) / levels;
+}
 
 void main() {
-    vec4 texFragment = texture(uTex, o_uv);
-    fragColor = texFragment;
+    if (format == 0) {
+        vec4 c = texture(uTex, o_uv);
+        fragColor = vec4(quantize(applyLut(c.rgb)), c.a);
+        return;
+    }
+    if (format == 3) {
+        fragColor = vec4(quantize(applyLut(texture(uTex, o_uv).rgb)), 1.0);
+        return;
+    }
+    float y = texture(uTex, o_uv).r;
+    vec2 uv = format == 1 ? vec2(texture(uChroma0, o_uv).r, texture(uChroma1, o_uv).r)
+                          : texture(uChroma0, o_uv).rg;
+    vec3 rgb = (yuvToRgb * vec4(y, uv, 1.0)).rgb;
+    fragColor = vec4(quantize(applyLut(clamp(rgb, 0.0, 1.0))), 1.0);
 }
@@ -6,6 +6,10 @@ layout(location = 0) out vec2 o_uv;
 
 layout(std140, binding = 0) uniform buf {
     mat4 mvp;
+    mat4 yuvToRgb;
+    int format;
+    float levels;
+    float lutSize;
 };
 
 void main() {
@@ -0,0 +1,356 @@
+#include "audioout.h"
+#include <QDataStream>
+#include <QDebug>
+#include <cstring>
+
+extern "C" {
+#include "libavutil/channel_layout.h"
+#include "libavutil/opt.h"
+}
+
+namespace videoio {
+
+void AudioRing::reset(size_t frames, int channels) {
+    _frames = std::max<size_t>(frames, 1);
+    _channels = channels;
+    _samples.assign(_frames * channels, 0.0f);
+    _read = 0;
+    _write = 0;
+    _discardTo = 0;
+}
+
+size_t AudioRing::write(const float* src, size_t frames) {
+    const uint64_t w = _write.load(std::memory_order_relaxed);
+    const size_t n = std::min(frames, space());
+    const size_t at = size_t(w % _frames), first = std::min(n, _frames - at);
+    memcpy(&_samples[at * _channels], src, first * _channels * sizeof(float));
+    memcpy(&_samples[0], src + first * _channels, (n - first) * _channels * sizeof(float));
+    _write.store(w + n, std::memory_order_release);
+    return n;
+}
+
+size_t AudioRing::read(float* dst, size_t frames) {
+    const uint64_t r = readFrom();
+    const size_t n = std::min<size_t>(frames, _write.load(std::memory_order_acquire) - r);
+    const size_t at = size_t(r % _frames), first = std::min(n, _frames - at);
+    memcpy(dst, &_samples[at * _channels], first * _channels * sizeof(float));
+    memcpy(dst + first * _channels, &_samples[0], (n - first) * _channels * sizeof(float));
+    _read.store(r + n, std::memory_order_release);
+    return n;
+}
+
+size_t AudioRing::skip(size_t frames) {
+    const uint64_t r = readFrom();
+    const size_t n = std::min<size_t>(frames, _write.load(std::memory_order_acquire) - r);
+    _read.store(r + n, std::memory_order_release);
+    return n;
+}
+
+bool WavAudioSink::open(int sampleRate, int channels) {
+    if (!_file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        qWarning() << "WavAudioSink: unable to open" << _file.fileName();
+        return false;
+    }
+    _channels = channels;
+    _dataBytes = 0;
+    // Sizes are patched in on close()
+    QDataStream out(&_file);
+    out.setByteOrder(QDataStream::LittleEndian);
+    out.writeRawData("RIFF", 4);
+    out << quint32(0);
+    out.writeRawData("WAVEfmt ", 8);
+    out << quint32(16) << quint16(3) << quint16(channels) << quint32(sampleRate)
+        << quint32(sampleRate * channels * 4) << quint16(channels * 4) << quint16(32);
+    out.writeRawData("data", 4);
+    out << quint32(0);
+    return true;
+}
+
+void WavAudioSink::write(const float* samples, size_t frames) {
+    if (!_file.isOpen())
+        return;
+    const qint64 bytes = qint64(frames) * _channels * sizeof(float);
+    if (_file.write(reinterpret_cast<const char*>(samples), bytes) == bytes)
+        _dataBytes += quint32(bytes);
+}
+
+void WavAudioSink::close() {
+    if (!_file.isOpen())
+        return;
+    QDataStream out(&_file);
+    out.setByteOrder(QDataStream::LittleEndian);
+    _file.seek(4);
+    out << quint32(36 + _dataBytes);
+    _file.seek(40);
+    out << _dataBytes;
+    _file.close();
+}
+
+unique_ptr<AudioSink> AudioOutput::createSink(const QString& spec) {
+    if (spec == "null")
+        return make_unique<NullAudioSink>();
+    if (spec.startsWith("wav:"))
+        return make_unique<WavAudioSink>(spec.mid(4));
+    return nullptr;
+}
+
+bool AudioOutput::open(const AVStream* pStream, double originMs) {
+    close();
+    const AVCodec* pCodec = avcodec_find_decoder(pStream->codecpar->codec_id);
+    if (pCodec == nullptr || _sink == nullptr)
+        return false;
+    _pCodecContext = avcodec_alloc_context3(pCodec);
+    if (avcodec_parameters_to_context(_pCodecContext, pStream->codecpar) < 0 || avcodec_open2(_pCodecContext, pCodec, nullptr) < 0) {
+        qWarning() << "AudioOutput: unable to open decoder for" << avcodec_get_name(pStream->codecpar->codec_id);
+        avcodec_free_context(&_pCodecContext);
+        return false;
+    }
+    if (!_sink->open(SampleRate, Channels)) {
+        avcodec_free_context(&_pCodecContext);
+        return false;
+    }
+    _pFrame = av_frame_alloc();
+    _timebase = pStream->time_base;
+    _originMs = originMs;
+    _ring.reset(SampleRate, Channels);
+    _flushIndex = 0;
+    _clockValid = false;
+    _continuous = false;
+    _discardFrom = _discardTo = 0;
+    _stop = false;
+    _pump = std::thread(&AudioOutput::pumpLoop, this);
+    return true;
+}
+
+void AudioOutput::close() {
+    if (_pump.joinable()) {
+        {
+            std::lock_guard<std::mutex> g(_pumpLock);
+            _stop = true;
+        }
+        _pumpCv.notify_all();
+        _pump.join();
+    }
+    _clockValid = false;
+    _playing = false;
+    if (_sink)
+        _sink->close();
+    swr_free(&_pSwr);
+    av_frame_free(&_pFrame);
+    avcodec_free_context(&_pCodecContext);
+    _backlog.clear();
+    _backlogFrames = 0;
+    Marker marker;
+    while (_markers.pop(marker)) {}
+}
+
+void AudioOutput::decode(const AVPacket* pPacket) {
+    if (_pCodecContext == nullptr || avcodec_send_packet(_pCodecContext, pPacket) < 0)
+        return;
+    while (avcodec_receive_frame(_pCodecContext, _pFrame) >= 0) {
+        // The resampler follows whatever the stream switches to
+        if (_pSwr == nullptr) {
+            AVChannelLayout stereo = AV_CHANNEL_LAYOUT_STEREO;
+            if (swr_alloc_set_opts2(&_pSwr, &stereo, AV_SAMPLE_FMT_FLT, SampleRate, &_pFrame->ch_layout,
+                                    (AVSampleFormat)_pFrame->format, _pFrame->sample_rate, 0, nullptr) < 0
+                || swr_init(_pSwr) < 0) {
+                qWarning() << "AudioOutput: unable to set up resampling from" << _pFrame->sample_rate << "Hz";
+                swr_free(&_pSwr);
+                av_frame_unref(_pFrame);
+                return;
+            }
+        }
+        Chunk chunk;
+        const int64_t pts = _pFrame->best_effort_timestamp;
+        chunk.ptsMs = pts == AV_NOPTS_VALUE ? _nextPtsMs + _backlogFrames * 1000.0 / SampleRate
+                                            : pts * av_q2d(_timebase) * 1000 - _originMs;
+        const int capacity = swr_get_out_samples(_pSwr, _pFrame->nb_samples);
+        chunk.samples.resize(size_t(std::max(capacity, 0)) * Channels);
+        uint8_t* out[1] = {reinterpret_cast<uint8_t*>(chunk.samples.data())};
+        const int converted = swr_convert(_pSwr, out, capacity, const_cast<const uint8_t**>(_pFrame->extended_data), _pFrame->nb_samples);
+        av_frame_unref(_pFrame);
+        if (converted <= 0)
+            continue;
+        chunk.samples.resize(size_t(converted) * Channels);
+        addChunk(std::move(chunk));
+    }
+    drain();
+}
+
+void AudioOutput::addChunk(Chunk&& chunk) {
+    if (_discardTo > _discardFrom) {
+        const double frameMs = 1000.0 / SampleRate;
+        const double end = chunk.ptsMs + chunk.frames() * frameMs;
+        if (chunk.ptsMs >= _discardTo) {
+            _discardFrom = _discardTo = 0; // past it, done dropping
+        } else if (end > _discardFrom) {
+            // Keep what lies before the dropped range, and what lies after it as a chunk of its own
+            const size_t before = chunk.ptsMs < _discardFrom ? size_t((_discardFrom - chunk.ptsMs) / frameMs) : 0;
+            const size_t after = end > _discardTo ? size_t((end - _discardTo) / frameMs) : 0;
+            if (after > 0) {
+                Chunk tail;
+                tail.ptsMs = end - after * frameMs;
+                tail.samples.assign(chunk.samples.end() - after * Channels, chunk.samples.end());
+                chunk.samples.resize(before * Channels);
+                if (!chunk.samples.empty())
+                    addChunk(std::move(chunk));
+                addChunk(std::move(tail));
+                return;
+            }
+            chunk.samples.resize(before * Channels);
+            if (chunk.samples.empty())
+                return;
+        }
+    }
+    _backlogFrames += chunk.frames();
+    _backlog.push_back(std::move(chunk));
+    // Beyond the backlog limit the oldest audio goes; the marker on the next chunk keeps the clock right
+    while (_backlogFrames > BacklogMs * SampleRate / 1000 && _backlog.size() > 1) {
+        const size_t frames = _backlog.front().frames() - _backlog.front().offset;
+        _backlogFrames -= frames;
+        _dropped += frames;
+        _backlog.pop_front();
+        _continuous = false;
+    }
+}
+
+void AudioOutput::drain() {
+    while (!_backlog.empty() && _ring.space() > 0) {
+        Chunk& chunk = _backlog.front();
+        const double ptsMs = chunk.ptsMs + chunk.offset * 1000.0 / SampleRate;
+        // A marker wherever the audio does not simply follow on: after flushes, drops, gaps in the stream
+        if (!_continuous || std::abs(ptsMs - _nextPtsMs) > 2) {
+            if (!_markers.push({_ring.writePosition(), ptsMs}))
+                qWarning() << "AudioOutput: marker queue full, clock off until the next one";
+            _continuous = true;
+        }
+        const size_t written = _ring.write(chunk.samples.data() + chunk.offset * Channels, chunk.frames() - chunk.offset);
+        chunk.offset += written;
+        _backlogFrames -= written;
+        _nextPtsMs = ptsMs + written * 1000.0 / SampleRate;
+        if (chunk.offset == chunk.frames())
+            _backlog.pop_front();
+    }
+}
+
+void AudioOutput::flush(double discardBeforeMs) {
+    if (_pCodecContext == nullptr)
+        return;
+    avcodec_flush_buffers(_pCodecContext);
+    swr_free(&_pSwr);
+    _backlog.clear();
+    _backlogFrames = 0;
+    _ring.discardAll();
+    _flushIndex = _ring.writePosition();
+    _clockValid = false;
+    _continuous = false;
+    _discardFrom = -1e18;
+    _discardTo = discardBeforeMs;
+}
+
+void AudioOutput::skip(double fromMs, double toMs, bool flushDecoder) {
+    if (_pCodecContext == nullptr)
+        return;
+    if (flushDecoder) {
+        avcodec_flush_buffers(_pCodecContext);
+        swr_free(&_pSwr);
+    }
+    _discardFrom = fromMs;
+    _discardTo = toMs;
+}
+
+bool AudioOutput::hungry() {
+    if (_pCodecContext == nullptr)
+        return false;
+    drain();
+    return _ring.available() < _ring.capacity() / 2;
+}
+
+void AudioOutput::setPlaying(bool playing, double videoMs) {
+    if (playing && !_playing)
+        _skipToMs = videoMs;
+    _playing = playing;
+    _pumpCv.notify_all();
+}
+
+bool AudioOutput::clock(double& ms) const {
+    if (!_clockValid || !_playing)
+        return false;
+    const long long now = nowNs(), starved = _starvedSinceNs;
+    if (starved != 0 && (now - starved) / 1e6 > StarvedMs)
+        return false;
+    const uint64_t read = _ring.readPosition(), mark = _markIndex;
+    // Interpolated between pump rounds, unless nothing is coming out
+    const double sincePump = starved != 0 ? 0 : std::min(10.0, (now - _lastPumpNs) / 1e6);
+    ms = _markPts + (read > mark ? read - mark : 0) * 1000.0 / SampleRate + sincePump - _sink->latencyMs();
+    return true;
+}
+
+void AudioOutput::adoptMarkers() {
+    const uint64_t read = _ring.readPosition();
+    while (const Marker* pNext = _markers.front()) {
+        if (pNext->index > read)
+            break;
+        Marker marker;
+        _markers.pop(marker);
+        _markPts = marker.ptsMs;
+        _markIndex = marker.index;
+        if (marker.index >= _flushIndex)
+            _clockValid = true;
+    }
+}
+
+void AudioOutput::pumpLoop() {
+    vector<float> buffer;
+    Clock::time_point origin;
+    uint64_t paced = 0;
+    bool running = false;
+    while (!_stop) {
+        {
+            std::unique_lock<std::mutex> l(_pumpLock);
+            _pumpCv.wait_for(l, std::chrono::milliseconds(5), [this] { return _stop.load(); });
+        }
+        if (!_playing) {
+            running = false;
+            continue;
+        }
+        const Clock::time_point now = Clock::now();
+        if (!running) {
+            origin = now;
+            paced = 0;
+            running = true;
+        }
+        // Frames due since the last round, at the sample rate
+        const uint64_t target = uint64_t(std::chrono::duration<double>(now - origin).count() * SampleRate);
+        const size_t due = size_t(target - paced);
+        paced = target;
+
+        // Starting to play: drop queued audio that lies before the picture
+        const double skipTo = _skipToMs.exchange(-1);
+        adoptMarkers();
+        if (skipTo >= 0 && _clockValid) {
+            const double lagMs = skipTo - (_markPts + (_ring.readPosition() - _markIndex) * 1000.0 / SampleRate);
+            if (lagMs > 0)
+                _ring.skip(size_t(lagMs * SampleRate / 1000));
+            adoptMarkers();
+        }
+
+        buffer.resize(due * Channels);
+        const size_t got = _ring.read(buffer.data(), due);
+        adoptMarkers();
+        if (got > 0)
+            _sink->write(buffer.data(), got);
+        _played += got;
+        // Starved: time moves on without the clock, no catching up later
+        if (got < due) {
+            if (_starvedSinceNs == 0) {
+                _starvedSinceNs = nowNs();
+                _underruns++;
+            }
+        } else {
+            _starvedSinceNs = 0;
+        }
+        _lastPumpNs = nowNs();
+    }
+}
+}
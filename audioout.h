@@ -0,0 +1,185 @@
+#pragma once
+
+extern "C" {
+#include "libavcodec/avcodec.h"
+#include "libavformat/avformat.h"
+#include "libswresample/swresample.h"
+}
+
+#include <QFile>
+#include <QString>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "spscqueue.h"
+
+namespace videoio {
+using namespace std;
+
+// Lock-free single-producer/single-consumer ring of interleaved float frames. Positions are running frame
+// counts that never wrap, so both sides can refer to "frame n" (clock markers, discards) without a lock.
+class AudioRing {
+    vector<float> _samples;
+    size_t _frames = 1;
+    int _channels = 2;
+    alignas(64) std::atomic<uint64_t> _read{0};  // written by the consumer
+    alignas(64) std::atomic<uint64_t> _write{0}; // written by the producer
+    std::atomic<uint64_t> _discardTo{0};         // producer: the consumer skips everything before this
+
+    uint64_t readFrom() const { return std::max(_read.load(std::memory_order_acquire), _discardTo.load(std::memory_order_acquire)); }
+
+public:
+    // Not thread safe: only while neither side is running
+    void reset(size_t frames, int channels);
+
+    // Producer side
+    size_t write(const float* src, size_t frames);
+    void discardAll() { _discardTo.store(_write.load(std::memory_order_relaxed), std::memory_order_release); }
+    uint64_t writePosition() const { return _write.load(std::memory_order_relaxed); }
+    size_t space() const { return _frames - size_t(_write.load(std::memory_order_relaxed) - readFrom()); }
+
+    // Consumer side
+    size_t read(float* dst, size_t frames);
+    size_t skip(size_t frames);
+    uint64_t readPosition() const { return _read.load(std::memory_order_acquire); }
+
+    size_t available() const { return size_t(_write.load(std::memory_order_acquire) - readFrom()); }
+    size_t capacity() const { return _frames; }
+};
+
+// Where decoded audio ends up. The output pumps interleaved float frames into it in real time; sinks that
+// are not a device just have to take them. Further sinks (an audio device) plug in by subclassing.
+class AudioSink {
+public:
+    virtual ~AudioSink() {}
+    virtual bool open(int sampleRate, int channels) = 0;
+    virtual void close() = 0;
+    virtual void write(const float* samples, size_t frames) = 0;
+    // Written but not audible yet
+    virtual double latencyMs() { return 0; }
+};
+
+// Swallows everything; keeps the audio clock running without a device, e.g. headless
+class NullAudioSink : public AudioSink {
+public:
+    bool open(int, int) override { return true; }
+    void close() override {}
+    void write(const float*, size_t) override {}
+};
+
+// 32-bit float WAV of everything played, for checking what came out
+class WavAudioSink : public AudioSink {
+    QFile _file;
+    int _channels = 2;
+    quint32 _dataBytes = 0;
+
+public:
+    explicit WavAudioSink(const QString& path) : _file(path) {}
+    ~WavAudioSink() { close(); }
+    bool open(int sampleRate, int channels) override;
+    void close() override;
+    void write(const float* samples, size_t frames) override;
+};
+
+// Audio path of a reader: packets from the reader's demux loop are decoded, resampled to 48 kHz stereo float
+// and handed to a pump thread through an AudioRing; the pump feeds the sink at the sample rate while playing.
+// The ring takes one second; decoded audio that does not fit waits in a backlog (up to BacklogMs, oldest
+// dropped beyond that) so the demuxer never waits for audio. Markers travelling alongside the samples tie ring
+// positions to media time, which gives the clock: the media time of the sample being played now.
+// decode()/flush()/skip()/hungry() belong to the thread demuxing, setPlaying()/clock() are callable from anywhere.
+class AudioOutput {
+public:
+    static constexpr int SampleRate = 48000;
+    static constexpr int Channels = 2;
+    static constexpr double BacklogMs = 10000;
+    // Starved for longer than this the clock stops claiming to be valid, so video does not wait forever
+    static constexpr double StarvedMs = 200;
+
+    // "null" or "wav:<path>"; nullptr for anything else
+    static unique_ptr<AudioSink> createSink(const QString& spec);
+
+private:
+    using Clock = std::chrono::steady_clock;
+    struct Chunk {
+        double ptsMs;
+        vector<float> samples;
+        size_t offset = 0; // frames already in the ring
+        size_t frames() const { return samples.size() / Channels; }
+    };
+    struct Marker {
+        uint64_t index;
+        double ptsMs;
+    };
+
+    unique_ptr<AudioSink> _sink;
+
+    // Producer side
+    AVCodecContext* _pCodecContext = nullptr;
+    SwrContext* _pSwr = nullptr;
+    AVFrame* _pFrame = nullptr;
+    AVRational _timebase{1, 1};
+    double _originMs = 0;
+    deque<Chunk> _backlog;
+    size_t _backlogFrames = 0;
+    double _discardFrom = 0, _discardTo = 0; // decoded audio in [from, to) is dropped, nothing when equal
+    double _nextPtsMs = 0; // where the audio written so far ends
+    bool _continuous = false; // whether the next chunk may follow on without a marker
+
+    AudioRing _ring;
+    SPSCQueue<Marker> _markers{64};
+
+    // Consumer side
+    std::thread _pump;
+    std::mutex _pumpLock;
+    std::condition_variable _pumpCv;
+    std::atomic<bool> _stop{false}, _playing{false};
+    std::atomic<double> _skipToMs{-1};
+    std::atomic<uint64_t> _flushIndex{0}, _markIndex{0};
+    std::atomic<double> _markPts{0};
+    std::atomic<bool> _clockValid{false};
+    std::atomic<long long> _lastPumpNs{0}, _starvedSinceNs{0};
+    std::atomic<long long> _underruns{0}, _dropped{0}, _played{0};
+
+    void addChunk(Chunk&& chunk);
+    void drain();
+    void pumpLoop();
+    void adoptMarkers();
+    static long long nowNs() { return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count(); }
+
+public:
+    explicit AudioOutput(unique_ptr<AudioSink> sink) : _sink(std::move(sink)) {}
+    AudioOutput(const AudioOutput&) = delete;
+    AudioOutput& operator=(const AudioOutput&) = delete;
+    ~AudioOutput() { close(); }
+
+    // originMs: media time 0 in the stream's own timeline, in ms (the video stream's start)
+    bool open(const AVStream* pStream, double originMs);
+    void close();
+    bool isOpen() const { return _pCodecContext != nullptr; }
+
+    void decode(const AVPacket* pPacket);
+    // After a seek: everything queued goes, and decoded audio before discardBeforeMs is dropped
+    void flush(double discardBeforeMs);
+    // Jumping a gap: decoded audio in [fromMs, toMs) is dropped, what is queued stays. flushDecoder when the
+    // demuxer moved.
+    void skip(double fromMs, double toMs, bool flushDecoder);
+    // Whether the ring is running low; also moves backlog into the ring
+    bool hungry();
+
+    // Playing: the pump feeds the sink. Starting drops queued audio that lies before videoMs.
+    void setPlaying(bool playing, double videoMs = -1);
+    // Media time being heard now; false while there is nothing meaningful to report
+    bool clock(double& ms) const;
+
+    long long underruns() const { return _underruns; }
+    long long dropped() const { return _dropped; }
+    long long played() const { return _played; }
+};
+}
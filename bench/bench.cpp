@@ -0,0 +1,251 @@
+// Microbenchmarks for the player's hot paths, run by hand: qtplayer_bench <name> [args]. Each one logs
+// a small table through qInfo and leaves the app itself untouched.
+
+#include <QCoreApplication>
+#include <QDebug>
+#include <QFile>
+#include <QFileInfo>
+#include <QString>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "framering.h"
+#include "frameconverter.h"
+#include "mmapio.h"
+#include "rotatekernels.h"
+#include "workerpool.h"
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+using namespace videoio;
+using namespace cv;
+using Clock = std::chrono::steady_clock;
+
+static double msSince(Clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+// The decoder's frame window under steady playback: a frame comes in, the oldest goes out once the window
+// is full, and every step looks a pts up. Pooled ring against the vector<shared_ptr<AVFrame>> it replaced.
+static int framePool(const QStringList& args) {
+    const int window = args.value(0, "10").toInt();
+    const int frames = args.value(1, "1000000").toInt();
+    const int64_t step = 40;
+    qInfo() << "framepool:" << frames << "frames through a window of" << window;
+
+    {
+        std::vector<std::shared_ptr<AVFrame>> vec;
+        long long allocations = 0;
+        int64_t found = 0;
+        const auto start = Clock::now();
+        for (int i = 0; i < frames; i++) {
+            AVFrame* pFrame = av_frame_alloc();
+            allocations++;
+            pFrame->pts = i * step;
+            vec.push_back(std::shared_ptr<AVFrame>(pFrame, [](AVFrame* ptr) { av_frame_free(&ptr); }));
+            if ((int)vec.size() > window)
+                vec.erase(vec.begin());
+            const int64_t pts = (i - window / 2) * step;
+            for (size_t j = 0; j < vec.size(); j++) {
+                if (pts <= vec[j]->pts + step / 2 && pts > vec[j]->pts - step / 2) {
+                    found++;
+                    break;
+                }
+            }
+        }
+        const double ms = msSince(start);
+        qInfo().nospace() << "  vector<shared_ptr>: " << ms * 1e6 / frames << " ns/frame, " << allocations
+                          << " frame allocations, " << found << " found";
+    }
+    {
+        FramePool pool(window + 2);
+        FrameRing ring(&pool, window);
+        int64_t found = 0;
+        const auto start = Clock::now();
+        for (int i = 0; i < frames; i++) {
+            AVFrame* pFrame = pool.acquire();
+            pFrame->pts = i * step;
+            ring.push_back(pFrame);
+            const int index = ring.upperBound((i - window / 2) * step + step / 2) - 1;
+            if (index >= 0)
+                found++;
+        }
+        const double ms = msSince(start);
+        qInfo().nospace() << "  FramePool + FrameRing: " << ms * 1e6 / frames << " ns/frame, " << pool.allocations()
+                          << " frame allocations, " << found << " found";
+    }
+    return 0;
+}
+
+// yuv420p -> RGBA16 conversion of synthetic 1080p, 4K and 8K frames with 1, 2, 4 and 8 slices, unrotated and
+// rotated by 90 degrees.
+static int convertFrames(const QStringList& args) {
+    const int iterations = args.value(0, "20").toInt();
+    const std::vector<std::pair<const char*, QSize>> sizes = {{"1080p", QSize(1920, 1080)}, {"4K", QSize(3840, 2160)}, {"8K", QSize(7680, 4320)}};
+    const int threadCounts[] = {1, 2, 4, 8};
+    qInfo() << "convert: yuv420p -> RGBA16, bicubic," << iterations << "iterations, pool size" << WorkerPool::shared().size() + 1
+            << "rotate kernel" << rotateKernelName();
+    for (const auto& size : sizes) {
+        AVFrame* pFrame = av_frame_alloc();
+        pFrame->format = AV_PIX_FMT_YUV420P;
+        pFrame->width = size.second.width();
+        pFrame->height = size.second.height();
+        if (av_frame_get_buffer(pFrame, 0) < 0) {
+            av_frame_free(&pFrame);
+            continue;
+        }
+        // Gradients rather than flat planes so the filters do real work
+        for (int plane = 0; plane < 3; plane++) {
+            int w = plane ? (pFrame->width + 1) / 2 : pFrame->width;
+            int h = plane ? (pFrame->height + 1) / 2 : pFrame->height;
+            for (int y = 0; y < h; y++)
+                for (int x = 0; x < w; x++)
+                    pFrame->data[plane][y * pFrame->linesize[plane] + x] = uchar((x + y * (plane + 1)) & 0xff);
+        }
+        Mat out(pFrame->height, pFrame->width, CV_16UC4), rotated(pFrame->width, pFrame->height, CV_16UC4);
+        double baseline = 0;
+        for (int threads : threadCounts) {
+            FrameConverter converter;
+            converter.setThreads(threads);
+            auto measure = [&](Mat& dst, unsigned rotate) {
+                converter.convert(pFrame, pFrame->width, pFrame->height, dst.data, dst.step, PixelLayout::RGBA16, rotate); // warm up contexts
+                const auto start = Clock::now();
+                for (int i = 0; i < iterations; i++)
+                    converter.convert(pFrame, pFrame->width, pFrame->height, dst.data, dst.step, PixelLayout::RGBA16, rotate);
+                return msSince(start) / iterations;
+            };
+            double ms = measure(out, 3);
+            double rotatedMs = measure(rotated, ROTATE_90_CLOCKWISE);
+            if (threads == 1)
+                baseline = ms;
+            qInfo().nospace() << "  " << size.first << " threads " << threads << ": " << ms << " ms/frame, x" << (ms > 0 ? baseline / ms : 0)
+                              << ", rotated 90: " << rotatedMs << " ms/frame";
+        }
+        av_frame_free(&pFrame);
+    }
+    return 0;
+}
+
+// Drops the file's pages from the page cache where the OS lets us; a warm run follows anyway.
+static bool dropPageCache(const QString& path) {
+#if defined(__linux__)
+    int fd = ::open(QFile::encodeName(path).constData(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+    fdatasync(fd);
+    bool ok = posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED) == 0;
+    ::close(fd);
+    return ok;
+#else
+    Q_UNUSED(path);
+    return false;
+#endif
+}
+
+// Demux throughput and seek-to-first-packet latency of a file, libavformat's file protocol against MappedInput,
+// each with a dropped (cold) and a primed (warm) page cache.
+static int mappedInput(const QStringList& args) {
+    if (args.isEmpty())
+        return 1;
+    const QString path = args[0];
+    const int seeks = args.value(1, "50").toInt();
+    auto p = path.toStdString();
+
+    auto run = [&](bool mapped, bool cold) {
+        if (cold && !dropPageCache(path))
+            qInfo() << "  (page cache could not be dropped, cold numbers are warm)";
+        std::unique_ptr<MappedInput> input = mapped ? MappedInput::open(path) : nullptr;
+        if (mapped && input == nullptr) {
+            qCritical() << "io: unable to map" << path;
+            return;
+        }
+        auto begin = Clock::now();
+        AVFormatContext* pFormat = avformat_alloc_context();
+        if (input != nullptr) {
+            pFormat->pb = input->context();
+            pFormat->flags |= AVFMT_FLAG_CUSTOM_IO;
+        }
+        if (avformat_open_input(&pFormat, p.c_str(), nullptr, nullptr) != 0 || avformat_find_stream_info(pFormat, nullptr) < 0) {
+            qCritical() << "io: unable to open" << path;
+            if (pFormat != nullptr)
+                avformat_close_input(&pFormat);
+            return;
+        }
+        double openMs = msSince(begin);
+        int stream = av_find_best_stream(pFormat, AVMEDIA_TYPE_VIDEO, -1, -1, nullptr, 0);
+        AVPacket* pPacket = av_packet_alloc();
+
+        begin = Clock::now();
+        long long packets = 0, bytes = 0;
+        while (av_read_frame(pFormat, pPacket) >= 0) {
+            packets++;
+            bytes += pPacket->size;
+            av_packet_unref(pPacket);
+        }
+        double demuxMs = msSince(begin);
+
+        // Random seeks, each timed until the first packet of the video stream arrives
+        double seekMs = 0, worstMs = 0;
+        int done = 0;
+        const AVStream* pStream = stream >= 0 ? pFormat->streams[stream] : nullptr;
+        int64_t duration = pStream == nullptr ? 0 : pStream->duration > 0 ? pStream->duration
+                                                                            : av_rescale_q(pFormat->duration, AV_TIME_BASE_Q, pStream->time_base);
+        std::mt19937 random(1234);
+        for (int i = 0; i < seeks && duration > 0; i++) {
+            int64_t target = (pStream->start_time == AV_NOPTS_VALUE ? 0 : pStream->start_time) + int64_t(random() % 10000 / 10000.0 * duration);
+            begin = Clock::now();
+            if (av_seek_frame(pFormat, stream, target, AVSEEK_FLAG_BACKWARD) < 0)
+                continue;
+            while (av_read_frame(pFormat, pPacket) >= 0) {
+                bool found = pPacket->stream_index == stream;
+                av_packet_unref(pPacket);
+                if (found)
+                    break;
+            }
+            double t = msSince(begin);
+            seekMs += t;
+            worstMs = std::max(worstMs, t);
+            done++;
+        }
+        av_packet_free(&pPacket);
+        avformat_close_input(&pFormat);
+        qInfo().noquote() << QString("  %1 %2: open %3 ms, demux %4 packets %5 MB in %6 ms (%7 MB/s), seek to first packet avg %8 ms max %9 ms over %10")
+                                 .arg(mapped ? "mmap   " : "default").arg(cold ? "cold" : "warm")
+                                 .arg(openMs, 0, 'f', 1).arg(packets).arg(bytes / 1048576.0, 0, 'f', 1).arg(demuxMs, 0, 'f', 1)
+                                 .arg(demuxMs > 0 ? bytes / 1048576.0 / (demuxMs / 1000) : 0, 0, 'f', 0)
+                                 .arg(done ? seekMs / done : 0, 0, 'f', 2).arg(worstMs, 0, 'f', 2).arg(done);
+    };
+
+    qInfo() << "io:" << path << QFileInfo(path).size() / 1048576.0 << "MB";
+    for (bool mapped : {false, true}) {
+        run(mapped, true);
+        run(mapped, false);
+    }
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    QCoreApplication app(argc, argv);
+    const std::vector<std::pair<QString, std::function<int(const QStringList&)>>> benchmarks = {
+        {"framepool", framePool},
+        {"convert", convertFrames},
+        {"io", mappedInput},
+    };
+    QStringList args = app.arguments().mid(1);
+    const QString name = args.isEmpty() ? QString() : args.takeFirst();
+    for (const auto& benchmark : benchmarks) {
+        if (benchmark.first == name)
+            return benchmark.second(args);
+    }
+    qInfo() << "usage: qtplayer_bench <name> [args]";
+    qInfo() << "  framepool [window] [frames]";
+    qInfo() << "  convert [iterations]";
+    qInfo() << "  io <file> [seeks]";
+    return 1;
+}
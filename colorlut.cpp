@@ -0,0 +1,210 @@
+#include "colorlut.h"
+#include <QDebug>
+#include <QFile>
+#include <QTextStream>
+#include <algorithm>
+#include <array>
+#include <cmath>
+
+using Mat3 = std::array<std::array<double, 3>, 3>;
+using Vec3 = std::array<double, 3>;
+
+static Vec3 mul(const Mat3& m, const Vec3& v) {
+    return {m[0][0] * v[0] + m[0][1] * v[1] + m[0][2] * v[2],
+            m[1][0] * v[0] + m[1][1] * v[1] + m[1][2] * v[2],
+            m[2][0] * v[0] + m[2][1] * v[1] + m[2][2] * v[2]};
+}
+
+static Mat3 mul(const Mat3& a, const Mat3& b) {
+    Mat3 m{};
+    for (int i = 0; i < 3; i++)
+        for (int j = 0; j < 3; j++)
+            m[i][j] = a[i][0] * b[0][j] + a[i][1] * b[1][j] + a[i][2] * b[2][j];
+    return m;
+}
+
+static Mat3 inverse(const Mat3& m) {
+    const double det = m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1])
+                     - m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0])
+                     + m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0]);
+    Mat3 r;
+    r[0][0] = (m[1][1] * m[2][2] - m[1][2] * m[2][1]) / det;
+    r[0][1] = (m[0][2] * m[2][1] - m[0][1] * m[2][2]) / det;
+    r[0][2] = (m[0][1] * m[1][2] - m[0][2] * m[1][1]) / det;
+    r[1][0] = (m[1][2] * m[2][0] - m[1][0] * m[2][2]) / det;
+    r[1][1] = (m[0][0] * m[2][2] - m[0][2] * m[2][0]) / det;
+    r[1][2] = (m[0][2] * m[1][0] - m[0][0] * m[1][2]) / det;
+    r[2][0] = (m[1][0] * m[2][1] - m[1][1] * m[2][0]) / det;
+    r[2][1] = (m[0][1] * m[2][0] - m[0][0] * m[2][1]) / det;
+    r[2][2] = (m[0][0] * m[1][1] - m[0][1] * m[1][0]) / det;
+    return r;
+}
+
+// xy chromaticities of R, G, B and white for an AVColorPrimaries value; BT.709 for anything unknown
+static std::array<double, 8> chromaticities(int primaries) {
+    switch (primaries) {
+    case 4:  return {0.67, 0.33, 0.21, 0.71, 0.14, 0.08, 0.310, 0.316};          // BT.470M, illuminant C
+    case 5:  return {0.64, 0.33, 0.29, 0.60, 0.15, 0.06, 0.3127, 0.3290};        // BT.470BG
+    case 6: case 7:
+             return {0.630, 0.340, 0.310, 0.595, 0.155, 0.070, 0.3127, 0.3290};  // SMPTE 170M/240M
+    case 9:  return {0.708, 0.292, 0.170, 0.797, 0.131, 0.046, 0.3127, 0.3290};  // BT.2020
+    case 11: return {0.680, 0.320, 0.265, 0.690, 0.150, 0.060, 0.314, 0.351};    // DCI-P3
+    case 12: return {0.680, 0.320, 0.265, 0.690, 0.150, 0.060, 0.3127, 0.3290};  // Display P3
+    default: return {0.64, 0.33, 0.30, 0.60, 0.15, 0.06, 0.3127, 0.3290};        // BT.709
+    }
+}
+
+// Whether chromaticities() has something other than BT.709 for the value
+static bool otherPrimaries(int primaries) {
+    return primaries == 4 || primaries == 5 || primaries == 6 || primaries == 7 || primaries == 9 || primaries == 11 || primaries == 12;
+}
+
+// Linear RGB to XYZ. Whites are not adapted to each other, which only matters for BT.470M and DCI-P3.
+static Mat3 rgbToXyz(int primaries) {
+    const auto c = chromaticities(primaries);
+    Mat3 p;
+    for (int i = 0; i < 3; i++) {
+        const double x = c[2 * i], y = c[2 * i + 1];
+        p[0][i] = x / y;
+        p[1][i] = 1.0;
+        p[2][i] = (1.0 - x - y) / y;
+    }
+    const Vec3 white{c[6] / c[7], 1.0, (1.0 - c[6] - c[7]) / c[7]};
+    const Vec3 s = mul(inverse(p), white);
+    for (int row = 0; row < 3; row++)
+        for (int i = 0; i < 3; i++)
+            p[row][i] *= s[i];
+    return p;
+}
+
+static bool isHdr(int trc) {
+    return trc == 16 || trc == 18; // SMPTE 2084 (PQ), ARIB STD-B67 (HLG)
+}
+
+// Display light relative to SDR white for a non-linear value of an AVColorTransferCharacteristic (not HLG,
+// whose system gamma needs all three channels)
+static double decode(int trc, double v) {
+    switch (trc) {
+    case 4: return std::pow(v, 2.2);  // gamma 2.2
+    case 5: return std::pow(v, 2.8);  // gamma 2.8
+    case 8: return v;                 // linear
+    case 13: return v <= 0.04045 ? v / 12.92 : std::pow((v + 0.055) / 1.055, 2.4); // sRGB
+    case 16: {                        // PQ, in nits over reference white
+        const double m1 = 0.1593017578125, m2 = 78.84375, c1 = 0.8359375, c2 = 18.8515625, c3 = 18.6875;
+        const double p = std::pow(v, 1.0 / m2);
+        return std::pow(std::max(p - c1, 0.0) / (c2 - c3 * p), 1.0 / m1) * 10000.0 / 203.0;
+    }
+    default: return std::pow(v, 2.4); // BT.709/601/2020 and untagged, as shown by a BT.1886 display
+    }
+}
+
+static double hlgInverseOetf(double v) {
+    const double a = 0.17883277, b = 0.28466892, c = 0.55991073;
+    return v <= 0.5 ? v * v / 3.0 : (std::exp((v - c) / a) + b) / 12.0;
+}
+
+// Keeps everything below the knee, compresses what is above into the rest of [0, 1]
+static double rollOff(double x) {
+    const double knee = 0.8;
+    return x <= knee ? x : knee + (1.0 - knee) * (1.0 - std::exp(-(x - knee) / (1.0 - knee)));
+}
+
+std::shared_ptr<const ColorLut> ColorLut::generate(int primaries, int trc, int size) {
+    const bool sdrTransfer = trc <= 2 || trc == 6 || trc == 14 || trc == 15; // BT.1886 already
+    if (!otherPrimaries(primaries) && sdrTransfer)
+        return nullptr;
+    const Mat3 toXyz = rgbToXyz(primaries);
+    const Mat3 toTarget = mul(inverse(rgbToXyz(1)), toXyz);
+    const Vec3 luma = toXyz[1];
+    const bool hdr = isHdr(trc);
+
+    auto lut = std::make_shared<ColorLut>();
+    lut->size = size;
+    lut->rgb.resize(size_t(size) * size * size * 3);
+    float* out = lut->rgb.data();
+    for (int b = 0; b < size; b++) {
+        for (int g = 0; g < size; g++) {
+            for (int r = 0; r < size; r++) {
+                const Vec3 v{r / double(size - 1), g / double(size - 1), b / double(size - 1)};
+                Vec3 linear;
+                if (trc == 18) {
+                    // HLG: scene light, then the OOTF for a 1000 nit display (system gamma 1.2)
+                    const Vec3 scene{hlgInverseOetf(v[0]), hlgInverseOetf(v[1]), hlgInverseOetf(v[2])};
+                    const double ys = luma[0] * scene[0] + luma[1] * scene[1] + luma[2] * scene[2];
+                    const double gain = std::pow(std::max(ys, 1e-6), 0.2) * 1000.0 / 203.0;
+                    linear = {scene[0] * gain, scene[1] * gain, scene[2] * gain};
+                } else {
+                    linear = {decode(trc, v[0]), decode(trc, v[1]), decode(trc, v[2])};
+                }
+                Vec3 target = mul(toTarget, linear);
+                for (double& c : target) {
+                    c = std::max(c, 0.0);
+                    if (hdr)
+                        c = rollOff(c);
+                    *out++ = float(std::pow(std::min(c, 1.0), 1.0 / 2.4));
+                }
+            }
+        }
+    }
+    return lut;
+}
+
+std::shared_ptr<const ColorLut> ColorLut::load(const QString& path) {
+    QFile f(path);
+    if (!f.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        qWarning() << "ColorLut: cannot open" << path;
+        return nullptr;
+    }
+    auto lut = std::make_shared<ColorLut>();
+    QTextStream in(&f);
+    while (!in.atEnd()) {
+        const QString line = in.readLine().trimmed();
+        if (line.isEmpty() || line.startsWith('#') || line.startsWith("TITLE"))
+            continue;
+        const QStringList fields = line.split(' ', Qt::SkipEmptyParts);
+        // Keywords are words; only a line that starts with a number is an entry of the table
+        bool numeric = false;
+        fields[0].toFloat(&numeric);
+        if (numeric) {
+            bool ok[3] = {false, false, false};
+            if (fields.size() == 3 && lut->size > 0) {
+                for (int i = 0; i < 3; i++)
+                    lut->rgb.push_back(fields[i].toFloat(&ok[i]));
+            }
+            if (!ok[0] || !ok[1] || !ok[2]) {
+                qWarning() << "ColorLut: bad entry" << line << "in" << path << (lut->size > 0 ? "" : "(before LUT_3D_SIZE)");
+                return nullptr;
+            }
+        } else if (fields[0] == "LUT_3D_SIZE" && fields.size() == 2) {
+            lut->size = fields[1].toInt();
+            if (lut->size < 2 || lut->size > 256) {
+                qWarning() << "ColorLut: unsupported LUT_3D_SIZE" << lut->size << "in" << path;
+                return nullptr;
+            }
+            lut->rgb.reserve(size_t(lut->size) * lut->size * lut->size * 3);
+        } else if (fields[0] == "LUT_1D_SIZE") {
+            qWarning() << "ColorLut: 1D tables are not supported," << path;
+            return nullptr;
+        } else if (fields[0] == "DOMAIN_MIN" || fields[0] == "DOMAIN_MAX" || fields[0] == "LUT_3D_INPUT_RANGE") {
+            // DOMAIN_MIN/MAX give a bound per channel, LUT_3D_INPUT_RANGE both bounds for all of them
+            const bool range = fields[0] == "LUT_3D_INPUT_RANGE";
+            bool supported = fields.size() == (range ? 3 : 4);
+            for (int i = 1; supported && i < fields.size(); i++) {
+                const float expected = range ? (i == 1 ? 0.0f : 1.0f) : (fields[0] == "DOMAIN_MIN" ? 0.0f : 1.0f);
+                bool ok = false;
+                supported = fields[i].toFloat(&ok) == expected && ok;
+            }
+            if (!supported) {
+                qWarning() << "ColorLut: only the default [0, 1] domain is supported," << line << "in" << path;
+                return nullptr;
+            }
+        }
+        // other keywords (vendor extensions) are ignored
+    }
+    if (lut->size == 0 || lut->rgb.size() != size_t(lut->size) * lut->size * lut->size * 3) {
+        qWarning() << "ColorLut: expected" << lut->size << "cubed entries in" << path << "got" << lut->rgb.size() / 3;
+        return nullptr;
+    }
+    qInfo() << "ColorLut: loaded" << path << "size" << lut->size;
+    return lut;
+}
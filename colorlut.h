@@ -0,0 +1,23 @@
+#ifndef COLORLUT_H
+#define COLORLUT_H
+
+#include <QString>
+#include <memory>
+#include <vector>
+
+// 3D colour lookup table frame.frag applies to the RGB it gets after YUV -> RGB (or straight from an RGB
+// frame): size^3 RGB entries in [0, 1], red fastest, then green, then blue, like .cube files. A table is built
+// once per colour setting and shared by every frame using it, so switching settings costs no per-frame work.
+struct ColorLut {
+    int size = 0;
+    std::vector<float> rgb; // 3 per entry
+
+    // From the source's primaries and transfer (AVColorPrimaries / AVColorTransferCharacteristic values) to
+    // BT.709 primaries on a BT.1886 display. PQ and HLG put reference white (203 nits) at 1 and roll off above.
+    // nullptr when the table would be the identity: BT.709 primaries with an SDR transfer, or untagged.
+    static std::shared_ptr<const ColorLut> generate(int primaries, int trc, int size = 33);
+    // A .cube file with a 3D table over the default [0, 1] domain; nullptr with a warning for anything else
+    static std::shared_ptr<const ColorLut> load(const QString& path);
+};
+
+#endif // COLORLUT_H
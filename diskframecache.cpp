@@ -0,0 +1,285 @@
+#include "diskframecache.h"
+#include <QDataStream>
+#include <QDebug>
+#include <algorithm>
+
+extern "C" {
+#include "libavutil/imgutils.h"
+}
+
+namespace videoio {
+
+static const quint32 FramesMagic = 0x51504643; // "QPFC"
+static const quint32 FramesVersion = 1;
+
+bool DiskFrameCache::open(const FileIdentity& id) {
+    close();
+    if (!id.isValid())
+        return false;
+    _id = id;
+    _file.setFileName(mediaCachePath("frames", id, ".qfc"));
+    if (!_file.open(QIODevice::ReadWrite)) {
+        qWarning() << "DiskFrameCache: unable to open" << _file.fileName();
+        return false;
+    }
+    if (!loadIndex()) {
+        _records.clear();
+        _head = 0;
+        _file.resize(0);
+    }
+    _writeFile.setFileName(_file.fileName());
+    if (!_writeFile.open(QIODevice::ReadWrite | QIODevice::Unbuffered)) {
+        qWarning() << "DiskFrameCache: unable to open" << _file.fileName() << "for writing";
+        _records.clear();
+        _file.close();
+        return false;
+    }
+    _stop = false;
+    _writer = std::thread(&DiskFrameCache::writeLoop, this);
+    qInfo() << "DiskFrameCache:" << _records.size() << "frames cached for" << id.path;
+    return true;
+}
+
+void DiskFrameCache::close() {
+    if (_writer.joinable()) {
+        {
+            std::lock_guard<std::mutex> g(_lock);
+            _stop = true;
+        }
+        _queued.notify_all();
+        _writer.join();
+    }
+    _writeFile.close();
+    std::lock_guard<std::mutex> g(_lock);
+    for (auto pFrame : _queue)
+        av_frame_free(&pFrame);
+    _queue.clear();
+    if (_file.isOpen()) {
+        saveIndex();
+        _file.close();
+    }
+    _records.clear();
+    _head = 0;
+}
+
+void DiskFrameCache::setBudget(size_t bytes) {
+    std::lock_guard<std::mutex> g(_lock);
+    _budget = bytes;
+    _generation++;
+    // Whatever lies past the new end is gone
+    for (auto it = _records.begin(); it != _records.end();)
+        it = size_t(it->second.offset + it->second.size) > _budget ? _records.erase(it) : std::next(it);
+    if (_head > (int64_t)_budget)
+        _head = 0;
+    if (_file.isOpen() && _file.size() > (qint64)_budget)
+        _file.resize(_budget);
+}
+
+void DiskFrameCache::clear() {
+    std::lock_guard<std::mutex> g(_lock);
+    _records.clear();
+    _head = 0;
+    _generation++;
+    if (_file.isOpen())
+        _file.resize(0);
+}
+
+size_t DiskFrameCache::bytes() {
+    std::lock_guard<std::mutex> g(_lock);
+    size_t total = 0;
+    for (auto& entry : _records)
+        total += entry.second.size;
+    return total;
+}
+
+void DiskFrameCache::store(const AVFrame* pFrame) {
+    if (pFrame == nullptr || !isOpen())
+        return;
+    std::lock_guard<std::mutex> g(_lock);
+    if (_records.count(pFrame->pts) || std::any_of(_queue.begin(), _queue.end(), [&](AVFrame* q) { return q->pts == pFrame->pts; }))
+        return;
+    if (_queue.size() >= MaxQueued) {
+        _dropped++;
+        return;
+    }
+    AVFrame* pRef = av_frame_clone(pFrame);
+    if (pRef == nullptr)
+        return;
+    _queue.push_back(pRef);
+    _queued.notify_one();
+}
+
+void DiskFrameCache::writeLoop() {
+    std::unique_lock<std::mutex> l(_lock);
+    for (;;) {
+        _queued.wait(l, [this] { return _stop || !_queue.empty(); });
+        if (_stop)
+            return;
+        // Stays queued, and so served from memory by load(), until its record is in the index
+        AVFrame* pFrame = _queue.front();
+        if (write(pFrame, l))
+            _written++;
+        _queue.pop_front();
+        av_frame_free(&pFrame);
+    }
+}
+
+bool DiskFrameCache::write(const AVFrame* pFrame, std::unique_lock<std::mutex>& l) {
+    // Called with _lock held. The region is reserved under it: the records it overwrites leave the index and
+    // _head moves past it, so no reader is pointed at bytes still being written. Copy and write run unlocked.
+    int size = av_image_get_buffer_size((AVPixelFormat)pFrame->format, pFrame->width, pFrame->height, 1);
+    if (size <= 0 || size_t(size) > _budget)
+        return false;
+    if (_head + size > (int64_t)_budget)
+        _head = 0;
+    int64_t begin = _head, end = _head + size;
+    for (auto it = _records.begin(); it != _records.end();)
+        it = it->second.offset < end && it->second.offset + it->second.size > begin ? _records.erase(it) : std::next(it);
+    _head = end;
+    const quint64 generation = _generation;
+    l.unlock();
+
+    _scratch.resize(size);
+    bool ok = av_image_copy_to_buffer(_scratch.data(), size, pFrame->data, pFrame->linesize, (AVPixelFormat)pFrame->format,
+                                      pFrame->width, pFrame->height, 1) >= 0;
+    if (ok && (!_writeFile.seek(begin) || _writeFile.write(reinterpret_cast<const char*>(_scratch.data()), size) != size || !_writeFile.flush())) {
+        qWarning() << "DiskFrameCache: write failed" << _writeFile.errorString();
+        ok = false;
+    }
+
+    l.lock();
+    if (generation != _generation) {
+        // clear() or setBudget() cut the file in the meantime and took the region away; the write may have
+        // grown the file past the budget again
+        if (_file.size() > (qint64)_budget)
+            _file.resize(std::min(_file.size(), (qint64)_budget));
+        return false;
+    }
+    if (!ok)
+        return false;
+    _records[pFrame->pts] = {pFrame->pts, begin, size, pFrame->width, pFrame->height, pFrame->format,
+                             pFrame->color_range, pFrame->colorspace, pFrame->color_primaries, pFrame->color_trc,
+                             pFrame->sample_aspect_ratio.num, pFrame->sample_aspect_ratio.den, pFrame->flags};
+    return true;
+}
+
+const DiskFrameCache::Record* DiskFrameCache::lookup(int64_t pts, int64_t step) const {
+    auto it = _records.upper_bound(pts + step / 2);
+    if (it == _records.begin())
+        return nullptr;
+    --it;
+    return pts < it->second.pts + std::max<int64_t>(step, 1) ? &it->second : nullptr;
+}
+
+bool DiskFrameCache::contains(int64_t pts, int64_t step) {
+    std::lock_guard<std::mutex> g(_lock);
+    return isOpen() && lookup(pts, step) != nullptr;
+}
+
+bool DiskFrameCache::load(int64_t pts, int64_t step, AVFrame* pFrame) {
+    std::lock_guard<std::mutex> g(_lock);
+    if (!isOpen())
+        return false;
+    // Frames still waiting for the writer are served from memory
+    for (AVFrame* pQueued : _queue) {
+        if (pQueued->pts <= pts + step / 2 && pts < pQueued->pts + std::max<int64_t>(step, 1)) {
+            _hits++;
+            return av_frame_ref(pFrame, pQueued) >= 0;
+        }
+    }
+    const Record* pRecord = lookup(pts, step);
+    if (pRecord == nullptr)
+        return false;
+    uchar* pData = _file.map(pRecord->offset, pRecord->size);
+    if (pData == nullptr)
+        return false;
+    pFrame->width = pRecord->width;
+    pFrame->height = pRecord->height;
+    pFrame->format = pRecord->format;
+    bool ok = av_frame_get_buffer(pFrame, 0) >= 0;
+    if (ok) {
+        uint8_t* src[4];
+        int srcLinesize[4];
+        ok = av_image_fill_arrays(src, srcLinesize, pData, (AVPixelFormat)pRecord->format, pRecord->width, pRecord->height, 1) >= 0;
+        if (ok)
+            av_image_copy(pFrame->data, pFrame->linesize, const_cast<const uint8_t**>(src), srcLinesize,
+                          (AVPixelFormat)pRecord->format, pRecord->width, pRecord->height);
+    }
+    _file.unmap(pData);
+    if (!ok) {
+        av_frame_unref(pFrame);
+        return false;
+    }
+    pFrame->pts = pRecord->pts;
+    pFrame->best_effort_timestamp = pRecord->pts;
+    pFrame->color_range = (AVColorRange)pRecord->colorRange;
+    pFrame->colorspace = (AVColorSpace)pRecord->colorSpace;
+    pFrame->color_primaries = (AVColorPrimaries)pRecord->colorPrimaries;
+    pFrame->color_trc = (AVColorTransferCharacteristic)pRecord->colorTrc;
+    pFrame->sample_aspect_ratio = {pRecord->sarNum, pRecord->sarDen};
+    pFrame->flags = pRecord->flags;
+    _hits++;
+    return true;
+}
+
+vector<int64_t> DiskFrameCache::cachedPts() {
+    std::lock_guard<std::mutex> g(_lock);
+    vector<int64_t> pts;
+    pts.reserve(_records.size() + _queue.size());
+    for (auto& entry : _records)
+        pts.push_back(entry.first);
+    for (AVFrame* pQueued : _queue)
+        pts.push_back(pQueued->pts);
+    sort(pts.begin(), pts.end());
+    return pts;
+}
+
+bool DiskFrameCache::loadIndex() {
+    QFile f(mediaCachePath("frames", _id, ".qfcx"));
+    if (!f.open(QIODevice::ReadOnly))
+        return false;
+    QDataStream in(&f);
+    quint32 magic, version;
+    QString path;
+    qint64 size, mtime, head;
+    quint64 count;
+    in >> magic >> version >> path >> size >> mtime >> head >> count;
+    if (in.status() != QDataStream::Ok || magic != FramesMagic || version != FramesVersion
+        || path != _id.path || size != _id.size || mtime != _id.mtime || count > (quint64)f.size() / 60) {
+        return false;
+    }
+    for (quint64 i = 0; i < count; i++) {
+        Record r;
+        qint64 pts, offset, bytes;
+        in >> pts >> offset >> bytes >> r.width >> r.height >> r.format >> r.colorRange >> r.colorSpace
+           >> r.colorPrimaries >> r.colorTrc >> r.sarNum >> r.sarDen >> r.flags;
+        r.pts = pts;
+        r.offset = offset;
+        r.size = bytes;
+        // A data file shorter than the index says (crash, disk full) invalidates the lot
+        if (in.status() != QDataStream::Ok || offset + bytes > _file.size())
+            return false;
+        _records[r.pts] = r;
+    }
+    _head = head;
+    // The index is rewritten on close; until then a crash must not leave a stale one behind
+    f.close();
+    f.remove();
+    return true;
+}
+
+void DiskFrameCache::saveIndex() {
+    QFile f(mediaCachePath("frames", _id, ".qfcx"));
+    if (!f.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        qWarning() << "DiskFrameCache: unable to write index" << f.fileName();
+        return;
+    }
+    QDataStream out(&f);
+    out << FramesMagic << FramesVersion << _id.path << _id.size << _id.mtime << (qint64)_head << (quint64)_records.size();
+    for (auto& entry : _records) {
+        const Record& r = entry.second;
+        out << (qint64)r.pts << (qint64)r.offset << (qint64)r.size << r.width << r.height << r.format << r.colorRange
+            << r.colorSpace << r.colorPrimaries << r.colorTrc << r.sarNum << r.sarDen << r.flags;
+    }
+}
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+extern "C" {
+#include "libavutil/frame.h"
+}
+
+#include <QFile>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "mediacache.h"
+
+namespace videoio {
+using namespace std;
+
+// Second tier behind the in-memory frame window: decoded frames spilled to one cache file per media file,
+// planes stored tightly packed as they came out of the decoder. The file is used as a ring up to a byte budget,
+// frames that get overwritten drop out of the index. Writes happen on a thread of their own, through a file
+// handle of its own and without the lock; reads map the record with QFile::map and copy the planes into a
+// pool frame. The index is saved next to the data on close() and reloaded by the next open() of the same
+// file identity.
+class DiskFrameCache {
+    struct Record {
+        int64_t pts, offset, size;
+        qint32 width, height, format;
+        qint32 colorRange, colorSpace, colorPrimaries, colorTrc;
+        qint32 sarNum, sarDen, flags;
+    };
+
+    FileIdentity _id;
+    QFile _file;
+    QFile _writeFile; // writer thread only
+    std::mutex _lock; // _records, _head, _file, _generation
+    map<int64_t, Record> _records; // by pts
+    int64_t _head = 0;
+    size_t _budget = size_t(4) << 30;
+    quint64 _generation = 0; // bumped whenever the file is cut, so a write in flight knows its region is gone
+    vector<uint8_t> _scratch; // writer thread only
+
+    std::thread _writer;
+    std::condition_variable _queued;
+    deque<AVFrame*> _queue; // under _lock
+    bool _stop = false;
+    std::atomic<long long> _hits{0}, _written{0}, _dropped{0};
+
+    static constexpr size_t MaxQueued = 8;
+
+    void writeLoop();
+    bool write(const AVFrame* pFrame, std::unique_lock<std::mutex>& l);
+    bool loadIndex();
+    void saveIndex();
+    const Record* lookup(int64_t pts, int64_t step) const;
+
+public:
+    DiskFrameCache() = default;
+    DiskFrameCache(const DiskFrameCache&) = delete;
+    DiskFrameCache& operator=(const DiskFrameCache&) = delete;
+    ~DiskFrameCache() { close(); }
+
+    bool open(const FileIdentity& id);
+    void close();
+    bool isOpen() const { return _file.isOpen(); }
+    void setBudget(size_t bytes);
+    size_t budget() const { return _budget; }
+    void clear();
+
+    // Queues a reference to the frame for writing; frames already cached, or arriving while the writer is
+    // behind, are skipped. Callable from any thread.
+    void store(const AVFrame* pFrame);
+    // Whether a cached frame covers pts (starts at most step/2 after it and less than step before it)
+    bool contains(int64_t pts, int64_t step);
+    // Fills pFrame (an empty frame, e.g. from the pool) with the frame covering pts; false on a miss.
+    bool load(int64_t pts, int64_t step, AVFrame* pFrame);
+    // pts of every cached frame, ascending
+    vector<int64_t> cachedPts();
+
+    size_t bytes();
+    long long hits() const { return _hits; }
+    long long written() const { return _written; }
+    long long dropped() const { return _dropped; }
+};
+}
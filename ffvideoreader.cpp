@@ -1,7 +1,10 @@
 #include "ffvideoreader.h"
+#include "filmstrip.h"
 //#include "FFReaderUtils.h"
 #include <iostream>
 #include <mutex>
+#include <chrono>
+#include <climits>
 
 namespace videoio {
 using namespace cv;
@@ -9,14 +12,26 @@ using namespace std;
 bool FFVideoReader::seek(long long pts) {
     if(!_isOpen)
         return false;
+    applyProbe();
     auto clampedPts = clampPts(pts);
     bool retVal = (pts == clampedPts);
-    if(findIndex(pts) >= 0) {
+    if(!_scrubWindow && findIndex(pts) >= 0) {
         _currentIndex = findIndex(pts);
         _lastShown = currentPts();
         return retVal;
     }
-    if(!frameInNearFuture(pts, 10)) {
+    // Frames in the near future are consumed from the decode-ahead queue; anything else needs the decoder,
+    // unless the disk cache has it.
+    bool nearFuture = _framesSynced && frameInNearFuture(pts, 10);
+    if (!nearFuture && (loadFromSegments(clampedPts) || loadFromDisk(clampedPts)))
+        return retVal;
+    if (!nearFuture && _scrubbing && _scrubMode != ScrubMode::Exact)
+        return scrubTo(clampedPts) && retVal;
+    DecodeAheadPause pause(this, !nearFuture);
+    if(!nearFuture && _indexReady) {
+        // The index knows the right keyframe, no need to probe.
+        seekToKeyFrame(pts);
+    } else if(!nearFuture) {
         seekToKeyFrame(pts);
         long long cpts = 0, lastPts = -1;
         for(int i=1;i<=5;i++) {
@@ -24,7 +39,7 @@ bool FFVideoReader::seek(long long pts) {
                 //qInfo() << "->->-> Was seeking" << tc2ms(pts) << "found" << tc2ms(_frames.front()->pts) << _frames.front()->key_frame;
                 long long keyPts = _frames.size() == 0 ? -1 : _frames.front()->pts;
                 if(_frames.size() == 0 || ((_frames.front()->pts > pts || !(_frames.front()->flags & AV_FRAME_FLAG_KEY) || _frames.front()->pts + _timestep*100 < pts) && lastPts != _frames.front()->pts )) {
-                    if(_byteSeek && _frames.front()->pts + _timestep*100 < pts) {
+                    if(_byteSeek && durationKnown() && _frames.front()->pts + _timestep*100 < pts) {
                         if(cpts == 0)
                             cpts = pts;
                         cpts = cpts+(cpts - _frames.front()->pts)*0.9*i;
@@ -35,6 +50,8 @@ bool FFVideoReader::seek(long long pts) {
                 } else
                     break;
                 lastPts = keyPts;
+                if (cancelled())
+                    break;
             } else {
                 qCritical() << "Reading failed after seek";
                 return false;
@@ -62,9 +79,7 @@ void log_callback_report(void *ptr, int level, const char *fmt, va_list vl)	{
     cerr << line;
 }
 
-bool FFVideoReader::open() {
-    qInfo() << "Trying to open the file " << _path << isOpen();
-    _isOpen = false;
+bool FFVideoReader::openInput(long long probeSize) {
     auto path = _path.toStdString();
     AVDictionary* options = NULL;
     if (_startIndex >= 0) {
@@ -72,22 +87,72 @@ bool FFVideoReader::open() {
         sprintf(st, "%lld", _startIndex);
         av_dict_set(&options, "start_number", st, 0);
     }
-    qDebug() << "Open Called for file" << _path << _startIndex;
+    _pFormat = avformat_alloc_context();
+    _input.reset();
+    if (_mappedIO && _startIndex < 0 && !IsImageSequence(_path)) {
+        _input = MappedInput::open(_path);
+        if (_input) {
+            _pFormat->pb = _input->context();
+            _pFormat->flags |= AVFMT_FLAG_CUSTOM_IO;
+        } else {
+            qInfo() << "Unable to map" << _path << "reading it through the file protocol";
+        }
+    }
+    if (_interrupt != nullptr) {
+        _pFormat->interrupt_callback.callback = [](void* opaque) { return static_cast<std::atomic<bool>*>(opaque)->load() ? 1 : 0; };
+        _pFormat->interrupt_callback.opaque = const_cast<std::atomic<bool>*>(_interrupt);
+    }
+    // A reopen only needs to read as far as the last probe got, with some slack
+    if (probeSize > 0 && probeSize < _pFormat->probesize)
+        _pFormat->probesize = std::max(probeSize + probeSize / 4, 64LL * 1024);
+    qDebug() << "Open Called for file" << _path << _startIndex << "probesize" << _pFormat->probesize;
     int ret = avformat_open_input(&_pFormat, path.c_str(), nullptr, &options);
+    av_dict_free(&options);
     if(ret) {
         qCritical() << "Unable to open file" << _path;
+        _input.reset();
         return false;
     }
     ret = avformat_find_stream_info(_pFormat, nullptr);
     if(ret) {
         qCritical() << "Unable to find stream information in file" << _path;
+        avformat_close_input(&_pFormat);
+        _input.reset();
         return false;
     }
     _videoStreamIndex = av_find_best_stream(_pFormat, AVMEDIA_TYPE_VIDEO, -1, -1, nullptr, 0);
     if(_videoStreamIndex < 0) {
         qCritical() << "Unable to find video stream information in file" << _path;
+        avformat_close_input(&_pFormat);
+        _input.reset();
+        return false;
+    }
+    const AVCodecParameters* par = _pFormat->streams[_videoStreamIndex]->codecpar;
+    if (probeSize > 0 && (par->width <= 0 || par->format < 0 || _pFormat->streams[_videoStreamIndex]->r_frame_rate.num == 0)) {
+        avformat_close_input(&_pFormat);
+        _input.reset();
         return false;
     }
+    _probe.probeBytes = _pFormat->pb != nullptr ? avio_tell(_pFormat->pb) : 0;
+    return true;
+}
+
+bool FFVideoReader::open() {
+    qInfo() << "Trying to open the file " << _path << isOpen();
+    auto openBegin = chrono::steady_clock::now();
+    _isOpen = false;
+    auto path = _path.toStdString();
+    _fileId = FileIdentity::of(_path);
+    ProbeRecord cached;
+    bool probeCached = _startIndex < 0 && !_boundsHelper && ProbeRecord::load(_fileId, cached);
+    if (probeCached && !(openInput(cached.probeBytes) && _videoStreamIndex == cached.streamIndex)) {
+        qInfo() << "Cached probe not enough for" << _path << "probing again";
+        if (_pFormat != nullptr)
+            avformat_close_input(&_pFormat);
+        probeCached = false;
+    }
+    if (!probeCached && !openInput(0))
+        return false;
     const AVStream *pStream = _pFormat->streams[_videoStreamIndex];
     qDebug() << "CodecID:" << pStream->codecpar->codec_id;
     const AVCodec* pCodec = avcodec_find_decoder(pStream->codecpar->codec_id);
@@ -96,7 +161,7 @@ bool FFVideoReader::open() {
         return false;
     }
     _pCodecContext = avcodec_alloc_context3(pCodec);
-    ret = avcodec_parameters_to_context(_pCodecContext, pStream->codecpar);
+    int ret = avcodec_parameters_to_context(_pCodecContext, pStream->codecpar);
     if(ret < 0) {
         qCritical() << "Unable to copy decoded video stream info with index" << _videoStreamIndex << "from file" << _path ;
         avcodec_free_context(&_pCodecContext);
@@ -181,34 +246,132 @@ bool FFVideoReader::open() {
     _info["pixelFormat"] = av_get_pix_fmt_name(_pCodecContext->pix_fmt);
     _info["isBlackAndWhite"] = _pCodecContext->pix_fmt == AV_PIX_FMT_GRAY8;
     _info["isTelecined"] = false; // can we detect this (or a separate isDeinterlaced) later?
-    _pSwsContext = sws_getContext(_pCodecContext->width, _pCodecContext->height,_pCodecContext->pix_fmt, _width, _height, AV_PIX_FMT_RGBA64LE, SWS_BICUBIC, NULL,NULL,NULL);
-    if(_pSwsContext == nullptr) {
+    _fullWidth = _pCodecContext->width;
+    _maxLowres = pCodec->max_lowres;
+    updateOutputSize();
+    if(!_converter.prepare(_pCodecContext->width, _pCodecContext->height, _pCodecContext->pix_fmt, _outWidth, _outHeight)) {
         qCritical() << "Unable to setup conversion context";
         avcodec_free_context(&_pCodecContext);
         return false;
     }
+    sizeWindow();
+    playRangesChanged();
     av_log_set_callback(log_callback_report);
-    av_dump_format(_pFormat, 0, path.c_str(), 0);
+    if (!_boundsHelper)
+        av_dump_format(_pFormat, 0, path.c_str(), 0);
     _isOpen = true;
     _isEOF = false;
+    _info["boundsPending"] = false;
+    if(_startIndex < 0 && !IsImageSequence(_path) && !_boundsHelper)
+        startIndexing();
     if(_startIndex < 0) {
         _duration += _startTC;
         qInfo() << "Determining start and end" << _startTC << _duration;
-        if (_duration < 0) {
-            estimateDuration();
+        if (probeCached) {
+            _duration = cached.duration;
+            readStart();
+            _startTC = cached.start;
+        } else if (_lazyOpen && !_boundsHelper) {
+            // The end is found by a helper reader in the background; until then go by the bitrate, if there is one,
+            // or leave it unknown
+            bool endUnsure = _duration < 0 || _pFormat->duration_estimation_method == AVFMT_DURATION_FROM_BITRATE;
+            if (_duration < 0)
+                _duration = _pFormat->bit_rate > 0 && _size > 0 ? _startTC + _size * 8.0 / _pFormat->bit_rate / av_q2d(_timebase) : -1;
+            _startTC = readStart();
+            if (endUnsure)
+                startProbe();
+            else
+                saveProbe();
+        } else {
+            if (_duration < 0 || _boundsHelper) {
+                estimateDuration();
+            }
+            _startTC = readFirst();
+            if (!_boundsHelper)
+                saveProbe();
         }
-        _startTC = readFirst();
-        qInfo() << "Determined start and end" << _startTC << _duration;
+        qInfo() << "Determined start and end" << _startTC << _duration << (probeCached ? "from cache" : "");
     }
     _info["adjustmentFactor"] = computeAdjustedFrameSize(_info["resolution"].toSize(), _info["sar"].toDouble());
     _info["adjustedSize"] = _adjustedSize;
     _info["start"] = _startTC;  // Presentation timestamp (PTS) of first frame in stream in stream time base.
     _info["startTimeMs"] = tc2ms(_startTC); // PTS of first frame in ms --- I think this is always 0? becase tc2ms subtracts _startTC.
-    _info["duration"] = tc2ms(_duration);   // Duration in ms.
-    qInfo() << "Successfully opened " << _path;
+    _info["duration"] = durationKnown() ? tc2ms(_duration) : -1;   // Duration in ms, -1 while unknown.
+    _info["decodeAheadCapacity"] = (int)_aheadQueue.capacity();
+    _info["frameCacheBytes"] = _info["reverseCacheBytes"] = (long long)_gopCache.budget();
+    if(!_boundsHelper)
+        _gopCache.open(_path, _videoStreamIndex, _timestep, _startTC, &_index, &_indexReady);
+    _info["diskCacheBytes"] = (long long)_diskCache.budget();
+    if(_diskCacheEnabled && !_boundsHelper)
+        _diskCache.open(_fileId);
+    _info["probeCached"] = probeCached;
+    _info["mappedIO"] = _input != nullptr;
+    _info["openMs"] = chrono::duration<double, milli>(chrono::steady_clock::now() - openBegin).count();
+    openAudio();
+    qInfo() << "Successfully opened " << _path << "in" << _info["openMs"].toDouble() << "ms";
+    if(_decodeAhead)
+        startDecodeAhead();
+    return true;
+}
+
+void FFVideoReader::startProbe() {
+    _probeCancel = false;
+    _probeReady = false;
+    _info["boundsPending"] = true;
+    _probeThread = std::thread([this, path = _path] {
+        auto begin = chrono::steady_clock::now();
+        FFVideoReader helper(path);
+        helper._boundsHelper = true;
+        helper._interrupt = &_probeCancel;
+        if (!helper.open() || _probeCancel)
+            return;
+        _probedDuration = helper._duration;
+        _probeReady = true;
+        qInfo() << "Found end of" << path << "in the background after"
+                << chrono::duration<double, milli>(chrono::steady_clock::now() - begin).count() << "ms";
+    });
+}
+
+void FFVideoReader::stopProbe() {
+    _probeCancel = true;
+    if (_probeThread.joinable())
+        _probeThread.join();
+    _probeReady = false;
+}
+
+bool FFVideoReader::applyProbe() {
+    if (!_probeReady.exchange(false))
+        return false;
+    if (_probeThread.joinable())
+        _probeThread.join();
+    _duration = _probedDuration;
+    _info["length"] = _duration;
+    _info["duration"] = tc2ms(_duration);
+    _info["boundsPending"] = false;
+    saveProbe();
+    emit infoChanged();
     return true;
 }
 
+void FFVideoReader::saveProbe() {
+    if (IsImageSequence(_path))
+        return;
+    _probe.streamIndex = _videoStreamIndex;
+    _probe.start = _startTC;
+    _probe.duration = _duration;
+    _probe.save(_fileId);
+}
+
+long long FFVideoReader::readStart() {
+    // Straight after probing the demuxer is at the beginning already, the first frame needs no seek
+    if (readNext()) {
+        _currentIndex = 0;
+        if (currentPts() >= 0)
+            return currentPts();
+    }
+    return readFirst();
+}
+
 void FFVideoReader::estimateDuration() {
     _duration = 1e10;
     _duration = readLast();
@@ -270,23 +433,416 @@ unsigned FFVideoReader::detectOrientation(const AVStream *pStream) {
 }
 
 void FFVideoReader::close() {
+    stopProbe();
+    _decodeAhead = false;
+    stopDecodeAhead(false);
+    if (_audio) {
+        _audio->close();
+        _audio.reset();
+    }
+    _audioStreamIndex = -1;
+    dropParkedPackets();
+    _gopCache.close();
+    _diskCache.close();
+    stopIndexing();
     qInfo() << "Trying to close the file" << isReadingNext << _path << isOpen();
     if (isOpen() && !isReadingNext) {
         qInfo() << "Closing the file" << _path;
         clearFrames();
         avformat_close_input(&_pFormat);
         avformat_free_context(_pFormat);
+        _input.reset();
         avcodec_free_context(&_pCodecContext);
-        sws_freeContext(_pSwsContext);
+        _converter.reset();
         _pCodecContext = nullptr;
         _pFormat = nullptr;
         Reader::close();
     }
 }
 
+void FFVideoReader::startIndexing() {
+    if (_index.load(_fileId, _videoStreamIndex)) {
+        qInfo() << "Loaded packet index for" << _path << _index.frameCount() << "frames";
+        _indexReady = true;
+        return;
+    }
+    _indexCancel = false;
+    _indexThread = std::thread([this, path = _path, id = _fileId, stream = _videoStreamIndex] {
+        if (_index.build(path, stream, _indexCancel)) {
+            _index.save(id);
+            _indexReady = true;
+        }
+    });
+}
+
+void FFVideoReader::stopIndexing() {
+    _indexCancel = true;
+    if (_indexThread.joinable())
+        _indexThread.join();
+    _indexReady = false;
+    _index.clear();
+}
+
+bool FFVideoReader::stepBackFromCache() {
+    long long target = currentPts() - 1;
+    if (target < _startTC)
+        return false;
+    vector<AVFrame*> frames;
+    if (_gopCache.fetch(target, (int)_frames.capacity(), frames) == 0)
+        return false;
+    // Whatever the decode-ahead queue holds is stale now; the next real seek flushes it
+    retainWindow();
+    clearFrames();
+    for (auto pFrame : frames)
+        _frames.push_back(pFrame);
+    _framesSynced = false;
+    _currentIndex = _frames.size() - 1;
+    _lastShown = currentPts();
+    _isEOF = false;
+    return true;
+}
+
+bool FFVideoReader::loadFromDisk(long long pts) {
+    if (!_diskCache.isOpen())
+        return false;
+    AVFrame* pFrame = _framePool.acquire();
+    if (!_diskCache.load(pts, _timestep, pFrame)) {
+        _framePool.release(pFrame);
+        return false;
+    }
+    // As with the GOP cache, the decode-ahead queue is stale from here on and the next real seek flushes it
+    retainWindow();
+    clearFrames();
+    _frames.push_back(pFrame);
+    _framesSynced = false;
+    _currentIndex = 0;
+    _lastShown = currentPts();
+    _isEOF = false;
+    return true;
+}
+
+void FFVideoReader::cacheAndClear(bool ignorePlayHead) {
+    if (!_diskCache.isOpen())
+        return;
+    DecodeAheadPause pause(this);
+    for (size_t i = 0; i < _frames.size(); i++)
+        _diskCache.store(_frames[i]);
+    AVFrame* pCurrent = !ignorePlayHead && isIndexValid() ? av_frame_clone(getCurrentFrame()) : nullptr;
+    bool wasLast = isIndexValid() && _currentIndex == (int)_frames.size() - 1;
+    clearFrames();
+    _currentIndex = -1;
+    if (pCurrent != nullptr) {
+        _frames.push_back(pCurrent);
+        _currentIndex = 0;
+        // Dropping frames after the current one puts the window behind the demuxer
+        _framesSynced = _framesSynced && wasLast;
+    }
+    auto range = getFrameBufferRange();
+    emit frameBufferRangeChangedoo(vector<long long>(range.begin(), range.end()));
+}
+
+vector<int64_t> FFVideoReader::getFrameBufferRange() {
+    vector<int64_t> pts = _diskCache.isOpen() ? _diskCache.cachedPts() : vector<int64_t>();
+    for (size_t i = 0; i < _frames.size(); i++)
+        pts.push_back(_frames[i]->pts);
+    sort(pts.begin(), pts.end());
+    pts.erase(unique(pts.begin(), pts.end()), pts.end());
+    return pts;
+}
+
+void FFVideoReader::retainWindow() {
+    // Only a window the decoder produced is a contiguous run; frames served from a cache are in it already.
+    // A jump between play ranges splits it.
+    if (!_framesSynced || _frames.empty() || !fullSize(_frames.front()))
+        return;
+    vector<AVFrame*> frames;
+    for (size_t i = 0; i < _frames.size(); i++) {
+        frames.push_back(_frames[i]);
+        if (i + 1 < _frames.size() && _frames[i + 1]->pts - _frames[i]->pts > 2 * _timestep) {
+            _gopCache.retain(frames, _frames[i]->pts + _timestep);
+            frames.clear();
+        }
+    }
+    _gopCache.retain(frames, _frames.back()->pts + _timestep);
+}
+
+bool FFVideoReader::loadFromSegments(long long pts) {
+    vector<AVFrame*> frames;
+    int index = 0;
+    if (_gopCache.peek(pts, (int)_frames.capacity(), frames, index) == 0)
+        return false;
+    retainWindow();
+    clearFrames();
+    for (auto pFrame : frames)
+        _frames.push_back(pFrame);
+    _framesSynced = false;
+    _currentIndex = index;
+    _lastShown = currentPts();
+    _isEOF = false;
+    return true;
+}
+
+void FFVideoReader::sizeWindow() {
+    size_t capacity = _maxSize;
+    if (_maxSize <= 0) {
+        int frameBytes = av_image_get_buffer_size(_pCodecContext->pix_fmt, _pCodecContext->width, _pCodecContext->height, 1);
+        capacity = frameBytes > 0 ? std::clamp<size_t>(_windowBytes / frameBytes, 3, 240) : 10;
+    }
+    if (capacity != _frames.capacity()) {
+        // Resizing drops the window; it goes through the segment cache so the current frame survives
+        bool hadFrames = !_frames.empty();
+        retainWindow();
+        _frames.reset(capacity);
+        _currentIndex = -1;
+        _framesSynced = true;
+        if (hadFrames)
+            loadFromSegments(_lastShown);
+    }
+    _framePool.reserve(capacity + _aheadQueue.capacity() + 4);
+    _info["frameWindow"] = (int)capacity;
+    _info["frameWindowBytes"] = (long long)_windowBytes;
+}
+
+void FFVideoReader::updateOutputSize() {
+    if (_width <= 0 || _height <= 0)
+        return;
+    _outWidth = _width;
+    _outHeight = _height;
+    if (_outputSize.width() > 0 && _outputSize.height() > 0) {
+        bool transposed = _rotate == ROTATE_90_CLOCKWISE || _rotate == ROTATE_90_COUNTERCLOCKWISE;
+        QSize target = transposed ? _outputSize.transposed() : _outputSize;
+        double scale = std::min({1.0, target.width() / double(_width), target.height() / double(_height)});
+        if (scale < 1) {
+            // Even, so chroma lines up in the converter's slices
+            _outWidth = std::max(2, int(_width * scale) & ~1);
+            _outHeight = std::max(2, int(_height * scale) & ~1);
+        }
+    }
+    // The smallest decode that still covers the output. Lowres divides the coded picture, before the sample
+    // aspect ratio stretches it to _width, so compare in coded pixels; the stream's, as the codec context
+    // reports its size already divided once it decodes at lowres.
+    int lowres = 0;
+    if (_lowresEnabled && _pFormat != nullptr && _videoStreamIndex >= 0) {
+        const AVCodecParameters* pParams = _pFormat->streams[_videoStreamIndex]->codecpar;
+        const double neededWidth = _outWidth * double(pParams->width) / _width;
+        const double neededHeight = _outHeight * double(pParams->height) / _height;
+        while (lowres < _maxLowres && (pParams->width >> (lowres + 1)) >= neededWidth && (pParams->height >> (lowres + 1)) >= neededHeight)
+            lowres++;
+    }
+    _lowres = lowres;
+    _info["outputSize"] = frameSize();
+    _info["lowres"] = _lowres;
+}
+
+bool FFVideoReader::reopenDecoder() {
+    const AVStream* pStream = _pFormat->streams[_videoStreamIndex];
+    const AVCodec* pCodec = avcodec_find_decoder(pStream->codecpar->codec_id);
+    AVCodecContext* pContext = avcodec_alloc_context3(pCodec);
+    if (pContext == nullptr || avcodec_parameters_to_context(pContext, pStream->codecpar) < 0) {
+        avcodec_free_context(&pContext);
+        return false;
+    }
+    pContext->lowres = _lowres;
+    if (avcodec_open2(pContext, pCodec, nullptr) < 0) {
+        qWarning() << "Unable to reopen the decoder at lowres" << _lowres << "staying at" << _pCodecContext->lowres;
+        avcodec_free_context(&pContext);
+        _lowres = _pCodecContext->lowres;
+        return false;
+    }
+    if (pContext->pix_fmt == AV_PIX_FMT_NONE)
+        pContext->pix_fmt = AV_PIX_FMT_YUV420P;
+    avcodec_free_context(&_pCodecContext);
+    _pCodecContext = pContext;
+    qInfo() << "Decoding" << _path << "at lowres" << _lowres;
+    return true;
+}
+
+bool FFVideoReader::scrubTo(long long pts) {
+    DecodeAheadPause pause(this);
+    long long key = pts;
+    if (_scrubMode == ScrubMode::KeyFrame && _indexReady) {
+        // Nearest keyframe on either side, the one after is as cheap to show as the one before
+        const PacketIndexEntry* pBefore = _index.keyFrameBefore(pts);
+        const PacketIndexEntry* pAfter = _index.keyFrameAfter(pts);
+        if (pBefore != nullptr && pAfter != nullptr && pAfter->pts - pts < pts - pBefore->pts)
+            key = pAfter->pts;
+    }
+    if (!seekToKeyFrame(key))
+        return false;
+    _pCodecContext->skip_frame = _scrubMode == ScrubMode::KeyFrame ? AVDISCARD_NONKEY : AVDISCARD_NONREF;
+    bool ok = readNext();
+    // NONREF: reference frames up to the target; the first one past it is the stand-in for what follows
+    while (ok && _scrubMode == ScrubMode::NonRef && _frames.back()->pts + _timestep / 2 < pts && !cancelled())
+        ok = readNext();
+    _pCodecContext->skip_frame = AVDISCARD_DEFAULT;
+    // The window is sparse, whatever reads on goes through a real seek
+    _framesSynced = false;
+    _scrubWindow = true;
+    if (_frames.empty()) {
+        avcodec_flush_buffers(_pCodecContext);
+        return false;
+    }
+    _currentIndex = _frames.upperBound(key + _timestep / 2) - 1;
+    if (_currentIndex < 0)
+        _currentIndex = 0;
+    _lastShown = currentPts();
+    // The decoder still holds frames decoded against references it skipped: flush it and put the demuxer
+    // back at the keyframe of the frame shown, so whoever decodes next (decode-ahead included) starts clean
+    if (!seekDemuxer(_lastShown))
+        avcodec_flush_buffers(_pCodecContext);
+    _decodedPts = LLONG_MIN;
+    _scrubSeeks++;
+    return true;
+}
+
+void FFVideoReader::openAudio() {
+    _audioStreamIndex = -1;
+    if (_audioSink.isEmpty() || _boundsHelper)
+        return;
+    int index = av_find_best_stream(_pFormat, AVMEDIA_TYPE_AUDIO, -1, _videoStreamIndex, nullptr, 0);
+    if (index < 0)
+        return;
+    unique_ptr<AudioSink> sink = AudioOutput::createSink(_audioSink);
+    if (!sink) {
+        qWarning() << "Unknown audio sink" << _audioSink;
+        return;
+    }
+    auto audio = make_shared<AudioOutput>(std::move(sink));
+    // Audio times are taken relative to the video's start, like tc2ms()
+    if (!audio->open(_pFormat->streams[index], _startTC * av_q2d(_timebase) * 1000)) {
+        qWarning() << "Unable to play audio stream" << index << "of" << _path;
+        return;
+    }
+    _audio = audio;
+    _audioStreamIndex = index;
+    _info["audioStream"] = index;
+    qInfo() << "Playing audio stream" << index << "through" << _audioSink;
+}
+
+int FFVideoReader::readPacket(AVPacket* pPacket) {
+    if (_parkedVideo.empty())
+        return av_read_frame(_pFormat, pPacket);
+    AVPacket* pParked = _parkedVideo.front();
+    _parkedVideo.pop_front();
+    av_packet_move_ref(pPacket, pParked);
+    av_packet_free(&pParked);
+    return 0;
+}
+
+void FFVideoReader::dropParkedPackets() {
+    for (AVPacket* pPacket : _parkedVideo)
+        av_packet_free(&pPacket);
+    _parkedVideo.clear();
+}
+
+void FFVideoReader::demuxForAudio() {
+    // Called by whoever owns the decoder
+    if (!_audio)
+        return;
+    AVPacket* pPacket = av_packet_alloc();
+    while (_parkedVideo.size() < MaxParkedPackets && _audio->hungry() && av_read_frame(_pFormat, pPacket) >= 0) {
+        if (pPacket->stream_index == _audioStreamIndex) {
+            _audio->decode(pPacket);
+        } else if (pPacket->stream_index == _videoStreamIndex) {
+            AVPacket* pParked = av_packet_alloc();
+            av_packet_move_ref(pParked, pPacket);
+            _parkedVideo.push_back(pParked);
+        }
+        av_packet_unref(pPacket);
+    }
+    av_packet_free(&pPacket);
+}
+
+void FFVideoReader::resyncAudio() {
+    // The window came from the caches, so the demuxer is somewhere else. Go back to the keyframe before the frame
+    // on screen for the audio, and let the video decode through to where the window ends without keeping frames.
+    DecodeAheadPause pause(this);
+    long long pts = currentPts();
+    if (pts < 0 || _frames.empty() || !seekDemuxer(pts))
+        return;
+    _audio->flush(tc2ms(pts));
+    _decodedPts = LLONG_MIN;
+    _skipBefore = _frames.back()->pts + _timestep;
+    _framesSynced = true;
+}
+
+void FFVideoReader::playRangesChanged() {
+    std::lock_guard<std::mutex> g(_scheduleMutex);
+    if (_timestep <= 0)
+        return; // not open yet, open() picks the ranges up
+    _schedule = _playRanges.mapped([this](long long ms) { return ms2tc(ms); });
+}
+
+bool FFVideoReader::skipGap() {
+    // Called by whoever owns the decoder, before reading on
+    long long last = _decodedPts;
+    if (last == LLONG_MIN || _skipBefore != LLONG_MIN)
+        return false;
+    long long next = last + _timestep, target;
+    {
+        std::lock_guard<std::mutex> g(_scheduleMutex);
+        if (_schedule.empty() || _schedule.contains(next))
+            return false;
+        auto range = _schedule.after(next);
+        if (!range)
+            return false; // past the last range, play on
+        target = range->first;
+    }
+    const PacketIndexEntry* pKey = _indexReady ? _index.keyFrameBefore(target) : nullptr;
+    const bool moveDemuxer = pKey == nullptr || pKey->pts > last;
+    if (moveDemuxer && !seekDemuxer(target))
+        return false;
+    if (_audio)
+        _audio->skip(tc2ms(last + _timestep), tc2ms(target), moveDemuxer);
+    _skipBefore = target;
+    _gapJumps++;
+    return true;
+}
+
+bool FFVideoReader::seekDemuxer(long long pts) {
+    const PacketIndexEntry* pKey = _indexReady ? _index.keyFrameBefore(pts) : nullptr;
+    int ret;
+    if (pKey != nullptr)
+        ret = _byteSeek && pKey->pos >= 0
+            ? avformat_seek_file(_pFormat, -1, INT64_MIN, pKey->pos, INT64_MAX, AVSEEK_FLAG_BYTE)
+            : av_seek_frame(_pFormat, _videoStreamIndex, pKey->pts, AVSEEK_FLAG_BACKWARD);
+    else if (_byteSeek && durationKnown())
+        ret = avformat_seek_file(_pFormat, -1, INT64_MIN, (pts - _startTC) * _size / _duration, INT64_MAX, AVSEEK_FLAG_BYTE);
+    else
+        ret = av_seek_frame(_pFormat, _videoStreamIndex, pts, AVSEEK_FLAG_BACKWARD);
+    if (ret < 0) {
+        qWarning() << "Seek to play range at" << pts << "failed";
+        return false;
+    }
+    dropParkedPackets();
+    avcodec_flush_buffers(_pCodecContext);
+    return true;
+}
+
 bool FFVideoReader::seekToKeyFrame(long long pts, int attempt) {
+    retainWindow();
     clearFrames();
-    if (_byteSeek) {
+    _framesSynced = true;
+    _decodedPts = LLONG_MIN;
+    _skipBefore = LLONG_MIN;
+    dropParkedPackets();
+    if (_audio)
+        _audio->flush(tc2ms(pts));
+    if (_pCodecContext->lowres != _lowres)
+        reopenDecoder();
+    if (_indexReady && attempt == 0) {
+        const PacketIndexEntry* pKey = _index.keyFrameBefore(pts);
+        int ret = _byteSeek && pKey->pos >= 0
+            ? avformat_seek_file(_pFormat, -1, INT64_MIN, pKey->pos, INT64_MAX, AVSEEK_FLAG_BYTE)
+            : av_seek_frame(_pFormat, _videoStreamIndex, pKey->pts, AVSEEK_FLAG_BACKWARD);
+        if (ret >= 0) {
+            avcodec_flush_buffers(_pCodecContext);
+            return true;
+        }
+        qWarning() << "Indexed seek failed for" << pts << "falling back to timestamp seek";
+    }
+    // Without an end there is nothing to interpolate a byte position from
+    if (_byteSeek && durationKnown()) {
         long long location = (pts-_timestep*attempt*5-_startTC)*_size/_duration;
         if(avformat_seek_file(_pFormat, -1, INT64_MIN, location, INT64_MAX, AVSEEK_FLAG_BYTE) < 0) {
             qCritical() << "Seek failed to location" << pts << "on stream" << _videoStreamIndex;
@@ -302,22 +858,42 @@ bool FFVideoReader::seekToKeyFrame(long long pts, int attempt) {
     return true;
 }
 
-Mat FFVideoReader::convertFrame(std::shared_ptr<AVFrame> pFrame) {
+Mat FFVideoReader::convertFrame(AVFrame* pFrame) {
     if (pFrame != nullptr && pFrame->height > 0 && pFrame->width > 0) {
-        Mat frame(_height, _width, CV_16UC4);
-        int step = frame.step;
-        sws_scale(_pSwsContext, pFrame->data, pFrame->linesize, 0, pFrame->height, &frame.data, &step);
-        if (_rotate < 3) {
-            Mat rframe;
-            cv::rotate(frame, rframe, _rotate);
-            return rframe;
-        }
-        return frame;
+        bool transposed = _rotate == ROTATE_90_CLOCKWISE || _rotate == ROTATE_90_COUNTERCLOCKWISE;
+        QSize size = transposed ? QSize(_height, _width) : QSize(_width, _height);
+        Mat frame(size.height(), size.width(), CV_16UC4);
+        if (_converter.convert(pFrame, _width, _height, frame.data, frame.step, PixelLayout::RGBA16, _rotate))
+            return frame;
     }
     return Mat();
 }
 
-Mat FFVideoReader::convertFrameRGB(std::shared_ptr<AVFrame> pFrame) {
+bool FFVideoReader::getFrameInto(uchar* dst, int stride, PixelLayout layout) {
+    AVFrame* pFrame = getCurrentFrame();
+    if (pFrame == nullptr)
+        return false;
+    _lastShown = pFrame->pts;
+    return _converter.convert(pFrame, _outWidth, _outHeight, dst, stride, layout, _rotate);
+}
+
+size_t FFVideoReader::frameBufferSize(PixelLayout layout) {
+    if (layout != PixelLayout::YUVPlanar)
+        return Reader::frameBufferSize(layout);
+    AVFrame* pFrame = getCurrentFrame();
+    if (pFrame != nullptr)
+        return av_image_get_buffer_size((AVPixelFormat)pFrame->format, pFrame->width, pFrame->height, 1);
+    return _pCodecContext == nullptr ? 0 : av_image_get_buffer_size(_pCodecContext->pix_fmt, _pCodecContext->width, _pCodecContext->height, 1);
+}
+
+Mat FFVideoReader::getFrameView() {
+    AVFrame* pFrame = getCurrentFrame();
+    if (pFrame == nullptr || _rotate < 3 || pFrame->width != _outWidth || pFrame->height != _outHeight)
+        return Mat();
+    return FrameConverter::wrap(pFrame);
+}
+
+Mat FFVideoReader::convertFrameRGB(AVFrame* pFrame) {
     Mat frame = convertFrame(pFrame), temp;
     frame.convertTo(temp, CV_8UC4, 1/256.0f);
     cvtColor(temp, frame, COLOR_RGBA2BGR);
@@ -326,12 +902,133 @@ Mat FFVideoReader::convertFrameRGB(std::shared_ptr<AVFrame> pFrame) {
 
 void FFVideoReader::readTill(long long pts) {
     while (_frames.empty() || (!containsFrame(pts) && _frames.back()->pts < pts && _frames.front()->pts < pts)) {
-        if (!readNext())
+        if (cancelled() && !_frames.empty()) {
+            _seeksCancelled++;
             break;
+        }
+        if (!advance())
+            break;
+    }
+}
+
+bool FFVideoReader::advance(bool scheduled) {
+    // While paused (_aheadFlush) the caller owns the decoder and reads synchronously.
+    if (!_aheadThread.joinable() || _aheadFlush) {
+        if (scheduled)
+            skipGap();
+        bool ok = readNext();
+        if (scheduled)
+            demuxForAudio();
+        return ok;
+    }
+    return popAhead();
+}
+
+bool FFVideoReader::popAhead() {
+    AVFrame* pFrame = nullptr;
+    bool stalled = false;
+    while (!_aheadQueue.pop(pFrame)) {
+        if (_aheadEOF && _aheadQueue.empty()) {
+            _isEOF = true;
+            return false;
+        }
+        if (!stalled) {
+            _aheadStalls++;
+            stalled = true;
+        }
+        std::unique_lock<std::mutex> l(_aheadWaitMutex);
+        _aheadCv.wait_for(l, std::chrono::milliseconds(20), [this] { return !_aheadQueue.empty() || _aheadEOF; });
+    }
+    _aheadCv.notify_all();
+    _isEOF = false;
+    addFrame(pFrame);
+    return true;
+}
+
+bool FFVideoReader::enqueueFrame(AVFrame* pFrame) {
+    while (!_aheadQueue.push(pFrame)) {
+        if (_aheadStop || _aheadFlush) {
+            _framePool.release(pFrame);
+            return false;
+        }
+        std::unique_lock<std::mutex> l(_aheadWaitMutex);
+        _aheadCv.wait_for(l, std::chrono::milliseconds(20), [this] { return !_aheadQueue.full() || _aheadStop || _aheadFlush; });
+    }
+    _aheadCv.notify_all();
+    return true;
+}
+
+void FFVideoReader::decodeAheadLoop() {
+    while (!_aheadStop) {
+        if (_aheadQueue.full() && _audio && !_aheadFlush) {
+            // Video is far enough ahead, keep the audio from running dry meanwhile
+            std::lock_guard<std::mutex> g(_decodeMutex);
+            if (!_aheadStop && !_aheadFlush && _isOpen)
+                demuxForAudio();
+        }
+        if (_aheadQueue.full() || _aheadEOF || _aheadFlush) {
+            std::unique_lock<std::mutex> l(_aheadWaitMutex);
+            _aheadCv.wait_for(l, std::chrono::milliseconds(20), [this] {
+                return _aheadStop || (!_aheadQueue.full() && !_aheadEOF && !_aheadFlush);
+            });
+            continue;
+        }
+        std::lock_guard<std::mutex> g(_decodeMutex);
+        if (!_aheadStop && !_aheadFlush && _isOpen) {
+            skipGap();
+            readNext(true);
+        }
+    }
+}
+
+void FFVideoReader::startDecodeAhead() {
+    if (_aheadThread.joinable() || !_isOpen)
+        return;
+    _aheadStop = false;
+    _aheadFlush = false;
+    _aheadEOF = false;
+    _aheadThread = std::thread(&FFVideoReader::decodeAheadLoop, this);
+}
+
+void FFVideoReader::stopDecodeAhead(bool resync) {
+    if (!_aheadThread.joinable())
+        return;
+    _aheadStop = true;
+    _aheadCv.notify_all();
+    _aheadThread.join();
+    // Queued frames are already past the demuxer position; if any get dropped, re-sync on the current frame.
+    bool dropped = !_aheadQueue.empty();
+    AVFrame* pFrame = nullptr;
+    while (_aheadQueue.pop(pFrame))
+        _framePool.release(pFrame);
+    if (dropped && resync && _isOpen && isIndexValid()) {
+        long long pts = currentPts();
+        clearFrames();
+        seek(pts);
     }
 }
 
-int FFVideoReader::decodeAndAdd(AVPacket* pPacket) {
+void FFVideoReader::pauseDecodeAhead() {
+    if (_aheadPauseDepth++ > 0 || !_aheadThread.joinable())
+        return;
+    _aheadFlush = true;
+    _aheadCv.notify_all();
+    _decodeLock.lock();
+    AVFrame* pFrame = nullptr;
+    while (_aheadQueue.pop(pFrame))
+        _framePool.release(pFrame);
+}
+
+void FFVideoReader::resumeDecodeAhead() {
+    if (--_aheadPauseDepth > 0 || !_decodeLock.owns_lock())
+        return;
+    _aheadEOF = false;
+    _aheadFlush = false;
+    _decodeLock.unlock();
+    _aheadCv.notify_all();
+}
+
+int FFVideoReader::decodeAndAdd(AVPacket* pPacket, bool ahead) {
     int count = 0;
     int response = avcodec_send_packet(_pCodecContext, pPacket);
     if (response < 0 && pPacket != nullptr) {
@@ -341,21 +1038,35 @@ int FFVideoReader::decodeAndAdd(AVPacket* pPacket) {
         return response;
     }
     while(response >= 0) {
-        AVFrame* pFrame = av_frame_alloc();
+        AVFrame* pFrame = _framePool.acquire();
         response = avcodec_receive_frame(_pCodecContext, pFrame);
         if (response == AVERROR(EAGAIN) || response == AVERROR_EOF) {
-            av_frame_free(&pFrame);
+            _framePool.release(pFrame);
             return count;
         } else if(response < 0) {
             char errorMsg[AV_ERROR_MAX_STRING_SIZE];
             av_make_error_string(errorMsg, AV_ERROR_MAX_STRING_SIZE, response);
             qCritical() << "Error decoding packet" << errorMsg;
-            av_frame_free(&pFrame);
+            _framePool.release(pFrame);
             return response;
         }
         pFrame->pts = pFrame->best_effort_timestamp;
+        if (_skipBefore != LLONG_MIN) {
+            // Crossing a gap between play ranges: frames before the next range only feed the decoder
+            if (pFrame->pts + _timestep / 2 < _skipBefore) {
+                _framePool.release(pFrame);
+                continue;
+            }
+            _skipBefore = LLONG_MIN;
+        }
+        _decodedPts = pFrame->pts;
         // qCritical() << "FF pFrame: w: " << pFrame->width << pFrame->pts << pFrame->time_base.num;
-        if (addFrame(std::shared_ptr<AVFrame>(pFrame, [](AVFrame* ptr) { av_frame_free(&ptr); }))) {
+        if (ahead) {
+            // Paused or stopped with the queue full: the caller takes the decoder over, stop demuxing for the queue
+            if (!enqueueFrame(pFrame))
+                return AheadFlushed;
+            count++;
+        } else if (addFrame(pFrame)) {
             count++;
         }
     }
@@ -364,34 +1075,36 @@ int FFVideoReader::decodeAndAdd(AVPacket* pPacket) {
 
 void FFVideoReader::eraseFramesTo(int size) {
     while (_frames.size() > size) {
-        _frames.erase(_frames.begin());
+        _frames.pop_front();
     }
 }
 
-bool FFVideoReader::addFrame(std::shared_ptr<AVFrame> pFrame) {
+bool FFVideoReader::addFrame(AVFrame* pFrame) {
     if (_frames.empty() || pFrame->pts != _frames.back()->pts) {
-        _frames.push_back(pFrame);
-        eraseFramesTo(_maxSize);
+        if (_frames.full() && _diskCache.isOpen() && fullSize(_frames.front()))
+            _diskCache.store(_frames.front());
+        _frames.push_back(pFrame); // evicts the oldest frame when the ring is full
         return true;
     }
+    _framePool.release(pFrame);
     return false;
 }
 
 int FFVideoReader::findIndex(long long pts) {
-    for (int i = 0; i<_frames.size(); i++) {
-        if (pts <= (_frames[i]->pts + _timestep/2.0f) && pts > (_frames[i]->pts - _timestep/2.0f)) {
-            return i;
-        }
-    }
-    return -1;
+    // Frames are in presentation order: pick the last one starting at or before pts,
+    // with half a frame of slack for ms <-> timebase rounding.
+    int i = _frames.upperBound(pts + _timestep/2) - 1;
+    if (i < 0 || (i == _frames.size() - 1 && pts > _frames.back()->pts + _timestep/2))
+        return -1;
+    return i;
 }
 
-std::shared_ptr<AVFrame> FFVideoReader::find(long long pts) {
+AVFrame* FFVideoReader::find(long long pts) {
     auto index = findIndex(pts);
     return index >= 0 && index < _frames.size() ? _frames[index] : nullptr;
 }
 
-bool FFVideoReader::readNext() {
+bool FFVideoReader::readNext(bool ahead) {
     // std::string mySeekTo = std::to_string(std::hash<std::thread::id>{}(std::this_thread::get_id())).substr(0, 5) + " FFVR::readNext(" + ")";
     // auto now = std::chrono::high_resolution_clock::now();
     // long long now_ms = std::chrono::duration_cast<std::chrono::milliseconds>(now.time_since_epoch()).count();
@@ -399,12 +1112,16 @@ bool FFVideoReader::readNext() {
     // console.debug("^_()_^", __TL_threadLogger);
     isReadingNext = true;
     AVPacket *pPacket = av_packet_alloc();
-    while (av_read_frame(_pFormat, pPacket) >= 0) {
+    while (readPacket(pPacket) >= 0) {
+        // Not while skipping frames for a scrub, that audio would be flushed by the next seek anyway
+        if (pPacket->stream_index == _audioStreamIndex && _audio && _pCodecContext->skip_frame == AVDISCARD_DEFAULT)
+            _audio->decode(pPacket);
         if (pPacket->stream_index == _videoStreamIndex) {
-            int count = decodeAndAdd(pPacket);
+            int count = decodeAndAdd(pPacket, ahead);
             if (count != 0) {
                 av_packet_free(&pPacket);
-                _isEOF = false;
+                if (!ahead)
+                    _isEOF = false;
                 isReadingNext = false;
                 return count > 0;
             }
@@ -412,9 +1129,17 @@ bool FFVideoReader::readNext() {
         av_packet_unref(pPacket);
     }
     av_packet_free(&pPacket);
-    int count = decodeAndAdd(nullptr);
-    if(count <= 0)
-        _isEOF = true;
+    int count = decodeAndAdd(nullptr, ahead);
+    if (count == AheadFlushed) {
+        isReadingNext = false;
+        return false;
+    }
+    if(count <= 0) {
+        if (ahead)
+            _aheadEOF = true;
+        else
+            _isEOF = true;
+    }
 
     // mySeekTo = std::to_string(std::hash<std::thread::id>{}(std::this_thread::get_id())).substr(0, 5) + " FFVR::readNext(" + ") END";
     // now = std::chrono::high_resolution_clock::now();
@@ -426,6 +1151,7 @@ bool FFVideoReader::readNext() {
 }
 
 long long FFVideoReader::readFirst() {
+    DecodeAheadPause pause(this);
     long long step = _startTC;
     int n = 10;
     while((!seekToKeyFrame(step, 0) || !readNext()) && n > 0) {
@@ -437,7 +1163,9 @@ long long FFVideoReader::readFirst() {
 }
 
 long long FFVideoReader::readLast() {
-    long long ts = _duration;
+    DecodeAheadPause pause(this);
+    // Not knowing the end, start from where we are and read on
+    long long ts = durationKnown() ? _duration : currentPts();
     seek(ts);
     int n = 10;
     while(_frames.empty() && n > 0) {
@@ -450,23 +1178,32 @@ long long FFVideoReader::readLast() {
         readNext();
     }
     n = 0;
-    while (readNext() && n < 100) n++;
+    while (readNext() && (n < 100 || !durationKnown())) n++;
     _currentIndex = _frames.size() - 1;
     return currentPts();
 }
 
-bool FFVideoReader::isAllBlack(std::shared_ptr<AVFrame> pFrame, int threshold) {
+bool FFVideoReader::isAllBlack(AVFrame* pFrame, int threshold) {
+    // Sampling the luma plane is enough for YUV, only RGB sources need the conversion
+    double level = FrameConverter::lumaLevel(pFrame);
+    if (level >= 0)
+        return level <= threshold;
     Mat gframe;
     cvtColor(convertFrameRGB(pFrame), gframe, cv::COLOR_BGR2GRAY);
     cv::Scalar tempVal = cv::mean( gframe );
     return tempVal.val[0] <= threshold;
 }
 
+vector<Mat> FFVideoReader::getFilmstrip(int count, int width) {
+    return Filmstrip::generate(_path, count, width, _rotate);
+}
+
 Mat FFVideoReader::getThumbnail(float width, int maxRead, int startFrame) {
     if(!isOpen()) return Mat();
+    DecodeAheadPause pause(this);
 
     auto startFrameTC = ms2tc(startFrame);
-    if (startFrameTC <= 0 || _duration <= startFrameTC) {
+    if (startFrameTC <= 0 || (durationKnown() && _duration <= startFrameTC)) {
         readFirst();
         int i = 0;
         while(i < maxRead && (_frames.empty() || isAllBlack(_frames.back()))) {
@@ -14,6 +14,20 @@ extern "C" {
 #include <QFile>
 #include <QDebug>
 #include <atomic>
+#include <climits>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include "spscqueue.h"
+#include "packetindex.h"
+#include "framering.h"
+#include "frameconverter.h"
+#include "gopcache.h"
+#include "probecache.h"
+#include "mmapio.h"
+#include "diskframecache.h"
+#include "audioout.h"
 
 namespace videoio {
 using namespace std;
@@ -22,39 +36,177 @@ using namespace cv;
 class FFVideoReader: public Reader {
     AVFormatContext *_pFormat;
     AVCodecContext *_pCodecContext;
-    SwsContext *_pSwsContext;
+    FrameConverter _converter;
     int _videoStreamIndex;
-    vector<std::shared_ptr<AVFrame>> _frames;
+    FramePool _framePool;
+    FrameRing _frames;
     long long _lastShown, _startTC, _timestep, _duration, _size;
     AVRational _timebase, _framerate, _sar;
     int _maxSize, _currentIndex, _width, _height;
-    bool _byteSeek, _isBlackAndWhite, _isTelecined, _overrideInputColorspace;
-    int _colorPrimaries, _colorSpace, _colorTrc, _colorRange;
+    bool _byteSeek, _isBlackAndWhite, _isTelecined, _overrideInputColorspace = false;
+    // Colour overrides, -1 when not set. Space and range steer the CPU conversion here; all four reach the view
+    // through Reader::colorSetting(), as the YUV matrix and the colour LUT applied on the GPU.
+    int _colorPrimaries = -1, _colorSpace = -1, _colorTrc = -1, _colorRange = -1;
     unsigned int _rotate;
     long long _startIndex;
     std::atomic<bool> isReadingNext{false};
 
-    bool readNext();
+    // Decode-ahead: a producer thread keeps _aheadQueue filled with frames that follow _frames.back().
+    // _decodeMutex guards the format/codec contexts while that thread is running.
+    SPSCQueue<AVFrame*> _aheadQueue;
+    std::thread _aheadThread;
+    std::mutex _decodeMutex, _aheadWaitMutex;
+    std::unique_lock<std::mutex> _decodeLock;
+    std::condition_variable _aheadCv;
+    std::atomic<bool> _decodeAhead{false}, _aheadStop{false}, _aheadFlush{false}, _aheadEOF{false};
+    std::atomic<long long> _aheadStalls{0};
+    long long _seeksCancelled = 0;
+    int _aheadPauseDepth;
+
+    // Keyframe/packet index, loaded from its sidecar or built in the background after open().
+    PacketIndex _index;
+    FileIdentity _fileId;
+    std::thread _indexThread;
+    std::atomic<bool> _indexReady{false}, _indexCancel{false};
+
+    void startIndexing();
+    void stopIndexing();
+
+    // Lazy open: open() returns once codec parameters and the first frame are in, and a helper reader looks for
+    // the end of the stream in the background. Its result is picked up on the reader's own thread (applyProbe(),
+    // from the public entry points) and announced with infoChanged(). Start and end are cached per file. When
+    // the container has neither a duration nor a bitrate, the end is unknown (_duration < 0) until then.
+    bool _lazyOpen = false;
+    bool _boundsHelper = false; // this is such a helper reader
+    ProbeRecord _probe;
+    std::thread _probeThread;
+    std::atomic<bool> _probeReady{false}, _probeCancel{false};
+    std::atomic<long long> _probedDuration{0};
+    const std::atomic<bool>* _interrupt = nullptr; // aborts blocking I/O when set
+
+    // Disk tier behind _frames: frames leaving the window are spilled to it, seeks that would need the decoder
+    // look there first. Frames served from it leave _frames out of step with the demuxer, like the GOP cache.
+    DiskFrameCache _diskCache;
+    bool _diskCacheEnabled = false;
+    bool loadFromDisk(long long pts);
+
+    // Optional memory-mapped I/O for local files, installed as the format context's pb
+    bool _mappedIO = false;
+    unique_ptr<MappedInput> _input;
+
+    bool openInput(long long probeSize);
+    long long readStart();
+    void startProbe();
+    void stopProbe();
+    bool applyProbe();
+    void saveProbe();
+
+    // Decoded segments kept in memory by byte budget: the window is retained there before every seek away, so
+    // seeks back into it are hits, and reverse playback has GOPs decoded into it without touching the forward
+    // decoder. Frames taken from it leave _frames out of step with the demuxer until the next keyframe seek.
+    // The window itself holds as many frames as _windowBytes allows, unless a fixed maxSize was given.
+    GopCache _gopCache;
+    bool _reversePlayback = false;
+    bool _framesSynced = true;
+    size_t _windowBytes = size_t(256) << 20;
+    bool stepBackFromCache();
+    void retainWindow();
+    bool loadFromSegments(long long pts);
+    void sizeWindow();
+
+    // Play ranges as a playback schedule, in pts. Once the last frame before a gap is decoded the demuxer moves
+    // on to the keyframe of the next range (or decodes through when that keyframe lies within the gap anyway)
+    // and frames before the range start are dropped, so with decode-ahead the head of the next range is queued
+    // while the current one is still playing. Written on the reader's thread, read by the decode-ahead thread.
+    std::mutex _scheduleMutex;
+    IntervalSet _schedule;
+    std::atomic<long long> _decodedPts{LLONG_MIN}, _skipBefore{LLONG_MIN};
+    std::atomic<long long> _gapJumps{0};
+    void playRangesChanged() override;
+    bool skipGap();
+    bool seekDemuxer(long long pts);
+
+    // Scrub mode: while "scrubbing" is set, seeks that would need the decoder show a cheap stand-in instead of
+    // the exact frame: the keyframe nearest the target (decoded with AVDISCARD_NONKEY), or the last reference
+    // frame before it (AVDISCARD_NONREF, so B-frames are never decoded). The resulting window is sparse, so it
+    // is neither used for lookups nor retained; the next seek or step decodes properly. The caller does an exact
+    // seek once the drag settles.
+    enum class ScrubMode { Exact, KeyFrame, NonRef };
+    ScrubMode _scrubMode = ScrubMode::KeyFrame;
+    bool _scrubbing = false;
+    bool _scrubWindow = false; // _frames came from scrubTo()
+    long long _scrubSeeks = 0;
+    bool scrubTo(long long pts);
+
+    // Output size: getFrameInto() scales straight to _outputSize (fitted, never enlarged) rather than to the full
+    // stream size; the view sets it from its geometry, an empty size is full resolution. Decoders with lowres
+    // support also decode at 1/2^n when that still covers the output. lowres is fixed once a decoder is open, so
+    // a change re-opens the codec context (not the file) at the next keyframe seek; going up in resolution seeks
+    // to the frame on screen at once. Frames decoded at reduced size are kept out of the segment and disk caches.
+    QSize _outputSize;
+    int _outWidth = 0, _outHeight = 0; // what getFrameInto() produces, before rotation
+    int _fullWidth = 0;                // coded width at full resolution
+    int _lowres = 0, _maxLowres = 0;
+    bool _lowresEnabled = true;
+    void updateOutputSize();
+    bool reopenDecoder();
+    bool fullSize(const AVFrame* pFrame) const { return pFrame->width >= _fullWidth; }
+
+    // Audio: packets of the best audio stream are taken from the same demux loop and handed to _audio, which
+    // decodes them and plays them out through the sink named by "audioSink" (off when empty). Neither stream
+    // waits for the other: decoded audio that does not fit the output ring is backlogged, and when the video
+    // queue is full but audio runs low, the demuxer reads on for audio and parks the video packets it passes
+    // (up to MaxParkedPackets) for readNext() to pick up first.
+    static constexpr size_t MaxParkedPackets = 256;
+    int _audioStreamIndex = -1;
+    QString _audioSink;
+    shared_ptr<AudioOutput> _audio;
+    deque<AVPacket*> _parkedVideo;
+    void openAudio();
+    int readPacket(AVPacket* pPacket);
+    void dropParkedPackets();
+    void demuxForAudio();
+    void resyncAudio();
+
+    bool readNext(bool ahead = false);
+    bool advance(bool scheduled = false);
     bool seek(long long pts);
     void readTill(long long pts);
-    int decodeAndAdd(AVPacket* pPacket);
+    // Frames added, a negative AVERROR, or AheadFlushed when the decode-ahead queue was flushed under it
+    static constexpr int AheadFlushed = INT_MIN;
+    int decodeAndAdd(AVPacket* pPacket, bool ahead = false);
+    bool enqueueFrame(AVFrame* pFrame);
+    bool popAhead();
+    void decodeAheadLoop();
+    void startDecodeAhead();
+    void stopDecodeAhead(bool resync = true);
+    void pauseDecodeAhead();
+    void resumeDecodeAhead();
+
+    struct DecodeAheadPause {
+        FFVideoReader* reader;
+        DecodeAheadPause(FFVideoReader* r, bool active = true) : reader(active ? r : nullptr) { if (reader) reader->pauseDecodeAhead(); }
+        ~DecodeAheadPause() { if (reader) reader->resumeDecodeAhead(); }
+    };
+
     void eraseFramesTo(int size);
-    bool addFrame(std::shared_ptr<AVFrame> pFrame);
+    bool addFrame(AVFrame* pFrame);
     int findIndex(long long pts);
-    std::shared_ptr<AVFrame> find(long long pts);
-    bool isAllBlack(std::shared_ptr<AVFrame> pFrame, int threshold = 30);
+    AVFrame* find(long long pts);
+    bool isAllBlack(AVFrame* pFrame, int threshold = 30);
     bool seekToKeyFrame(long long pts, int attempt = 0);
     bool containsFrame(long long pts) { return !_frames.empty() && pts >= _frames.front()->pts && pts <= _frames.back()->pts; }
 
     long long ms2tc(long long ms) { return ms/av_q2d(_timebase)/1000 + _startTC; }
     long long tc2ms(long long tc) { return (tc - _startTC)*av_q2d(_timebase)*1000; }
-    void clearFrames() { eraseFramesTo(0); }
-    long long clampPts(long long pts) { return pts < _startTC ? _startTC : (pts > _duration ? _duration : pts); }
+    void clearFrames() { eraseFramesTo(0); _scrubWindow = false; }
+    bool durationKnown() const { return _duration >= 0; }
+    long long clampPts(long long pts) { return pts < _startTC ? _startTC : (durationKnown() && pts > _duration ? _duration : pts); }
     bool frameInNearFuture(long long pts, int frames = 5) { return !_frames.empty() && _frames.back()->pts < pts && (_frames.back()->pts + frames*_timestep) > pts; }
     bool isIndexValid() { return _currentIndex >= 0 && _currentIndex < _frames.size(); }
 
-    Mat convertFrame(std::shared_ptr<AVFrame> pFrame);
-    Mat convertFrameRGB(std::shared_ptr<AVFrame> pFrame);
+    Mat convertFrame(AVFrame* pFrame);
+    Mat convertFrameRGB(AVFrame* pFrame);
     unsigned detectOrientation(const AVStream *pStream);
     QVariantList streamInfo(AVMediaType avType);
 
@@ -85,8 +237,9 @@ class FFVideoReader: public Reader {
     void estimateDuration();
 
 public:
-    FFVideoReader(const QString path, int maxSize = 10, long long startIndex = -1)
-        : Reader(path), _pFormat(nullptr), _videoStreamIndex(-1), _startIndex(startIndex), _maxSize(maxSize), _lastShown(0), _startTC(0), _timestep(0), _duration(0), _width(0), _height(0), _currentIndex(-1), _byteSeek(false), _rotate(3) {}
+    // maxSize fixes the number of frames in the decoded window; 0 sizes it by frameWindowBytes.
+    FFVideoReader(const QString path, int maxSize = 0, long long startIndex = -1)
+        : Reader(path), _pFormat(nullptr), _videoStreamIndex(-1), _startIndex(startIndex), _maxSize(maxSize), _frames(&_framePool, maxSize > 0 ? maxSize : 10), _lastShown(0), _startTC(0), _timestep(0), _duration(0), _width(0), _height(0), _currentIndex(-1), _byteSeek(false), _rotate(3), _decodeLock(_decodeMutex, std::defer_lock), _aheadPauseDepth(0), _gopCache(&_framePool) {}
 
     virtual ~FFVideoReader() {
         close();
@@ -98,6 +251,7 @@ public:
             _rotate = info["rotation"].toInt();
             _info["rotation"] = _rotate;
             transpose();
+            updateOutputSize();
             ret = true;
         }
         if (info.contains("isBlackAndWhite")) {
@@ -135,21 +289,183 @@ public:
             _info["colorRange"] = _colorRange;
             ret = true;
         }
+        if (info.contains("overrideInputColorspace") || info.contains("colorSpace") || info.contains("colorRange")) {
+            _converter.setColorDetails(_overrideInputColorspace ? _colorSpace : -1, _overrideInputColorspace ? _colorRange : -1);
+        }
+        if (info.contains("convertThreads")) {
+            _converter.setThreads(info["convertThreads"].toInt());
+            _info["convertThreads"] = _converter.threads();
+            ret = true;
+        }
+        if (info.contains("scalerQuality")) {
+            int flags = FrameConverter::scalerFlags(info["scalerQuality"].toString());
+            if (flags < 0) {
+                qCritical() << "Unknown scaler quality" << info["scalerQuality"];
+            } else {
+                _converter.setScalerFlags(flags);
+                _info["scalerQuality"] = info["scalerQuality"].toString().toLower();
+                ret = true;
+            }
+        }
+        // reverseCacheBytes is the older name of the same budget
+        for (const char* key : {"frameCacheBytes", "reverseCacheBytes"}) {
+            if (info.contains(key)) {
+                _gopCache.setBudget(std::max(0LL, info[key].toLongLong()));
+                _info["frameCacheBytes"] = _info["reverseCacheBytes"] = (long long)_gopCache.budget();
+                ret = true;
+            }
+        }
+        if (info.contains("frameWindowBytes")) {
+            _windowBytes = std::max(0LL, info["frameWindowBytes"].toLongLong());
+            _info["frameWindowBytes"] = (long long)_windowBytes;
+            if (_isOpen) {
+                DecodeAheadPause pause(this);
+                sizeWindow();
+            }
+            ret = true;
+        }
+        if (info.contains("scrubMode")) {
+            QString mode = info["scrubMode"].toString();
+            _scrubMode = mode == "exact" ? ScrubMode::Exact : (mode == "nonref" ? ScrubMode::NonRef : ScrubMode::KeyFrame);
+            _info["scrubMode"] = _scrubMode == ScrubMode::Exact ? "exact" : (_scrubMode == ScrubMode::NonRef ? "nonref" : "keyframe");
+            ret = true;
+        }
+        if (info.contains("scrubbing")) {
+            _scrubbing = info["scrubbing"].toBool();
+            _info["scrubbing"] = _scrubbing;
+            ret = true;
+        }
+        if (info.contains("audioSink")) {
+            _audioSink = info["audioSink"].toString();
+            _info["audioSink"] = _audioSink;
+            ret = true;
+        }
+        if (info.contains("audioPlaying") && _audio) {
+            bool playing = info["audioPlaying"].toBool();
+            if (playing && !_framesSynced)
+                resyncAudio();
+            _audio->setPlaying(playing, currentTimestamp());
+            _info["audioPlaying"] = playing;
+            ret = true;
+        }
+        if (info.contains("outputSize") || info.contains("lowres")) {
+            if (info.contains("outputSize"))
+                _outputSize = info["outputSize"].toSize();
+            if (info.contains("lowres"))
+                _lowresEnabled = info["lowres"].toBool();
+            _info["lowresEnabled"] = _lowresEnabled;
+            updateOutputSize();
+            AVFrame* pShown = getCurrentFrame();
+            if (_isOpen && pShown != nullptr && pShown->width < (_fullWidth >> _lowres)) {
+                // Sharper than what is decoded: re-decode the frame on screen now rather than at the next seek
+                DecodeAheadPause pause(this);
+                long long pts = currentPts();
+                clearFrames();
+                seek(pts);
+            }
+            ret = true;
+        }
+        if (info.contains("reversePlayback")) {
+            _reversePlayback = info["reversePlayback"].toBool();
+            _info["reversePlayback"] = _reversePlayback;
+            ret = true;
+        }
+        if (info.contains("decodeAheadDepth")) {
+            bool running = _aheadThread.joinable();
+            stopDecodeAhead();
+            _aheadQueue.reset(std::max(1, info["decodeAheadDepth"].toInt()));
+            _framePool.reserve(_frames.capacity() + _aheadQueue.capacity() + 4);
+            _info["decodeAheadCapacity"] = (int)_aheadQueue.capacity();
+            if (running)
+                startDecodeAhead();
+            ret = true;
+        }
+        if (info.contains("diskCacheBytes")) {
+            _diskCache.setBudget(std::max(0LL, info["diskCacheBytes"].toLongLong()));
+            _info["diskCacheBytes"] = (long long)_diskCache.budget();
+            ret = true;
+        }
+        if (info.contains("diskCache")) {
+            _diskCacheEnabled = info["diskCache"].toBool();
+            _info["diskCache"] = _diskCacheEnabled;
+            if (_diskCacheEnabled && _isOpen && !_diskCache.isOpen())
+                _diskCache.open(_fileId);
+            else if (!_diskCacheEnabled)
+                _diskCache.close();
+            ret = true;
+        }
+        if (info.contains("mappedIO")) {
+            _mappedIO = info["mappedIO"].toBool();
+            _info["mappedIO"] = _mappedIO;
+            ret = true;
+        }
+        if (info.contains("lazyOpen")) {
+            _lazyOpen = info["lazyOpen"].toBool();
+            _info["lazyOpen"] = _lazyOpen;
+            ret = true;
+        }
+        if (info.contains("decodeAhead")) {
+            _decodeAhead = info["decodeAhead"].toBool();
+            _info["decodeAhead"] = _decodeAhead.load();
+            if (_decodeAhead && _isOpen)
+                startDecodeAhead();
+            else if (!_decodeAhead)
+                stopDecodeAhead();
+            ret = true;
+        }
 
         return ret;
     }
 
-    std::shared_ptr<AVFrame> getCurrentFrame() { return isIndexValid() ? _frames[_currentIndex] : nullptr; }
+    virtual QVariantMap& getInfo() override {
+        applyProbe();
+        _info["decodeAheadDepth"] = (int)_aheadQueue.size();
+        _info["decodeAheadStalls"] = _aheadStalls.load();
+        _info["frameAllocations"] = _framePool.allocations();
+        _info["convertMs"] = _converter.lastConvertMs();
+        _info["convertAverageMs"] = _converter.averageConvertMs();
+        _info["indexReady"] = _indexReady.load();
+        _info["frameCacheResidentBytes"] = _info["reverseCacheUsedBytes"] = (long long)_gopCache.bytes();
+        _info["frameCacheSegments"] = (int)_gopCache.segmentCount();
+        _info["frameCacheSeekHits"] = _gopCache.seekHits();
+        _info["frameCacheSeekMisses"] = _gopCache.seekMisses();
+        _info["reverseCacheHits"] = _gopCache.hits();
+        _info["reverseCacheMisses"] = _gopCache.misses();
+        _info["reverseCachePrefetched"] = _gopCache.prefetched();
+        _info["frameWindow"] = (int)_frames.capacity();
+        _info["playRanges"] = (int)_playRanges.size();
+        _info["playRangeJumps"] = _gapJumps.load();
+        _info["seeksCancelled"] = _seeksCancelled;
+        _info["scrubSeeks"] = _scrubSeeks;
+        if (_audio) {
+            _info["audioUnderruns"] = _audio->underruns();
+            _info["audioDropped"] = _audio->dropped();
+            _info["audioPlayed"] = _audio->played();
+        }
+        if (_diskCache.isOpen()) {
+            _info["diskCacheUsedBytes"] = (long long)_diskCache.bytes();
+            _info["diskCacheHits"] = _diskCache.hits();
+            _info["diskCacheWritten"] = _diskCache.written();
+            _info["diskCacheDropped"] = _diskCache.dropped();
+        }
+        if (_indexReady) {
+            _info["indexedFrames"] = (long long)_index.frameCount();
+            _info["indexedKeyFrames"] = (long long)_index.keyFrameCount();
+        }
+        return Reader::getInfo();
+    }
+
+    AVFrame* getCurrentFrame() { return isIndexValid() ? _frames[_currentIndex] : nullptr; }
     unsigned int getCurrentFrameIndex() { return _currentIndex; }
 
     virtual bool open() override;
 
     virtual bool isEOF() override {
-        return _lastShown >= _duration || Reader::isEOF();
+        return (durationKnown() && _lastShown >= _duration) || Reader::isEOF();
     }
 
     long long currentPts() override {
-        std::shared_ptr<AVFrame> pFrame = getCurrentFrame();
+        AVFrame* pFrame = getCurrentFrame();
         return pFrame == nullptr || pFrame->pts < 0 ? -1 : pFrame->pts;
     }
 
@@ -172,10 +488,22 @@ public:
         return result;
     }
 
+    virtual bool seekToFrame(long long frame) override {
+        if (_indexReady)
+            return seek(_index.framePts(frame));
+        return Reader::seekToFrame(frame);
+    }
+
     virtual void nextFrame() override {
+        applyProbe();
+        if (_input)
+            _input->setBackward(false);
         if (isIndexValid() && !isEOF()) {
-            if (_currentIndex == _frames.size() - 1) {
-                readNext();
+            if ((_currentIndex == _frames.size() - 1 && !_framesSynced) || _scrubWindow) {
+                // The demuxer is not behind these frames (or they are sparse), go through a real seek
+                seek(currentPts() + _timestep);
+            } else if (_currentIndex == _frames.size() - 1) {
+                advance(true);
                 _currentIndex = _frames.size() - 1;
             } else
                 _currentIndex++;
@@ -186,10 +514,14 @@ public:
     }
 
     virtual void prevFrame() override {
+        applyProbe();
+        if (_input)
+            _input->setBackward(true);
         if (isIndexValid()) {
-            if (_currentIndex == 0)
-                seek(currentPts() - _timestep);
-            else
+            if (_currentIndex == 0 || _scrubWindow) {
+                if (_scrubWindow || !_reversePlayback || !stepBackFromCache())
+                    seek(currentPts() - _timestep);
+            } else
                 _currentIndex--;
         } else {
             if (_looping)
@@ -199,7 +531,7 @@ public:
 
     virtual Mat getFrame() override {
         Mat frame;
-        std::shared_ptr<AVFrame> pFrame = getCurrentFrame();
+        AVFrame* pFrame = getCurrentFrame();
         if (pFrame != nullptr) {
             _lastShown = pFrame->pts;
             frame = convertFrame(pFrame);
@@ -207,13 +539,37 @@ public:
         return frame;
     }
 
+    // The size getFrameInto() writes, see "outputSize"; getFrame() stays at full size
+    virtual QSize frameSize() override {
+        bool transposed = _rotate == ROTATE_90_CLOCKWISE || _rotate == ROTATE_90_COUNTERCLOCKWISE;
+        return transposed ? QSize(_outHeight, _outWidth) : QSize(_outWidth, _outHeight);
+    }
+
+    virtual size_t frameBufferSize(PixelLayout layout) override;
+
+    // Converts the current frame straight into dst, skipping the intermediate RGBA64 Mat.
+    virtual bool getFrameInto(uchar* dst, int stride, PixelLayout layout) override;
+
+    // Zero-copy Mat over the current frame when it is already packed RGB at output size and unrotated,
+    // otherwise empty. Only valid until the frame leaves the decoded window.
+    Mat getFrameView();
+
     virtual bool canReload() override { return false; }
 
+    shared_ptr<AudioOutput> audioOutput() override { return _audio; }
+
     void close() override;
 
     Mat getThumbnail(float maxWidth = 640.0f, int maxRead = 30, int startFrame = 0) override;
+    vector<Mat> getFilmstrip(int count, int width) override;
+
+    // Spills the decoded window to the disk cache and frees it, keeping only the current frame unless
+    // ignorePlayHead. Does nothing without "diskCache".
+    void cacheAndClear(bool ignorePlayHead = false) override;
+    vector<int64_t> getFrameBufferRange() override;
 
     virtual bool clearBuffers() override {
+        DecodeAheadPause pause(this);
         clearFrames();
         if(_pCodecContext != nullptr)
             avcodec_flush_buffers(_pCodecContext);
@@ -0,0 +1,217 @@
+#include "filmstrip.h"
+#include "frameconverter.h"
+#include "workerpool.h"
+#include <QDebug>
+#include <QFile>
+#include <chrono>
+
+extern "C" {
+#include "libavformat/avformat.h"
+#include "libavcodec/avcodec.h"
+#include "libswscale/swscale.h"
+}
+
+namespace videoio {
+using namespace std;
+using namespace cv;
+
+// Each worker opens the file once; past a handful the demuxers just fight over the disk.
+static constexpr int MaxWorkers = 4;
+// Black keyframes (fades, slates) skipped per slot before settling for what there is
+static constexpr int MaxBlackSkips = 5;
+static constexpr int BlackThreshold = 30;
+
+QString Filmstrip::cachePath(const FileIdentity& id, int count, int width, unsigned rotate) {
+    return mediaCachePath("filmstrip", id, QString("_%1x%2_r%3.jpg").arg(count).arg(width).arg(rotate));
+}
+
+void Filmstrip::clearCache(const QString& path, int count, int width, unsigned rotate) {
+    QFile::remove(cachePath(FileIdentity::of(path), count, width, rotate));
+}
+
+bool Filmstrip::decodeSlots(const QString& path, vector<Slot*> slots, int width, unsigned rotate, int blackThreshold,
+                            const std::atomic<bool>* cancel) {
+    AVFormatContext* pFormat = nullptr;
+    AVCodecContext* pCodecContext = nullptr;
+    SwsContext* pSwsContext = nullptr;
+    AVPacket* pPacket = av_packet_alloc();
+    AVFrame* pFrame = av_frame_alloc();
+    auto cleanup = [&](bool ret) {
+        sws_freeContext(pSwsContext);
+        av_frame_free(&pFrame);
+        av_packet_free(&pPacket);
+        avcodec_free_context(&pCodecContext);
+        if (pFormat != nullptr)
+            avformat_close_input(&pFormat);
+        return ret;
+    };
+
+    auto p = path.toStdString();
+    if (avformat_open_input(&pFormat, p.c_str(), nullptr, nullptr) != 0 || avformat_find_stream_info(pFormat, nullptr) < 0) {
+        qCritical() << "Filmstrip: unable to open file" << path;
+        return cleanup(false);
+    }
+    const AVCodec* pCodec = nullptr;
+    int streamIndex = av_find_best_stream(pFormat, AVMEDIA_TYPE_VIDEO, -1, -1, &pCodec, 0);
+    if (streamIndex < 0 || pCodec == nullptr) {
+        qCritical() << "Filmstrip: no decodable video stream in" << path;
+        return cleanup(false);
+    }
+    for (unsigned i = 0; i < pFormat->nb_streams; i++)
+        pFormat->streams[i]->discard = (int)i == streamIndex ? AVDISCARD_DEFAULT : AVDISCARD_ALL;
+    const AVStream* pStream = pFormat->streams[streamIndex];
+    pCodecContext = avcodec_alloc_context3(pCodec);
+    if (avcodec_parameters_to_context(pCodecContext, pStream->codecpar) < 0) {
+        qCritical() << "Filmstrip: unable to set up decoder for" << path;
+        return cleanup(false);
+    }
+
+    // Output geometry from the display aspect, rotation applied afterwards
+    AVRational sar = pStream->sample_aspect_ratio.num ? pStream->sample_aspect_ratio : pStream->codecpar->sample_aspect_ratio;
+    double displayWidth = pStream->codecpar->width * (sar.num ? av_q2d(sar) : 1.0);
+    int srcHeight = pStream->codecpar->height;
+    if (displayWidth <= 0 || srcHeight <= 0)
+        return cleanup(false);
+    bool transposed = rotate == ROTATE_90_CLOCKWISE || rotate == ROTATE_90_COUNTERCLOCKWISE;
+    int height = std::max(1, (int)lround(transposed ? width * displayWidth / srcHeight : width * srcHeight / displayWidth));
+    int scaledWidth = transposed ? height : width, scaledHeight = transposed ? width : height;
+
+    // Keyframes only, decoded as cheaply as the codec allows; one thread each, the parallelism is across workers
+    pCodecContext->skip_frame = AVDISCARD_NONKEY;
+    pCodecContext->skip_loop_filter = AVDISCARD_ALL;
+    pCodecContext->flags2 |= AV_CODEC_FLAG2_FAST;
+    pCodecContext->thread_count = 1;
+    int lowres = 0;
+    while (lowres < pCodec->max_lowres && (pStream->codecpar->width >> (lowres + 1)) >= scaledWidth)
+        lowres++;
+    pCodecContext->lowres = lowres;
+    if (avcodec_open2(pCodecContext, pCodec, nullptr) < 0) {
+        qCritical() << "Filmstrip: unable to open decoder for" << path;
+        return cleanup(false);
+    }
+
+    int64_t start = pStream->start_time == AV_NOPTS_VALUE ? 0 : pStream->start_time;
+    int64_t duration = pStream->duration > 0 ? pStream->duration
+                                             : av_rescale_q(pFormat->duration, AV_TIME_BASE_Q, pStream->time_base);
+    if (duration <= 0)
+        return cleanup(false);
+
+    // Converts a decoded keyframe into a thumbnail, false when it is (nearly) black and should be skipped
+    auto takeFrame = [&](Slot* pSlot, int& skipped) {
+        double level = FrameConverter::lumaLevel(pFrame);
+        if (level >= 0 && level <= blackThreshold && skipped < MaxBlackSkips) {
+            skipped++;
+            return false;
+        }
+        pSwsContext = sws_getCachedContext(pSwsContext, pFrame->width, pFrame->height, (AVPixelFormat)pFrame->format,
+                                           scaledWidth, scaledHeight, AV_PIX_FMT_BGR24, SWS_AREA, nullptr, nullptr, nullptr);
+        if (pSwsContext == nullptr)
+            return false;
+        Mat thumbnail(scaledHeight, scaledWidth, CV_8UC3);
+        uchar* data = thumbnail.data;
+        int step = thumbnail.step;
+        sws_scale(pSwsContext, pFrame->data, pFrame->linesize, 0, pFrame->height, &data, &step);
+        // No luma plane to look at: judge the thumbnail itself, it is tiny. Its gray level, not one channel, so
+        // saturated red or green frames are not taken for black.
+        if (level < 0 && skipped < MaxBlackSkips) {
+            Mat gray;
+            cvtColor(thumbnail, gray, COLOR_BGR2GRAY);
+            if (mean(gray)[0] <= blackThreshold) {
+                skipped++;
+                return false;
+            }
+        }
+        if (rotate < 3)
+            cv::rotate(thumbnail, thumbnail, rotate);
+        pSlot->thumbnail = thumbnail;
+        return true;
+    };
+
+    for (Slot* pSlot : slots) {
+        if (cancel != nullptr && *cancel)
+            return cleanup(false);
+        int64_t target = start + int64_t(pSlot->position * duration);
+        if (av_seek_frame(pFormat, streamIndex, target, AVSEEK_FLAG_BACKWARD) < 0)
+            continue;
+        avcodec_flush_buffers(pCodecContext);
+        int skipped = 0;
+        bool done = false, eof = false;
+        while (!done && !eof) {
+            if (av_read_frame(pFormat, pPacket) < 0) {
+                avcodec_send_packet(pCodecContext, nullptr);
+                eof = true;
+            } else if (pPacket->stream_index != streamIndex || !(pPacket->flags & AV_PKT_FLAG_KEY)) {
+                // Non-key packets never reach the decoder at all
+                av_packet_unref(pPacket);
+                continue;
+            } else {
+                avcodec_send_packet(pCodecContext, pPacket);
+                av_packet_unref(pPacket);
+            }
+            while (!done && avcodec_receive_frame(pCodecContext, pFrame) >= 0) {
+                done = takeFrame(pSlot, skipped);
+                av_frame_unref(pFrame);
+            }
+        }
+    }
+    return cleanup(true);
+}
+
+vector<Mat> Filmstrip::generate(const QString& path, int count, int width, unsigned rotate, const std::atomic<bool>* cancel) {
+    if (count <= 0 || width <= 0)
+        return {};
+    auto begin = chrono::steady_clock::now();
+    FileIdentity id = FileIdentity::of(path);
+    QString cacheFile = id.isValid() ? cachePath(id, count, width, rotate) : QString();
+
+    // The cache is one strip image, count thumbnails side by side
+    if (!cacheFile.isEmpty() && QFile::exists(cacheFile)) {
+        Mat strip = imread(cacheFile.toStdString(), IMREAD_COLOR);
+        if (!strip.empty() && strip.cols == count * width) {
+            vector<Mat> thumbnails;
+            for (int i = 0; i < count; i++)
+                thumbnails.push_back(strip(Rect(i * width, 0, width, strip.rows)).clone());
+            return thumbnails;
+        }
+    }
+
+    vector<Slot> slots(count);
+    for (int i = 0; i < count; i++)
+        slots[i].position = (i + 0.5) / count;
+    // Interleaved so every worker walks its slots front to back
+    int workers = std::min({count, (int)WorkerPool::shared().size() + 1, MaxWorkers});
+    vector<vector<Slot*>> parts(workers);
+    for (int i = 0; i < count; i++)
+        parts[i % workers].push_back(&slots[i]);
+    WorkerPool::shared().parallelFor(workers, [&](int i) {
+        decodeSlots(path, parts[i], width, rotate, BlackThreshold, cancel);
+    });
+    if (cancel != nullptr && *cancel)
+        return {};
+
+    Size size;
+    for (const auto& slot : slots) {
+        if (!slot.thumbnail.empty()) {
+            size = slot.thumbnail.size();
+            break;
+        }
+    }
+    if (size.area() == 0) {
+        qCritical() << "Filmstrip: no keyframe could be decoded in" << path;
+        return {};
+    }
+    vector<Mat> thumbnails;
+    for (auto& slot : slots)
+        thumbnails.push_back(slot.thumbnail.empty() ? Mat::zeros(size, CV_8UC3) : slot.thumbnail);
+
+    if (!cacheFile.isEmpty()) {
+        Mat strip;
+        hconcat(thumbnails, strip);
+        if (!imwrite(cacheFile.toStdString(), strip, {IMWRITE_JPEG_QUALITY, 90}))
+            qWarning() << "Filmstrip: unable to write cache" << cacheFile;
+    }
+    auto ms = chrono::duration<double, milli>(chrono::steady_clock::now() - begin).count();
+    qInfo() << "Filmstrip:" << count << "thumbnails for" << path << "in" << ms << "ms on" << workers << "workers";
+    return thumbnails;
+}
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <QString>
+#include <atomic>
+#include <vector>
+#include "mediacache.h"
+
+namespace videoio {
+using namespace std;
+using namespace cv;
+
+// Timeline filmstrip: count thumbnails evenly spaced over a file, each taken from the keyframe at or before
+// its slot. Only keyframes are decoded (skip_frame = AVDISCARD_NONKEY, lowres where the codec has it) and
+// they are scaled straight down to thumbnail size. Slots are spread over several demuxer/decoder instances
+// on the shared WorkerPool, and finished strips are cached on disk per file identity.
+class Filmstrip {
+    struct Slot {
+        double position; // 0..1 over the duration
+        Mat thumbnail;
+    };
+    static bool decodeSlots(const QString& path, vector<Slot*> slots, int width, unsigned rotate, int blackThreshold,
+                            const std::atomic<bool>* cancel);
+    static QString cachePath(const FileIdentity& id, int count, int width, unsigned rotate);
+
+public:
+    // Returns BGR 8-bit thumbnails of the given width (height follows the display aspect, rotation applied,
+    // rotate being a cv::RotateFlags value or >= 3 for none). Black keyframes are skipped in favour of the next
+    // keyframe, like getThumbnail(). Empty on failure or cancel.
+    static vector<Mat> generate(const QString& path, int count, int width, unsigned rotate = 3,
+                                const std::atomic<bool>* cancel = nullptr);
+    static void clearCache(const QString& path, int count, int width, unsigned rotate = 3);
+};
+}
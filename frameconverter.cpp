@@ -0,0 +1,299 @@
+#include "frameconverter.h"
+#include "workerpool.h"
+#include "rotatekernels.h"
+#include <QDebug>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+
+extern "C" {
+#include "libavutil/pixdesc.h"
+}
+
+namespace videoio {
+using namespace std;
+using namespace cv;
+
+// Slices thinner than this cost more in context setup and scheduling than they save.
+static constexpr int MinSliceRows = 64;
+
+AVPixelFormat FrameConverter::avFormat(PixelLayout layout) {
+    switch (layout) {
+    case PixelLayout::RGBA8: return AV_PIX_FMT_RGBA;
+    case PixelLayout::BGRA8: return AV_PIX_FMT_BGRA;
+    case PixelLayout::RGBA16: return AV_PIX_FMT_RGBA64LE;
+    case PixelLayout::RGB10A2: return AV_PIX_FMT_X2BGR10LE;
+    default: return AV_PIX_FMT_NONE;
+    }
+}
+
+bool FrameConverter::supportsOutput(PixelLayout layout) {
+    if (layout == PixelLayout::YUVPlanar)
+        return true;
+    const AVPixelFormat format = avFormat(layout);
+    return format != AV_PIX_FMT_NONE && sws_isSupportedOutput(format);
+}
+
+int FrameConverter::matType(PixelLayout layout) {
+    return layout == PixelLayout::RGBA16 ? CV_16UC4 : CV_8UC4;
+}
+
+int FrameConverter::scalerFlags(const QString& quality) {
+    static const vector<pair<QString, int>> names = {
+        {"point", SWS_POINT}, {"fast_bilinear", SWS_FAST_BILINEAR}, {"bilinear", SWS_BILINEAR},
+        {"bicubic", SWS_BICUBIC}, {"area", SWS_AREA}, {"spline", SWS_SPLINE}, {"lanczos", SWS_LANCZOS}};
+    for (const auto& name : names) {
+        if (quality.compare(name.first, Qt::CaseInsensitive) == 0)
+            return name.second;
+    }
+    return -1;
+}
+
+void FrameConverter::setThreads(int threads) {
+    _threads = std::max(0, threads);
+}
+
+void FrameConverter::setScalerFlags(int flags) {
+    if (flags == _flags)
+        return;
+    _flags = flags;
+    // sws_getCachedContext would notice the new flags too, but only one context at a time
+    for (int i = 0; i < LayoutCount; i++)
+        freeContexts((PixelLayout)i);
+}
+
+void FrameConverter::setColorDetails(int colorSpace, int colorRange) {
+    _colorSpace = colorSpace;
+    _colorRange = colorRange;
+}
+
+void FrameConverter::applyColorDetails(SwsContext* pContext, const AVFrame* pFrame) const {
+    const AVPixFmtDescriptor* desc = av_pix_fmt_desc_get((AVPixelFormat)pFrame->format);
+    if (desc == nullptr || (desc->flags & AV_PIX_FMT_FLAG_RGB) || desc->nb_components < 3)
+        return;
+    int space = _colorSpace >= 0 ? _colorSpace : pFrame->colorspace;
+    // Untagged: guess from the resolution, like the GPU path does
+    if (space == AVCOL_SPC_UNSPECIFIED || space == AVCOL_SPC_RGB || space == AVCOL_SPC_RESERVED)
+        space = pFrame->height >= 720 ? AVCOL_SPC_BT709 : AVCOL_SPC_SMPTE170M;
+    const int range = _colorRange >= 0 ? _colorRange : pFrame->color_range;
+    const char* name = desc->name;
+    const int srcRange = range == AVCOL_RANGE_JPEG || (range == AVCOL_RANGE_UNSPECIFIED && strncmp(name, "yuvj", 4) == 0) ? 1 : 0;
+
+    int *inv, *table, currentRange, dstRange, brightness, contrast, saturation;
+    if (sws_getColorspaceDetails(pContext, &inv, &currentRange, &table, &dstRange, &brightness, &contrast, &saturation) < 0)
+        return;
+    const int* coefficients = sws_getCoefficients(space);
+    if (currentRange == srcRange && memcmp(inv, coefficients, 4 * sizeof(int)) == 0)
+        return;
+    sws_setColorspaceDetails(pContext, coefficients, srcRange, table, dstRange, brightness, contrast, saturation);
+}
+
+void FrameConverter::freeContexts(PixelLayout layout) {
+    for (auto& pContext : _contexts[(int)layout])
+        sws_freeContext(pContext);
+    _contexts[(int)layout].clear();
+}
+
+int FrameConverter::sliceCount(const AVFrame* pFrame, int width, int height) const {
+    // Independent slices only line up when there is no vertical scaling
+    if (pFrame->height != height)
+        return 1;
+    const AVPixFmtDescriptor* desc = av_pix_fmt_desc_get((AVPixelFormat)pFrame->format);
+    if (desc == nullptr || (desc->flags & (AV_PIX_FMT_FLAG_PAL | AV_PIX_FMT_FLAG_BITSTREAM | AV_PIX_FMT_FLAG_HWACCEL)))
+        return 1;
+    int slices = _threads > 0 ? _threads : (int)WorkerPool::shared().size() + 1;
+    return std::max(1, std::min(slices, height / MinSliceRows));
+}
+
+bool FrameConverter::prepare(int srcWidth, int srcHeight, AVPixelFormat srcFormat, int width, int height) {
+    if (!sws_isSupportedInput(srcFormat)) {
+        qCritical() << "Unsupported input pixel format" << av_get_pix_fmt_name(srcFormat);
+        return false;
+    }
+    auto& contexts = _contexts[(int)PixelLayout::RGBA16];
+    if (contexts.empty())
+        contexts.push_back(nullptr);
+    contexts[0] = sws_getCachedContext(contexts[0], srcWidth, srcHeight, srcFormat, width, height, AV_PIX_FMT_RGBA64LE, _flags, nullptr, nullptr, nullptr);
+    return contexts[0] != nullptr;
+}
+
+void FrameConverter::reset() {
+    for (int i = 0; i < LayoutCount; i++)
+        freeContexts((PixelLayout)i);
+    _rotateScratch.release();
+    _sliceScratch.clear();
+}
+
+// Writes rows [y, y + rows) of a width x height image, converted into src, to where they land in the rotated dst.
+static void rotateRows(const uchar* src, size_t srcStep, int y, int rows, int width, int height,
+                       uchar* dst, int stride, int bytesPerPixel, unsigned rotate) {
+    uchar* out = dst;
+    if (rotate == ROTATE_90_CLOCKWISE)
+        out += (ptrdiff_t)(height - y - rows) * bytesPerPixel;
+    else if (rotate == ROTATE_90_COUNTERCLOCKWISE)
+        out += (ptrdiff_t)y * bytesPerPixel;
+    else
+        out += (ptrdiff_t)(height - y - rows) * stride;
+    rotatePixels(src, srcStep, width, rows, out, stride, bytesPerPixel, rotate);
+}
+
+bool FrameConverter::scale(const AVFrame* pFrame, int width, int height, uchar* dst, int stride, PixelLayout layout, unsigned rotate) {
+    const AVPixelFormat srcFormat = (AVPixelFormat)pFrame->format;
+    const int slices = sliceCount(pFrame, width, height);
+    const int bytesPerPixel = layout == PixelLayout::RGBA16 ? 8 : 4;
+    auto& contexts = _contexts[(int)layout];
+    if ((int)contexts.size() != slices) {
+        freeContexts(layout);
+        contexts.assign(slices, nullptr);
+    }
+
+    if (slices == 1) {
+        // Returns the cached context untouched unless the source or destination geometry changed.
+        contexts[0] = sws_getCachedContext(contexts[0], pFrame->width, pFrame->height, srcFormat,
+                                           width, height, avFormat(layout), _flags, nullptr, nullptr, nullptr);
+        if (contexts[0] == nullptr)
+            return false;
+        applyColorDetails(contexts[0], pFrame);
+        if (rotate >= 3)
+            return sws_scale(contexts[0], pFrame->data, pFrame->linesize, 0, pFrame->height, &dst, &stride) > 0;
+        _rotateScratch.create(height, width, matType(layout));
+        uchar* data = _rotateScratch.data;
+        int step = _rotateScratch.step;
+        if (sws_scale(contexts[0], pFrame->data, pFrame->linesize, 0, pFrame->height, &data, &step) <= 0)
+            return false;
+        const int bands = std::min((int)WorkerPool::shared().size() + 1, std::max(1, height / MinSliceRows));
+        const int rows = (height + bands - 1) / bands;
+        WorkerPool::shared().parallelFor(bands, [&](int i) {
+            const int y = i * rows;
+            if (y < height)
+                rotateRows(data + (ptrdiff_t)y * step, step, y, std::min(rows, height - y), width, height, dst, stride, bytesPerPixel, rotate);
+        });
+        return true;
+    }
+
+    // Slice boundaries sit on chroma rows so every slice is a valid image of its own. The scaler treats
+    // slice edges as frame edges, which only affects the vertical chroma interpolation of subsampled input.
+    const AVPixFmtDescriptor* desc = av_pix_fmt_desc_get(srcFormat);
+    const int align = 1 << desc->log2_chroma_h;
+    // Rounded up on both counts, so the slices cover every row; the last one may come out shorter, or empty
+    const int rows = ((height + slices - 1) / slices + align - 1) / align * align;
+    if (rotate < 3)
+        _sliceScratch.resize(slices);
+    std::atomic<bool> failed{false};
+    WorkerPool::shared().parallelFor(slices, [&](int i) {
+        const int y = i * rows;
+        const int h = std::min(rows, height - y);
+        if (h <= 0)
+            return;
+        SwsContext*& pContext = contexts[i];
+        pContext = sws_getCachedContext(pContext, pFrame->width, h, srcFormat, width, h, avFormat(layout), _flags, nullptr, nullptr, nullptr);
+        if (pContext == nullptr) {
+            failed = true;
+            return;
+        }
+        applyColorDetails(pContext, pFrame);
+        const uint8_t* src[4] = {};
+        for (int plane = 0; plane < 4 && pFrame->data[plane]; plane++) {
+            const int shift = (plane == 1 || plane == 2) ? desc->log2_chroma_h : 0;
+            src[plane] = pFrame->data[plane] + (ptrdiff_t)(y >> shift) * pFrame->linesize[plane];
+        }
+        if (rotate >= 3) {
+            uchar* out = dst + (ptrdiff_t)y * stride;
+            sws_scale(pContext, src, pFrame->linesize, 0, h, &out, &stride);
+            return;
+        }
+        // The slice is rotated into place by the same worker right after conversion, while it is still in cache
+        Mat& scratch = _sliceScratch[i];
+        scratch.create(h, width, matType(layout));
+        uchar* out = scratch.data;
+        int step = scratch.step;
+        sws_scale(pContext, src, pFrame->linesize, 0, h, &out, &step);
+        rotateRows(out, step, y, h, width, height, dst, stride, bytesPerPixel, rotate);
+    });
+    return !failed;
+}
+
+bool FrameConverter::convert(const AVFrame* pFrame, int width, int height, uchar* dst, int stride, PixelLayout layout, unsigned rotate) {
+    if (pFrame == nullptr || pFrame->width <= 0 || pFrame->height <= 0 || dst == nullptr)
+        return false;
+    if (layout == PixelLayout::YUVPlanar) {
+        auto format = (AVPixelFormat)pFrame->format;
+        int size = av_image_get_buffer_size(format, pFrame->width, pFrame->height, 1);
+        return av_image_copy_to_buffer(dst, size, pFrame->data, pFrame->linesize, format, pFrame->width, pFrame->height, 1) >= 0;
+    }
+    auto start = chrono::steady_clock::now();
+    if (!scale(pFrame, width, height, dst, stride, layout, rotate)) {
+        qCritical() << "Unable to setup conversion context";
+        return false;
+    }
+    _lastMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    _totalMs += _lastMs;
+    _conversions++;
+    return true;
+}
+
+double FrameConverter::lumaLevel(const AVFrame* pFrame, int sampleStep) {
+    if (pFrame == nullptr || pFrame->data[0] == nullptr || pFrame->width <= 0 || pFrame->height <= 0)
+        return -1;
+    const AVPixFmtDescriptor* desc = av_pix_fmt_desc_get((AVPixelFormat)pFrame->format);
+    // Planar YUV or gray, with luma alone in plane 0
+    if (desc == nullptr || (desc->flags & (AV_PIX_FMT_FLAG_RGB | AV_PIX_FMT_FLAG_PAL | AV_PIX_FMT_FLAG_BITSTREAM | AV_PIX_FMT_FLAG_HWACCEL))
+        || desc->comp[0].plane != 0 || desc->comp[0].step > (desc->comp[0].depth > 8 ? 2 : 1)) {
+        return -1;
+    }
+    const int depth = desc->comp[0].depth;
+    const bool wide = depth > 8;
+    const bool bigEndian = desc->flags & AV_PIX_FMT_FLAG_BE;
+    double sum = 0;
+    long long samples = 0;
+    for (int y = 0; y < pFrame->height; y += sampleStep) {
+        const uchar* row = pFrame->data[0] + (ptrdiff_t)y * pFrame->linesize[0];
+        for (int x = 0; x < pFrame->width; x += sampleStep) {
+            unsigned v;
+            if (wide) {
+                const uchar* p = row + 2 * x;
+                v = bigEndian ? (p[0] << 8 | p[1]) : (p[1] << 8 | p[0]);
+                v >>= desc->comp[0].shift;
+            } else {
+                v = row[x];
+            }
+            sum += v;
+            samples++;
+        }
+    }
+    double mean = sum / samples / (1 << (depth - 8)); // 8-bit scale
+    // Limited range puts black at 16 and white at 235; gray formats are full range unless tagged otherwise
+    const bool gray = desc->nb_components <= 2;
+    const bool fullRange = pFrame->color_range == AVCOL_RANGE_JPEG || (gray && pFrame->color_range != AVCOL_RANGE_MPEG);
+    if (!fullRange)
+        mean = (mean - 16) * 255.0 / 219.0;
+    return std::clamp(mean, 0.0, 255.0);
+}
+
+Mat FrameConverter::wrap(const AVFrame* pFrame) {
+    if (pFrame == nullptr || pFrame->data[0] == nullptr || pFrame->linesize[0] <= 0)
+        return Mat();
+    int type;
+    switch (pFrame->format) {
+    case AV_PIX_FMT_RGBA:
+    case AV_PIX_FMT_BGRA:
+        type = CV_8UC4;
+        break;
+    case AV_PIX_FMT_RGB24:
+    case AV_PIX_FMT_BGR24:
+        type = CV_8UC3;
+        break;
+    case AV_PIX_FMT_RGBA64LE:
+    case AV_PIX_FMT_BGRA64LE:
+        type = CV_16UC4;
+        break;
+    case AV_PIX_FMT_RGB48LE:
+    case AV_PIX_FMT_BGR48LE:
+        type = CV_16UC3;
+        break;
+    default:
+        return Mat();
+    }
+    return Mat(pFrame->height, pFrame->width, type, pFrame->data[0], pFrame->linesize[0]);
+}
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+extern "C" {
+#include "libswscale/swscale.h"
+#include "libavutil/imgutils.h"
+#include "libavutil/frame.h"
+}
+
+#include <opencv2/opencv.hpp>
+#include <QString>
+#include "Reader.h"
+
+namespace videoio {
+using namespace std;
+using namespace cv;
+
+// Converts decoded AVFrames straight into caller-owned memory.
+// Every output layout keeps its own cached SwsContexts, so switching between them never rebuilds anything.
+// When the conversion keeps the frame height, the frame is cut into horizontal slices that are
+// converted in parallel on the shared WorkerPool, each slice with its own SwsContext.
+class FrameConverter {
+    static constexpr int LayoutCount = 5;
+    vector<SwsContext*> _contexts[LayoutCount];
+    int _flags = SWS_BICUBIC;
+    int _threads = 0;
+    int _colorSpace = -1, _colorRange = -1; // -1: as tagged on the frame
+    Mat _rotateScratch;
+    vector<Mat> _sliceScratch;
+    long long _conversions = 0;
+    double _totalMs = 0, _lastMs = 0;
+
+    int sliceCount(const AVFrame* pFrame, int width, int height) const;
+    // Converts and, for rotate < 3, rotates: each slice is rotated into dst by the worker that converted it, while
+    // it is still in cache. A single context (vertical scaling) converts the whole frame into _rotateScratch first.
+    bool scale(const AVFrame* pFrame, int width, int height, uchar* dst, int stride, PixelLayout layout, unsigned rotate);
+    void freeContexts(PixelLayout layout);
+    // Points a context's YUV -> RGB at the colour space and range frames are to be read with. Only touches it
+    // when they differ from what it has, so it costs nothing per frame.
+    void applyColorDetails(SwsContext* pContext, const AVFrame* pFrame) const;
+
+public:
+    FrameConverter() = default;
+    FrameConverter(const FrameConverter&) = delete;
+    FrameConverter& operator=(const FrameConverter&) = delete;
+    ~FrameConverter() { reset(); }
+
+    static AVPixelFormat avFormat(PixelLayout layout);
+    static int matType(PixelLayout layout);
+    // Whether swscale can write the layout; RGB10A2 needs a recent enough libswscale
+    static bool supportsOutput(PixelLayout layout);
+    // SWS_* flags for "point", "fast_bilinear", "bilinear", "bicubic", "area", "spline" or "lanczos"; -1 if unknown.
+    static int scalerFlags(const QString& quality);
+
+    // Checks that srcFormat can be converted and warms up the default RGBA16 context.
+    bool prepare(int srcWidth, int srcHeight, AVPixelFormat srcFormat, int width, int height);
+    void reset();
+
+    // Number of slices a frame is split into, <= 0 for one per pool thread (plus the caller).
+    void setThreads(int threads);
+    int threads() const { return _threads; }
+    void setScalerFlags(int flags);
+    int scalerFlags() const { return _flags; }
+    // AVColorSpace/AVColorRange to convert YUV with instead of the frames' tags, -1 to follow the tags. Cached
+    // contexts pick it up with their next frame, nothing is rebuilt.
+    void setColorDetails(int colorSpace, int colorRange);
+
+    // Scales to width x height, then applies rotate (a cv::RotateFlags value, >= 3 for none).
+    // YUVPlanar ignores size and rotation and copies the planes tightly packed.
+    bool convert(const AVFrame* pFrame, int width, int height, uchar* dst, int stride, PixelLayout layout, unsigned rotate);
+
+    long long conversions() const { return _conversions; }
+    double lastConvertMs() const { return _lastMs; }
+    double averageConvertMs() const { return _conversions ? _totalMs / _conversions : 0; }
+
+    // Average brightness on a 0..255 gray scale, estimated from a sparse sample of the luma plane.
+    // -1 for formats without a separate luma plane (packed RGB and the like).
+    static double lumaLevel(const AVFrame* pFrame, int sampleStep = 8);
+
+    // Zero-copy view of a frame that is already packed RGB(A); empty for any other pixel format.
+    // The view is only valid as long as the frame keeps its buffers.
+    static Mat wrap(const AVFrame* pFrame);
+};
+}
@@ -0,0 +1,134 @@
+#pragma once
+
+extern "C" {
+#include "libavutil/frame.h"
+}
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+namespace videoio {
+using namespace std;
+
+// Recycles AVFrame shells. release() only drops the frame's buffer references (which go back to the
+// decoder's buffer pool), so once warmed up acquire()/release() never touch the heap.
+class FramePool {
+    std::mutex _lock;
+    vector<AVFrame*> _free;
+    size_t _maxFree; // shells kept for reuse, the rest are freed on release()
+    std::atomic<long long> _allocations{0};
+
+public:
+    explicit FramePool(size_t capacity = 32) : _maxFree(capacity) { _free.reserve(capacity); }
+    ~FramePool() {
+        for (auto pFrame : _free)
+            av_frame_free(&pFrame);
+    }
+
+    // Not a steady-state call: grows the free list so that capacity shells can be kept around.
+    void reserve(size_t capacity) {
+        std::lock_guard<std::mutex> g(_lock);
+        _maxFree = std::max(_maxFree, capacity);
+        _free.reserve(_maxFree);
+    }
+
+    AVFrame* acquire() {
+        {
+            std::lock_guard<std::mutex> g(_lock);
+            if (!_free.empty()) {
+                AVFrame* pFrame = _free.back();
+                _free.pop_back();
+                return pFrame;
+            }
+        }
+        _allocations++;
+        return av_frame_alloc();
+    }
+
+    void release(AVFrame* pFrame) {
+        if (pFrame == nullptr)
+            return;
+        av_frame_unref(pFrame);
+        {
+            std::lock_guard<std::mutex> g(_lock);
+            if (_free.size() < _maxFree) {
+                _free.push_back(pFrame);
+                return;
+            }
+        }
+        av_frame_free(&pFrame);
+    }
+
+    long long allocations() const { return _allocations; }
+    size_t available() {
+        std::lock_guard<std::mutex> g(_lock);
+        return _free.size();
+    }
+};
+
+// Fixed-capacity window of decoded frames in presentation order. Pushing onto a full ring evicts the
+// oldest frame back into the pool; all operations are O(1) except the O(log n) pts lookups.
+class FrameRing {
+    vector<AVFrame*> _slots;
+    size_t _head = 0, _count = 0;
+    FramePool* _pool;
+
+    size_t slot(size_t i) const { return (_head + i) % _slots.size(); }
+
+public:
+    FrameRing(FramePool* pool, size_t capacity) : _slots(std::max<size_t>(capacity, 1), nullptr), _pool(pool) {}
+    ~FrameRing() { clear(); }
+
+    void reset(size_t capacity) {
+        clear();
+        _slots.assign(std::max<size_t>(capacity, 1), nullptr);
+        _head = 0;
+    }
+
+    size_t size() const { return _count; }
+    size_t capacity() const { return _slots.size(); }
+    bool empty() const { return _count == 0; }
+    bool full() const { return _count == _slots.size(); }
+
+    AVFrame* operator[](size_t i) const { return _slots[slot(i)]; }
+    AVFrame* front() const { return _slots[_head]; }
+    AVFrame* back() const { return _slots[slot(_count - 1)]; }
+
+    void push_back(AVFrame* pFrame) {
+        if (full())
+            pop_front();
+        _slots[slot(_count)] = pFrame;
+        _count++;
+    }
+
+    void pop_front() {
+        if (empty())
+            return;
+        _pool->release(_slots[_head]);
+        _slots[_head] = nullptr;
+        _head = slot(1);
+        _count--;
+    }
+
+    void clear() {
+        while (!empty())
+            pop_front();
+        _head = 0;
+    }
+
+    // Index of the first frame with pts > pts (size() when there is none).
+    int upperBound(int64_t pts) const {
+        size_t lo = 0, hi = _count;
+        while (lo < hi) {
+            size_t mid = (lo + hi) / 2;
+            if ((*this)[mid]->pts <= pts)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        return (int)lo;
+    }
+};
+}
@@ -0,0 +1,403 @@
+#include "gopcache.h"
+#include <QDebug>
+#include <algorithm>
+
+namespace videoio {
+using namespace std;
+
+// Demuxer seeks that land after the wanted frame are retried this many frames earlier per attempt.
+static constexpr int SeekBackoffFrames = 60;
+
+size_t GopCache::frameBytes(const AVFrame* pFrame) {
+    size_t bytes = 0;
+    for (int i = 0; i < AV_NUM_DATA_POINTERS && pFrame->buf[i]; i++)
+        bytes += pFrame->buf[i]->size;
+    for (int i = 0; i < pFrame->nb_extended_buf; i++)
+        bytes += pFrame->extended_buf[i]->size;
+    return bytes;
+}
+
+void GopCache::open(const QString& path, int streamIndex, int64_t timestep, int64_t startPts,
+                    const PacketIndex* index, const std::atomic<bool>* indexReady) {
+    close();
+    _path = path;
+    _streamIndex = streamIndex;
+    _timestep = std::max<int64_t>(timestep, 1);
+    _startPts = startPts;
+    _index = index;
+    _indexReady = indexReady;
+    _abort = false;
+    _prefetchStop = false;
+    _prefetchThread = std::thread(&GopCache::prefetchLoop, this);
+}
+
+void GopCache::close() {
+    {
+        std::lock_guard<std::mutex> g(_lock);
+        _prefetchStop = true;
+        _prefetchPts = AV_NOPTS_VALUE;
+    }
+    _abort = true;
+    _prefetchCv.notify_all();
+    if (_prefetchThread.joinable())
+        _prefetchThread.join();
+    std::lock_guard<std::mutex> d(_decodeLock);
+    closeDecoder();
+    clear();
+    _streamIndex = -1;
+}
+
+bool GopCache::openDecoder() {
+    if (_pCodecContext != nullptr)
+        return true;
+    auto path = _path.toStdString();
+    if (avformat_open_input(&_pFormat, path.c_str(), nullptr, nullptr) != 0) {
+        qCritical() << "GopCache: unable to open file" << _path;
+        return false;
+    }
+    if (avformat_find_stream_info(_pFormat, nullptr) < 0 || _streamIndex >= (int)_pFormat->nb_streams) {
+        qCritical() << "GopCache: unable to find stream" << _streamIndex << "in file" << _path;
+        closeDecoder();
+        return false;
+    }
+    for (unsigned i = 0; i < _pFormat->nb_streams; i++)
+        _pFormat->streams[i]->discard = (int)i == _streamIndex ? AVDISCARD_DEFAULT : AVDISCARD_ALL;
+    const AVCodecParameters* par = _pFormat->streams[_streamIndex]->codecpar;
+    const AVCodec* pCodec = avcodec_find_decoder(par->codec_id);
+    _pCodecContext = pCodec ? avcodec_alloc_context3(pCodec) : nullptr;
+    if (_pCodecContext == nullptr || avcodec_parameters_to_context(_pCodecContext, par) < 0) {
+        qCritical() << "GopCache: unable to set up decoder for" << _path;
+        closeDecoder();
+        return false;
+    }
+    // Whole GOPs are decoded in one go, frame threading pays off here
+    _pCodecContext->thread_count = 0;
+    if (avcodec_open2(_pCodecContext, pCodec, nullptr) < 0) {
+        qCritical() << "GopCache: unable to open decoder for" << _path;
+        closeDecoder();
+        return false;
+    }
+    return true;
+}
+
+void GopCache::closeDecoder() {
+    avcodec_free_context(&_pCodecContext);
+    if (_pFormat != nullptr)
+        avformat_close_input(&_pFormat);
+}
+
+bool GopCache::decode(int64_t pts, size_t budget, Segment& segment) {
+    if (!openDecoder())
+        return false;
+    const int64_t limit = pts + 1; // frames after pts were already shown
+    int64_t seekPts = pts, indexedKey = AV_NOPTS_VALUE;
+    if (_indexReady != nullptr && *_indexReady) {
+        if (const PacketIndexEntry* pKey = _index->keyFrameBefore(pts))
+            seekPts = indexedKey = pKey->pts;
+    }
+
+    deque<AVFrame*> window;
+    size_t bytes = 0;
+    auto releaseWindow = [&] {
+        for (auto pFrame : window)
+            _pool->release(pFrame);
+        window.clear();
+        bytes = 0;
+    };
+    AVPacket* pPacket = av_packet_alloc();
+    for (int attempt = 0; attempt < 5 && !_abort; attempt++) {
+        releaseWindow();
+        if (av_seek_frame(_pFormat, _streamIndex, seekPts, AVSEEK_FLAG_BACKWARD) < 0)
+            break;
+        avcodec_flush_buffers(_pCodecContext);
+        int64_t keyPts = indexedKey;
+        bool done = false;
+        auto receive = [&] {
+            for (;;) {
+                AVFrame* pFrame = _pool->acquire();
+                if (avcodec_receive_frame(_pCodecContext, pFrame) < 0) {
+                    _pool->release(pFrame);
+                    return;
+                }
+                pFrame->pts = pFrame->best_effort_timestamp;
+                if (pFrame->pts != AV_NOPTS_VALUE && pFrame->pts >= limit) {
+                    _pool->release(pFrame);
+                    done = true;
+                    return;
+                }
+                // Frames of an earlier GOP, or open-GOP leading frames that precede their keyframe
+                if (pFrame->pts == AV_NOPTS_VALUE || (keyPts != AV_NOPTS_VALUE && pFrame->pts < keyPts)) {
+                    _pool->release(pFrame);
+                    continue;
+                }
+                window.push_back(pFrame);
+                bytes += frameBytes(pFrame);
+                // Over budget: keep the newest frames, they are the next ones shown in reverse
+                while (bytes > budget && window.size() > 1) {
+                    bytes -= frameBytes(window.front());
+                    _pool->release(window.front());
+                    window.pop_front();
+                }
+            }
+        };
+        while (!done && !_abort) {
+            if (av_read_frame(_pFormat, pPacket) < 0) {
+                avcodec_send_packet(_pCodecContext, nullptr);
+                receive();
+                break;
+            }
+            if (pPacket->stream_index == _streamIndex) {
+                // Without an index the seek may land a few GOPs early; every keyframe up to pts restarts the GOP
+                if ((pPacket->flags & AV_PKT_FLAG_KEY) && pPacket->pts != AV_NOPTS_VALUE && pPacket->pts <= pts && pPacket->pts != keyPts) {
+                    keyPts = pPacket->pts;
+                    while (!window.empty() && window.front()->pts < keyPts) {
+                        bytes -= frameBytes(window.front());
+                        _pool->release(window.front());
+                        window.pop_front();
+                    }
+                }
+                if (avcodec_send_packet(_pCodecContext, pPacket) >= 0)
+                    receive();
+            }
+            av_packet_unref(pPacket);
+        }
+        if (!window.empty() || seekPts <= _startPts)
+            break;
+        // The demuxer landed after pts, back off
+        seekPts = std::max(_startPts, pts - _timestep * SeekBackoffFrames * (attempt + 1));
+        indexedKey = AV_NOPTS_VALUE;
+    }
+    av_packet_free(&pPacket);
+    if (window.empty() || _abort) {
+        releaseWindow();
+        return false;
+    }
+    segment.begin = window.front()->pts;
+    segment.end = limit;
+    segment.frames.assign(window.begin(), window.end());
+    segment.bytes = bytes;
+    return true;
+}
+
+GopCache::Segment* GopCache::find(int64_t pts) {
+    auto it = _segments.upper_bound(pts);
+    if (it == _segments.begin())
+        return nullptr;
+    --it;
+    return pts < it->second.end ? &it->second : nullptr;
+}
+
+void GopCache::releaseSegment(Segment& segment) {
+    for (auto pFrame : segment.frames)
+        _pool->release(pFrame);
+    _bytes -= segment.bytes;
+    segment.frames.clear();
+    segment.bytes = 0;
+}
+
+void GopCache::insert(Segment&& segment) {
+    // A fresh decode supersedes anything it overlaps
+    for (auto it = _segments.begin(); it != _segments.end();) {
+        if (it->second.begin < segment.end && segment.begin < it->second.end) {
+            releaseSegment(it->second);
+            it = _segments.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    const int64_t begin = segment.begin;
+    segment.lastUse = ++_tick;
+    _bytes += segment.bytes;
+    _segments.emplace(begin, std::move(segment));
+    evict(begin);
+}
+
+void GopCache::evict(int64_t keep) {
+    while (_bytes > _budget) {
+        auto victim = _segments.end();
+        for (auto it = _segments.begin(); it != _segments.end(); ++it) {
+            if (it->first == keep || it->first == _pinned)
+                continue;
+            if (victim == _segments.end() || it->second.lastUse < victim->second.lastUse)
+                victim = it;
+        }
+        if (victim == _segments.end())
+            return;
+        releaseSegment(victim->second);
+        _segments.erase(victim);
+    }
+}
+
+void GopCache::setBudget(size_t bytes) {
+    std::lock_guard<std::mutex> g(_lock);
+    _budget = bytes;
+    evict(AV_NOPTS_VALUE);
+}
+
+void GopCache::clear() {
+    std::lock_guard<std::mutex> g(_lock);
+    for (auto& entry : _segments)
+        releaseSegment(entry.second);
+    _segments.clear();
+    _bytes = 0;
+    _pinned = AV_NOPTS_VALUE;
+}
+
+size_t GopCache::bytes() {
+    std::lock_guard<std::mutex> g(_lock);
+    return _bytes;
+}
+
+size_t GopCache::segmentCount() {
+    std::lock_guard<std::mutex> g(_lock);
+    return _segments.size();
+}
+
+void GopCache::retain(const vector<AVFrame*>& frames, int64_t end) {
+    if (!isOpen() || frames.empty())
+        return;
+    std::lock_guard<std::mutex> g(_lock);
+    // Split the run around whatever is cached already, each uncovered piece becomes a segment
+    Segment segment;
+    auto flush = [&](int64_t pieceEnd) {
+        if (segment.frames.empty())
+            return;
+        segment.end = pieceEnd;
+        insert(std::move(segment));
+        segment = Segment();
+    };
+    for (size_t i = 0; i < frames.size(); i++) {
+        int64_t next = i + 1 < frames.size() ? frames[i + 1]->pts : end;
+        if (Segment* pCovering = find(frames[i]->pts)) {
+            pCovering->lastUse = ++_tick;
+            flush(frames[i]->pts);
+            continue;
+        }
+        if (segment.frames.empty())
+            segment.begin = frames[i]->pts;
+        AVFrame* pFrame = _pool->acquire();
+        av_frame_ref(pFrame, frames[i]);
+        segment.frames.push_back(pFrame);
+        segment.bytes += frameBytes(pFrame);
+        // Stop short of a segment that starts before the next frame
+        auto after = _segments.upper_bound(frames[i]->pts);
+        if (after != _segments.end() && after->first < next)
+            flush(after->first);
+    }
+    flush(end);
+}
+
+int GopCache::peek(int64_t pts, int count, vector<AVFrame*>& out, int& index) {
+    if (!isOpen() || count <= 0)
+        return 0;
+    std::lock_guard<std::mutex> g(_lock);
+    // Half a frame of slack for ms <-> timebase rounding, as in the reader's own lookups
+    const int64_t slack = _timestep / 2;
+    Segment* pSegment = find(pts + slack);
+    if (pSegment == nullptr || pSegment->frames.empty()) {
+        _seekMisses++;
+        return 0;
+    }
+    auto& frames = pSegment->frames;
+    int at = int(upper_bound(frames.begin(), frames.end(), pts + slack, [](int64_t p, const AVFrame* pFrame) { return p < pFrame->pts; }) - frames.begin()) - 1;
+    if (at < 0) {
+        _seekMisses++;
+        return 0;
+    }
+    int first = std::max(0, std::min(at, (int)frames.size() - count));
+    int last = std::min((int)frames.size(), first + count);
+    for (int i = first; i < last; i++) {
+        AVFrame* pFrame = _pool->acquire();
+        av_frame_ref(pFrame, frames[i]);
+        out.push_back(pFrame);
+    }
+    index = at - first;
+    pSegment->lastUse = ++_tick;
+    _seekHits++;
+    return last - first;
+}
+
+int GopCache::fetch(int64_t pts, int count, vector<AVFrame*>& out) {
+    if (!isOpen() || count <= 0)
+        return 0;
+    std::unique_lock<std::mutex> l(_lock);
+    Segment* pSegment = find(pts);
+    if (pSegment != nullptr) {
+        _hits++;
+    } else {
+        _misses++;
+        l.unlock();
+        {
+            // A prefetch of this very GOP may be running, taking the decoder waits for it to land
+            std::lock_guard<std::mutex> d(_decodeLock);
+            bool cached;
+            {
+                std::lock_guard<std::mutex> g(_lock);
+                cached = find(pts) != nullptr;
+            }
+            Segment segment;
+            if (!cached && decode(pts, _budget, segment)) {
+                std::lock_guard<std::mutex> g(_lock);
+                insert(std::move(segment));
+            }
+        }
+        l.lock();
+        pSegment = find(pts);
+        if (pSegment == nullptr)
+            return 0;
+    }
+
+    auto& frames = pSegment->frames;
+    int last = int(upper_bound(frames.begin(), frames.end(), pts, [](int64_t p, const AVFrame* pFrame) { return p < pFrame->pts; }) - frames.begin()) - 1;
+    if (last < 0)
+        return 0;
+    int first = std::max(0, last - count + 1);
+    for (int i = first; i <= last; i++) {
+        AVFrame* pFrame = _pool->acquire();
+        av_frame_ref(pFrame, frames[i]);
+        out.push_back(pFrame);
+    }
+    pSegment->lastUse = ++_tick;
+    _pinned = pSegment->begin;
+
+    // Reverse playback reaches the start of this run next, get the frames before it ready
+    if (pSegment->begin > _startPts && find(pSegment->begin - 1) == nullptr) {
+        _prefetchPts = pSegment->begin - 1;
+        _prefetchCv.notify_one();
+    }
+    return last - first + 1;
+}
+
+void GopCache::prefetchLoop() {
+    for (;;) {
+        int64_t pts;
+        size_t budget;
+        {
+            std::unique_lock<std::mutex> l(_lock);
+            _prefetchCv.wait(l, [this] { return _prefetchStop || _prefetchPts != AV_NOPTS_VALUE; });
+            if (_prefetchStop)
+                return;
+            pts = _prefetchPts;
+            _prefetchPts = AV_NOPTS_VALUE;
+            // Whatever the segment being served leaves of the budget
+            auto pinned = _segments.find(_pinned);
+            size_t used = pinned == _segments.end() ? 0 : pinned->second.bytes;
+            budget = _budget > used ? _budget - used : 0;
+        }
+        if (budget == 0)
+            continue;
+        std::lock_guard<std::mutex> d(_decodeLock);
+        {
+            std::lock_guard<std::mutex> g(_lock);
+            if (_prefetchStop || find(pts) != nullptr)
+                continue;
+        }
+        Segment segment;
+        if (decode(pts, budget, segment)) {
+            std::lock_guard<std::mutex> g(_lock);
+            insert(std::move(segment));
+            _prefetched++;
+        }
+    }
+}
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+extern "C" {
+#include "libavcodec/avcodec.h"
+#include "libavformat/avformat.h"
+}
+
+#include <QString>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "framering.h"
+#include "packetindex.h"
+
+namespace videoio {
+using namespace std;
+
+// Decoded runs of frames keyed by pts range, bounded by a byte budget and evicted least recently used first.
+// Runs come from two places: windows the reader retains before it seeks away (retain(), served back by peek()
+// so bouncing between two points never decodes twice), and GOPs decoded for backward stepping and reverse
+// playback (fetch()). A fetch() miss decodes the GOP holding the requested frame once, on a demuxer/decoder of
+// its own so the reader's forward position is never disturbed, and the GOP before the one being served is
+// decoded in the background. When a GOP does not fit the budget only its newest frames are kept.
+class GopCache {
+    struct Segment {
+        int64_t begin, end;     // pts of the first frame, exclusive upper bound
+        vector<AVFrame*> frames; // presentation order
+        size_t bytes = 0;
+        uint64_t lastUse = 0;
+    };
+
+    FramePool* _pool;
+    QString _path;
+    int _streamIndex = -1;
+    int64_t _timestep = 1, _startPts = 0;
+    const PacketIndex* _index = nullptr;
+    const std::atomic<bool>* _indexReady = nullptr;
+
+    std::mutex _lock; // segments and counters
+    map<int64_t, Segment> _segments; // by begin
+    size_t _bytes = 0, _budget = size_t(1) << 30;
+    uint64_t _tick = 0;
+    int64_t _pinned = AV_NOPTS_VALUE; // begin of the segment served last, never evicted
+    std::atomic<long long> _hits{0}, _misses{0}, _prefetched{0}, _seekHits{0}, _seekMisses{0};
+
+    // Helper decoder, opened lazily and used by fetch() misses and the prefetcher alike
+    std::mutex _decodeLock;
+    AVFormatContext* _pFormat = nullptr;
+    AVCodecContext* _pCodecContext = nullptr;
+
+    std::thread _prefetchThread;
+    std::condition_variable _prefetchCv;
+    int64_t _prefetchPts = AV_NOPTS_VALUE;
+    bool _prefetchStop = false;
+    std::atomic<bool> _abort{false};
+
+    bool openDecoder();
+    void closeDecoder();
+    bool decode(int64_t pts, size_t budget, Segment& segment);
+    void insert(Segment&& segment);
+    void evict(int64_t keep);
+    Segment* find(int64_t pts);
+    void releaseSegment(Segment& segment);
+    void prefetchLoop();
+    static size_t frameBytes(const AVFrame* pFrame);
+
+public:
+    explicit GopCache(FramePool* pool) : _pool(pool) {}
+    GopCache(const GopCache&) = delete;
+    GopCache& operator=(const GopCache&) = delete;
+    ~GopCache() { close(); }
+
+    // index/indexReady are optional; with them GOP boundaries come from the packet index instead of probing.
+    void open(const QString& path, int streamIndex, int64_t timestep, int64_t startPts,
+              const PacketIndex* index = nullptr, const std::atomic<bool>* indexReady = nullptr);
+    void close();
+    bool isOpen() const { return _streamIndex >= 0; }
+    void setBudget(size_t bytes);
+    size_t budget() const { return _budget; }
+
+    // Appends references to up to count frames ending with the last one at or before pts, oldest first.
+    // Decodes on a miss and queues the GOP before the served one for prefetching. Returns the number of frames.
+    int fetch(int64_t pts, int count, vector<AVFrame*>& out);
+    // Keeps references to a contiguous run of frames (presentation order) ending before end. Parts already
+    // held by other segments are skipped.
+    void retain(const vector<AVFrame*>& frames, int64_t end);
+    // Appends references to up to count frames of the segment holding pts, starting with the frame covering
+    // it when the segment has that many after it; index is where that frame ended up. Never decodes.
+    int peek(int64_t pts, int count, vector<AVFrame*>& out, int& index);
+    void clear();
+
+    size_t bytes();
+    size_t segmentCount();
+    long long seekHits() const { return _seekHits; }
+    long long seekMisses() const { return _seekMisses; }
+    long long hits() const { return _hits; }
+    long long misses() const { return _misses; }
+    long long prefetched() const { return _prefetched; }
+};
+}
@@ -0,0 +1,385 @@
+#include "imagesequencereader.h"
+#include "workerpool.h"
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QRegularExpression>
+#include <algorithm>
+#include <chrono>
+
+namespace videoio {
+using namespace cv;
+using namespace std;
+
+AVCodecID ImageSequenceReader::codecFor(const QString& path) {
+    QString ext = QFileInfo(path).suffix().toLower();
+    if (ext == "dpx") return AV_CODEC_ID_DPX;
+    if (ext == "exr") return AV_CODEC_ID_EXR;
+    if (ext == "png") return AV_CODEC_ID_PNG;
+    if (ext == "tif" || ext == "tiff") return AV_CODEC_ID_TIFF;
+    if (ext == "jpg" || ext == "jpeg") return AV_CODEC_ID_MJPEG;
+    return AV_CODEC_ID_NONE;
+}
+
+vector<QString> ImageSequenceReader::discover(const QString& path, long long& firstNumber) {
+    static const QRegularExpression numbered("^(.*?)(\\d+)(\\.[^.]+)$");
+    QFileInfo fi(path);
+    firstNumber = 0;
+    auto match = numbered.match(fi.fileName());
+    if (!match.hasMatch())
+        return fi.isFile() ? vector<QString>{fi.absoluteFilePath()} : vector<QString>{};
+    QString prefix = match.captured(1), ext = match.captured(3);
+    QDir dir = fi.absoluteDir();
+    vector<pair<long long, QString>> numberedFiles;
+    for (const QString& name : dir.entryList({prefix + "*" + ext}, QDir::Files)) {
+        auto m = numbered.match(name);
+        if (m.hasMatch() && m.captured(1) == prefix && m.captured(3) == ext)
+            numberedFiles.emplace_back(m.captured(2).toLongLong(), dir.filePath(name));
+    }
+    sort(numberedFiles.begin(), numberedFiles.end());
+    vector<QString> files;
+    for (auto& f : numberedFiles)
+        files.push_back(f.second);
+    if (!numberedFiles.empty())
+        firstNumber = numberedFiles.front().first;
+    return files;
+}
+
+size_t ImageSequenceReader::frameBytes(const AVFrame* pFrame) {
+    int size = av_image_get_buffer_size((AVPixelFormat)pFrame->format, pFrame->width, pFrame->height, 1);
+    return size > 0 ? size : 0;
+}
+
+AVFrame* ImageSequenceReader::decodeFile(long long frame) {
+    auto begin = chrono::steady_clock::now();
+    QFile f(_files[frame]);
+    if (!f.open(QIODevice::ReadOnly))
+        return nullptr;
+    AVPacket* pPacket = av_packet_alloc();
+    AVFrame* pFrame = av_frame_alloc();
+    const AVCodec* pCodec = avcodec_find_decoder(_codecId);
+    AVCodecContext* pCodecContext = pCodec ? avcodec_alloc_context3(pCodec) : nullptr;
+    bool ok = pCodecContext != nullptr && av_new_packet(pPacket, int(f.size())) == 0
+              && f.read(reinterpret_cast<char*>(pPacket->data), pPacket->size) == pPacket->size;
+    if (ok) {
+        // Frames are decoded side by side, one thread each
+        pCodecContext->thread_count = 1;
+        pPacket->flags |= AV_PKT_FLAG_KEY;
+        ok = avcodec_open2(pCodecContext, pCodec, nullptr) >= 0 && avcodec_send_packet(pCodecContext, pPacket) >= 0;
+        if (ok && avcodec_receive_frame(pCodecContext, pFrame) < 0) {
+            avcodec_send_packet(pCodecContext, nullptr);
+            ok = avcodec_receive_frame(pCodecContext, pFrame) >= 0;
+        }
+    }
+    av_packet_free(&pPacket);
+    avcodec_free_context(&pCodecContext);
+    if (!ok) {
+        qCritical() << "Unable to decode" << _files[frame];
+        av_frame_free(&pFrame);
+        return nullptr;
+    }
+    pFrame->pts = frame;
+    double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - begin).count();
+    std::lock_guard<std::mutex> g(_lock);
+    _decodeMsTotal += ms;
+    _decodes++;
+    return pFrame;
+}
+
+bool ImageSequenceReader::inWindow(long long frame) const {
+    long long ahead = _direction > 0 ? _ahead : _behind, behind = _direction > 0 ? _behind : _ahead;
+    return frame >= _current - behind && frame <= _current + ahead;
+}
+
+void ImageSequenceReader::schedule() {
+    if (_stop || _files.empty())
+        return;
+    // Nearest first, in the direction of playback before the other one. Never more queued than the pool can
+    // start on, so a seek does not wait behind a backlog of frames nobody wants anymore.
+    int limit = (int)WorkerPool::shared().size() * 2;
+    int ahead = _ahead, behind = _behind;
+    if (!_cache.empty()) {
+        size_t bytes = frameBytes(_cache.begin()->second);
+        int fits = bytes ? int(_budget / bytes) : ahead + behind + 1;
+        ahead = std::min(ahead, std::max(1, fits * ahead / (ahead + behind + 1)));
+        behind = std::min(behind, std::max(0, fits - ahead - 1));
+    }
+    auto queue = [&](long long frame) {
+        if (frame < 0 || frame >= (long long)_files.size() || _inFlight >= limit)
+            return;
+        if (_cache.count(frame) || _pending.count(frame) || _failed.count(frame))
+            return;
+        _pending.insert(frame);
+        _inFlight++;
+        WorkerPool::shared().post([this, frame] {
+            bool wanted;
+            {
+                std::lock_guard<std::mutex> g(_lock);
+                wanted = !_stop && inWindow(frame);
+            }
+            AVFrame* pFrame = wanted ? decodeFile(frame) : nullptr;
+            std::lock_guard<std::mutex> g(_lock);
+            _pending.erase(frame);
+            if (pFrame != nullptr && !_stop && !_cache.count(frame)) {
+                _cache[frame] = pFrame;
+                _bytes += frameBytes(pFrame);
+                evict();
+            } else {
+                if (wanted && pFrame == nullptr)
+                    _failed.insert(frame);
+                av_frame_free(&pFrame);
+            }
+            _inFlight--;
+            schedule();
+            _decoded.notify_all();
+        });
+    };
+    for (int d = 0; d <= std::max(ahead, behind); d++) {
+        if (d <= ahead)
+            queue(_current + d * _direction);
+        if (d > 0 && d <= behind)
+            queue(_current - d * _direction);
+    }
+}
+
+void ImageSequenceReader::evict() {
+    while (_bytes > _budget && _cache.size() > 1) {
+        auto farthest = _cache.end();
+        for (auto it = _cache.begin(); it != _cache.end(); ++it) {
+            if (it->first != _current && (farthest == _cache.end() || std::abs(it->first - _current) > std::abs(farthest->first - _current)))
+                farthest = it;
+        }
+        if (farthest == _cache.end())
+            break;
+        _bytes -= frameBytes(farthest->second);
+        av_frame_free(&farthest->second);
+        _cache.erase(farthest);
+    }
+}
+
+AVFrame* ImageSequenceReader::frameAt(long long frame) {
+    std::unique_lock<std::mutex> l(_lock);
+    for (;;) {
+        auto it = _cache.find(frame);
+        if (it != _cache.end()) {
+            _hits++;
+            return av_frame_clone(it->second);
+        }
+        if (_failed.count(frame))
+            return nullptr;
+        if (!_pending.count(frame))
+            break;
+        _decoded.wait(l);
+    }
+    // Nobody is on it yet: decode here rather than queue behind the prefetch
+    _misses++;
+    _pending.insert(frame);
+    l.unlock();
+    AVFrame* pFrame = decodeFile(frame);
+    l.lock();
+    _pending.erase(frame);
+    if (pFrame == nullptr) {
+        _failed.insert(frame);
+        return nullptr;
+    }
+    _cache[frame] = pFrame;
+    _bytes += frameBytes(pFrame);
+    AVFrame* pRef = av_frame_clone(pFrame); // before evict(), which may well pick this one
+    evict();
+    _decoded.notify_all();
+    return pRef;
+}
+
+void ImageSequenceReader::dropAll() {
+    std::lock_guard<std::mutex> g(_lock);
+    for (auto& entry : _cache)
+        av_frame_free(&entry.second);
+    _cache.clear();
+    _failed.clear();
+    _bytes = 0;
+}
+
+bool ImageSequenceReader::open() {
+    qInfo() << "Trying to open the image sequence" << _path;
+    close();
+    _files = discover(_path, _firstNumber);
+    _codecId = _files.empty() ? AV_CODEC_ID_NONE : codecFor(_files.front());
+    if (_files.empty() || _codecId == AV_CODEC_ID_NONE) {
+        qCritical() << "No decodable image sequence at" << _path;
+        return false;
+    }
+    {
+        std::lock_guard<std::mutex> g(_lock);
+        _stop = false;
+    }
+    _current = 0;
+    _direction = 1;
+    unique_ptr<AVFrame, FrameDeleter> frame(frameAt(0));
+    AVFrame* pFrame = frame.get();
+    if (pFrame == nullptr)
+        return false;
+    _width = pFrame->width;
+    _height = pFrame->height;
+    AVRational sar = pFrame->sample_aspect_ratio.num ? pFrame->sample_aspect_ratio : AVRational{1, 1};
+    _width = lround(_width * av_q2d(sar));
+    if (!_converter.prepare(pFrame->width, pFrame->height, (AVPixelFormat)pFrame->format, _width, _height)) {
+        qCritical() << "Unable to setup conversion context";
+        return false;
+    }
+
+    long long count = _files.size();
+    _info["path"] = _path;
+    _info["rotation"] = _rotate;
+    _info["originalRotation"] = 3;
+    _info["fps"] = _fps;
+    _info["framerate"] = _fps;
+    _info["timebase"] = 1.0 / _fps;
+    _info["timestep"] = 1000.0 / _fps;
+    _info["step"] = 1;
+    _info["length"] = count;
+    _info["start"] = 0;
+    _info["startTimeMs"] = 0;
+    _info["duration"] = (long long)frame2ms(count);
+    _info["firstNumber"] = _firstNumber;
+    _info["sar"] = av_q2d(sar);
+    _info["pixelFormat"] = av_get_pix_fmt_name((AVPixelFormat)pFrame->format);
+    _info["originalColorPrimaries"] = pFrame->color_primaries;
+    _info["originalColorSpace"] = pFrame->colorspace;
+    _info["originalColorTrc"] = pFrame->color_trc;
+    _info["originalColorRange"] = pFrame->color_range;
+    _info["isBlackAndWhite"] = pFrame->format == AV_PIX_FMT_GRAY8 || pFrame->format == AV_PIX_FMT_GRAY16LE || pFrame->format == AV_PIX_FMT_GRAY16BE;
+    _info["isTelecined"] = false;
+    _info["originalSize"] = QSize(_width, _height);
+    QSize size = frameSize();
+    _info["width"] = size.width();
+    _info["height"] = size.height();
+    _info["size"] = size;
+    _info["resolution"] = size;
+    _info["adjustmentFactor"] = computeAdjustedFrameSize(size, 1.0);
+    _info["adjustedSize"] = _adjustedSize;
+    _info["sequenceCacheBytes"] = (long long)_budget;
+    _isOpen = true;
+    _isEOF = false;
+    moveTo(0);
+    qInfo() << "Opened image sequence" << _path << count << "frames from" << _firstNumber << "at" << _width << "x" << _height;
+    return true;
+}
+
+void ImageSequenceReader::close() {
+    {
+        std::unique_lock<std::mutex> l(_lock);
+        _stop = true;
+        // Queued jobs still refer to this reader
+        _decoded.wait(l, [this] { return _inFlight == 0; });
+        _pending.clear();
+    }
+    dropAll();
+    _converter.reset();
+    if (_isOpen)
+        Reader::close();
+}
+
+bool ImageSequenceReader::updateInfo(const QVariantMap& info) {
+    bool ret = false;
+    std::lock_guard<std::mutex> g(_lock);
+    if (info.contains("rotation")) {
+        _rotate = info["rotation"].toInt();
+        _info["rotation"] = _rotate;
+        ret = true;
+    }
+    if (info.contains("fps") && info["fps"].toDouble() > 0) {
+        _fps = info["fps"].toDouble();
+        _info["fps"] = _info["framerate"] = _fps;
+        _info["timebase"] = 1.0 / _fps;
+        _info["timestep"] = 1000.0 / _fps;
+        _info["duration"] = (long long)frame2ms(_files.size());
+        ret = true;
+    }
+    if (info.contains("sequenceCacheBytes")) {
+        _budget = std::max(0LL, info["sequenceCacheBytes"].toLongLong());
+        _info["sequenceCacheBytes"] = (long long)_budget;
+        evict();
+        ret = true;
+    }
+    if (info.contains("prefetchAhead")) {
+        _ahead = std::max(0, info["prefetchAhead"].toInt());
+        _info["prefetchAhead"] = _ahead;
+        ret = true;
+    }
+    if (info.contains("prefetchBehind")) {
+        _behind = std::max(0, info["prefetchBehind"].toInt());
+        _info["prefetchBehind"] = _behind;
+        ret = true;
+    }
+    return ret;
+}
+
+QVariantMap& ImageSequenceReader::getInfo() {
+    std::lock_guard<std::mutex> g(_lock);
+    _info["sequenceCachedFrames"] = (int)_cache.size();
+    _info["sequenceCacheUsedBytes"] = (long long)_bytes;
+    _info["sequenceCacheHits"] = _hits;
+    _info["sequenceCacheMisses"] = _misses;
+    _info["sequenceDecodesInFlight"] = _inFlight;
+    _info["sequenceDecodeMs"] = _decodes ? _decodeMsTotal / _decodes : 0.0;
+    _info["convertMs"] = _converter.lastConvertMs();
+    _info["convertAverageMs"] = _converter.averageConvertMs();
+    return Reader::getInfo();
+}
+
+vector<int64_t> ImageSequenceReader::getFrameBufferRange() {
+    std::lock_guard<std::mutex> g(_lock);
+    vector<int64_t> frames;
+    for (auto& entry : _cache)
+        frames.push_back(entry.first);
+    sort(frames.begin(), frames.end());
+    return frames;
+}
+
+Mat ImageSequenceReader::getFrame() {
+    unique_ptr<AVFrame, FrameDeleter> pFrame(_current >= 0 ? frameAt(_current) : nullptr);
+    if (pFrame == nullptr)
+        return Mat();
+    QSize size = frameSize();
+    Mat frame(size.height(), size.width(), CV_16UC4);
+    if (!_converter.convert(pFrame.get(), _width, _height, frame.data, frame.step, PixelLayout::RGBA16, _rotate))
+        return Mat();
+    return frame;
+}
+
+size_t ImageSequenceReader::frameBufferSize(PixelLayout layout) {
+    if (layout != PixelLayout::YUVPlanar)
+        return Reader::frameBufferSize(layout);
+    unique_ptr<AVFrame, FrameDeleter> pFrame(_current >= 0 ? frameAt(_current) : nullptr);
+    return pFrame == nullptr ? 0 : frameBytes(pFrame.get());
+}
+
+bool ImageSequenceReader::getFrameInto(uchar* dst, int stride, PixelLayout layout) {
+    unique_ptr<AVFrame, FrameDeleter> pFrame(_current >= 0 ? frameAt(_current) : nullptr);
+    return pFrame != nullptr && _converter.convert(pFrame.get(), _width, _height, dst, stride, layout, _rotate);
+}
+
+Mat ImageSequenceReader::getThumbnail(float width, int maxRead, int startFrame) {
+    if (!isOpen())
+        return Mat();
+    long long frame = std::clamp(ms2frame(startFrame), 0LL, (long long)_files.size() - 1);
+    long long end = std::min((long long)_files.size(), frame + std::max(1, maxRead));
+    unique_ptr<AVFrame, FrameDeleter> pFrame;
+    for (; frame < end; frame++) {
+        pFrame.reset(frameAt(frame));
+        double level = pFrame ? FrameConverter::lumaLevel(pFrame.get()) : -1;
+        if (pFrame != nullptr && (level < 0 || level > 30))
+            break;
+    }
+    if (pFrame == nullptr)
+        return Mat();
+    QSize size = frameSize();
+    Mat frame16(size.height(), size.width(), CV_16UC4), frame8, thumbnail;
+    if (!_converter.convert(pFrame.get(), _width, _height, frame16.data, frame16.step, PixelLayout::RGBA16, _rotate))
+        return Mat();
+    frame16.convertTo(frame8, CV_8UC4, 1 / 256.0);
+    cvtColor(frame8, frame8, COLOR_RGBA2BGR);
+    resize(frame8, thumbnail, Size(width, (width / frame8.cols) * frame8.rows), INTER_LINEAR);
+    return thumbnail;
+}
+}
@@ -0,0 +1,124 @@
+#pragma once
+
+extern "C" {
+#include "libavcodec/avcodec.h"
+#include "libavutil/imgutils.h"
+}
+
+#include <opencv2/opencv.hpp>
+#include "Reader.h"
+#include <QDebug>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+#include "frameconverter.h"
+
+namespace videoio {
+using namespace std;
+using namespace cv;
+
+// Reader for numbered still images (name0001.dpx, name0002.dpx, ...). Every file is decoded on its own, so
+// frames around the playhead are decoded concurrently on the shared WorkerPool, the window reaching further in
+// the direction of playback. Decoded frames are kept by frame number up to a byte budget, the ones farthest
+// from the playhead going first; frame numbers map straight to files, so random access costs one decode.
+// pts and frame numbers are the same thing here: 0 for the first file of the sequence.
+class ImageSequenceReader : public Reader {
+    vector<QString> _files; // by frame number
+    long long _firstNumber = 0; // number in the name of the first file
+    AVCodecID _codecId = AV_CODEC_ID_NONE;
+    long long _current = -1; // written under _lock, the workers look at it
+    int _direction = 1;
+    double _fps = 24;
+    int _width = 0, _height = 0;
+    unsigned _rotate = 3;
+    FrameConverter _converter;
+
+    std::mutex _lock; // everything below
+    std::condition_variable _decoded;
+    unordered_map<long long, AVFrame*> _cache;
+    unordered_set<long long> _pending, _failed;
+    size_t _bytes = 0, _budget = size_t(2) << 30;
+    int _ahead = 24, _behind = 6;
+    int _inFlight = 0;
+    bool _stop = false;
+    long long _hits = 0, _misses = 0;
+    double _decodeMsTotal = 0;
+    long long _decodes = 0;
+
+    static AVCodecID codecFor(const QString& path);
+    static vector<QString> discover(const QString& path, long long& firstNumber);
+    struct FrameDeleter {
+        void operator()(AVFrame* pFrame) const { av_frame_free(&pFrame); }
+    };
+    AVFrame* decodeFile(long long frame);
+    // New reference to the decoded frame (decoding it on the spot when nobody is on it yet), nullptr on failure
+    AVFrame* frameAt(long long frame);
+    bool inWindow(long long frame) const;
+    void schedule();
+    void evict();
+    void dropAll();
+    static size_t frameBytes(const AVFrame* pFrame);
+
+    bool moveTo(long long frame) {
+        if (_files.empty())
+            return false;
+        long long clamped = std::clamp(frame, 0LL, (long long)_files.size() - 1);
+        std::lock_guard<std::mutex> g(_lock);
+        if (clamped != _current)
+            _direction = clamped < _current ? -1 : 1;
+        _current = clamped;
+        _isEOF = false;
+        schedule();
+        return clamped == frame;
+    }
+    long long ms2frame(long long ms) const { return llround(ms * _fps / 1000.0); }
+    long long frame2ms(long long frame) const { return llround(frame * 1000.0 / _fps); }
+
+public:
+    ImageSequenceReader(const QString path) : Reader(path) { _isImgSeq = true; }
+    virtual ~ImageSequenceReader() { close(); }
+
+    virtual bool updateInfo(const QVariantMap& info) override;
+    virtual bool open() override;
+    virtual void close() override;
+
+    virtual QVariantMap& getInfo() override;
+    long long currentPts() override { return _current; }
+    long long currentTimestamp() override { return frame2ms(_current); }
+    virtual long long readFirst() override { moveTo(0); return _current; }
+    virtual long long readLast() override { moveTo((long long)_files.size() - 1); return _current; }
+    virtual bool seekTo(long long timestamp, bool onFilterGraphReady = false) override { return moveTo(ms2frame(timestamp)); }
+    virtual bool seekToFrame(long long frame) override { return moveTo(frame); }
+    virtual long long getLast() override { return (long long)_files.size() - 1; }
+
+    virtual void nextFrame() override {
+        if (_current + 1 < (long long)_files.size())
+            moveTo(_current + 1);
+        else if (_looping)
+            moveTo(0);
+        else
+            _isEOF = true;
+    }
+    virtual void prevFrame() override {
+        if (_current > 0)
+            moveTo(_current - 1);
+        else if (_looping)
+            moveTo((long long)_files.size() - 1);
+    }
+
+    virtual Mat getFrame() override;
+    virtual QSize frameSize() override {
+        bool transposed = _rotate == ROTATE_90_CLOCKWISE || _rotate == ROTATE_90_COUNTERCLOCKWISE;
+        return transposed ? QSize(_height, _width) : QSize(_width, _height);
+    }
+    virtual size_t frameBufferSize(PixelLayout layout) override;
+    virtual bool getFrameInto(uchar* dst, int stride, PixelLayout layout) override;
+
+    virtual Mat getThumbnail(float maxWidth = 640.0f, int maxRead = 30, int startFrame = 0) override;
+    virtual bool clearBuffers() override { dropAll(); return true; }
+    virtual vector<int64_t> getFrameBufferRange() override;
+    virtual bool canReload() override { return true; }
+};
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <QDebug>
+#include <map>
+#include <optional>
+
+namespace videoio {
+using namespace std;
+
+// Disjoint closed intervals [first, last] kept sorted by their start. Adding merges with whatever overlaps or
+// touches the new interval, removing cuts the removed part out (splitting an interval when it falls inside).
+// Lookups are O(log n); nothing ever needs re-sorting.
+class IntervalSet {
+public:
+    struct Interval {
+        long long first, last;
+    };
+
+private:
+    map<long long, long long> _intervals; // first -> last
+
+public:
+    bool empty() const { return _intervals.empty(); }
+    size_t size() const { return _intervals.size(); }
+    void clear() { _intervals.clear(); }
+
+    void add(long long first, long long last) {
+        if (last < first)
+            return;
+        // The first interval that may touch [first, last] is the one before first (if it reaches first - 1)
+        auto it = _intervals.upper_bound(first);
+        if (it != _intervals.begin() && std::prev(it)->second >= first - 1)
+            --it;
+        while (it != _intervals.end() && it->first <= last + 1) {
+            first = std::min(first, it->first);
+            last = std::max(last, it->second);
+            it = _intervals.erase(it);
+        }
+        _intervals.emplace(first, last);
+    }
+
+    void remove(long long first, long long last) {
+        if (last < first)
+            return;
+        auto it = _intervals.upper_bound(first);
+        if (it != _intervals.begin() && std::prev(it)->second >= first)
+            --it;
+        while (it != _intervals.end() && it->first <= last) {
+            long long itFirst = it->first, itLast = it->second;
+            it = _intervals.erase(it);
+            if (itFirst < first)
+                _intervals.emplace(itFirst, first - 1);
+            if (itLast > last)
+                it = _intervals.emplace(last + 1, itLast).first;
+        }
+    }
+
+    // Interval holding value, if any
+    optional<Interval> at(long long value) const {
+        auto it = _intervals.upper_bound(value);
+        if (it == _intervals.begin() || std::prev(it)->second < value)
+            return nullopt;
+        --it;
+        return Interval{it->first, it->second};
+    }
+    bool contains(long long value) const { return at(value).has_value(); }
+
+    // First interval starting after value
+    optional<Interval> after(long long value) const {
+        auto it = _intervals.upper_bound(value);
+        if (it == _intervals.end())
+            return nullopt;
+        return Interval{it->first, it->second};
+    }
+
+    optional<Interval> front() const {
+        if (_intervals.empty())
+            return nullopt;
+        return Interval{_intervals.begin()->first, _intervals.begin()->second};
+    }
+
+    template <typename F> void forEach(F f) const {
+        for (auto& interval : _intervals)
+            f(interval.first, interval.second);
+    }
+
+    // Same intervals with both ends mapped through f (non-decreasing); intervals that meet after mapping merge
+    template <typename F> IntervalSet mapped(F f) const {
+        IntervalSet out;
+        for (auto& interval : _intervals)
+            out.add(f(interval.first), f(interval.second));
+        return out;
+    }
+};
+
+inline QDebug operator<<(QDebug debug, const IntervalSet& set) {
+    QDebugStateSaver saver(debug);
+    debug.nospace() << "IntervalSet(";
+    bool first = true;
+    set.forEach([&](long long a, long long b) {
+        debug << (first ? "" : ", ") << "[" << a << ", " << b << "]";
+        first = false;
+    });
+    return debug << ")";
+}
+}
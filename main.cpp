@@ -15,12 +15,17 @@ extern "C" {
 #include <libavutil/avutil.h>
 #include <libswscale/swscale.h>
 #include <libswresample/swresample.h>
+#include <libavutil/pixdesc.h>
 }
 
 #include <opencv2/opencv.hpp>
 #include <filesystem>
 
 #include "ffvideoreader.h"
+#include "imagesequencereader.h"
+#include "rhitextureitem.h"
+#include "rhiresourcecache.h"
+#include "presentationscheduler.h"
 
 QString sourceDirPath() {
     QFileInfo fi(QString::fromUtf8(__FILE__));
@@ -28,18 +33,114 @@ QString sourceDirPath() {
 }
 
 #include <thread>
+#include <deque>
 
 class AssetMaker : public QObject { Q_OBJECT
+    // Of the open file in ms, -1 while unknown; the timeline's range
+    Q_PROPERTY(qint64 duration READ duration NOTIFY durationChanged)
 private:
+    using Clock = std::chrono::steady_clock;
+
+    // Requests from QML, executed in order on _runner. A seek supersedes every seek still queued (latest wins)
+    // and cancels the one in flight, which then stops decoding towards its target and shows nothing.
+    // Refine is the exact seek that follows a scrub once the drag settles. Present comes from the window's
+    // swaps while playing and, like seeks, only the latest one matters; so does OutputSize, from the view's geometry.
+    enum class RequestKind { WriteBuffer, Open, Seek, SeekFrame, Next, Prev, Scrubbing, ScrubPolicy, Refine, Playback, Present, OutputSize, Color };
+    struct Request {
+        RequestKind kind;
+        long long value = 0; // ms for Seek and Present, frame number for SeekFrame, on/off for Scrubbing,
+                             // direction (0 for stopped) for Playback
+        QString file; // or the policy for ScrubPolicy
+        double rate = 1;
+        Clock::time_point issued = Clock::now();
+        QSize size; // for OutputSize
+        QVariantMap settings; // for Color
+        bool isSeek() const { return kind == RequestKind::Seek || kind == RequestKind::SeekFrame || kind == RequestKind::Refine; }
+    };
 
     std::thread _runner;
-    std::queue<int> reqs;
-    std::mutex _lock;
+    std::deque<Request> reqs;
+    std::mutex _queueLock; // reqs, _seeking
+    std::mutex _lock; // _reader
     std::condition_variable _cv;
     std::atomic_bool _stop{false};
+    bool _seeking = false;
+    std::atomic<bool> _seekCancel{false};
+    Clock::time_point _inputTime{}; // input the frame being pushed answers, zero when not a seek
+
+    // Scrubbing: while the timeline is held, seeks show the reader's cheap stand-in frame. The exact frame
+    // follows when the slider is released, or when no new position arrived for ScrubSettleMs. Runner thread only.
+    static constexpr int ScrubSettleMs = 150;
+    bool _scrubbing = false;
+    bool _refinePending = false;
+    float _scrubTarget = 0;
+    QString _scrubPolicy = "keyframe";
+    QSize _outputSize; // runner thread
+
+    // Colour settings given so far, handed to every reader opened: the readers' overrideInputColorspace,
+    // colorPrimaries, colorSpace, colorTrc and colorRange, plus colorLut, a .cube file that replaces the LUT
+    // otherwise generated from primaries and transfer. The LUT is only rebuilt when what it depends on changes.
+    QVariantMap _colorSettings;
+    std::shared_ptr<const ColorLut> _lut;
+    bool _lutBuilt = false;
+    int _lutPrimaries = -1, _lutTrc = -1;
+    QString _lutFile;
+
+    PresentationScheduler _scheduler;
+    qint64 _duration = -1; // GUI thread
+
+    // Input-to-photon latency of seeks: from the QML call to the swap that first shows the resulting frame
+    std::mutex _statsLock;
+    std::vector<double> _latencies;
+    long long _coalesced = 0, _cancelled = 0, _presented = 0;
+
+    // CPU cost of getting frames into the mailbox, by FrameFormat written, logged every PrepReportFrames frames.
+    // Sources deeper than 8 bits go to the view as RGB10A2/RGBA16F unless QTPLAYER_FORCE_8BIT is set, which
+    // gives the RGBA8 numbers to compare against. QTPLAYER_FORCE_RGBA likewise keeps YUV frames off the planar
+    // upload and converts them on the CPU, whatever the backend could sample; both together give plain RGBA8.
+    static constexpr int PrepReportFrames = 240;
+    const bool _highBitDepth = !qEnvironmentVariableIsSet("QTPLAYER_FORCE_8BIT");
+    const bool _planarUpload = !qEnvironmentVariableIsSet("QTPLAYER_FORCE_RGBA");
+    long long _prepFrames[6] = {};
+    double _prepMs[6] = {};
+
+    void notePrep(FrameFormat format, Clock::time_point start) {
+        const double ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+        std::lock_guard<std::mutex> g(_statsLock);
+        _prepFrames[int(format)]++;
+        _prepMs[int(format)] += ms;
+        long long total = 0;
+        for (long long frames : _prepFrames)
+            total += frames;
+        if (total < PrepReportFrames)
+            return;
+        static const char* names[] = {"RGBA8", "YUV420P", "NV12", "P010", "RGBA16F", "RGB10A2"};
+        QDebug log = qInfo().nospace();
+        log << "main: frame preparation";
+        for (int i = 0; i < 6; i++) {
+            if (_prepFrames[i] > 0)
+                log << " " << names[i] << " " << _prepMs[i] / _prepFrames[i] << " ms x" << _prepFrames[i];
+        }
+        std::fill(std::begin(_prepFrames), std::end(_prepFrames), 0);
+        std::fill(std::begin(_prepMs), std::end(_prepMs), 0.0);
+    }
 
-    long long ts;
-    std::string file;
+    void post(Request req) {
+        {
+            std::lock_guard<std::mutex> g(_queueLock);
+            if (req.isSeek()) {
+                size_t queued = reqs.size();
+                reqs.erase(std::remove_if(reqs.begin(), reqs.end(), [](const Request& r) { return r.isSeek(); }), reqs.end());
+                _coalesced += queued - reqs.size();
+                if (_seeking)
+                    _seekCancel = true;
+            } else if (req.kind == RequestKind::Present || req.kind == RequestKind::OutputSize) {
+                reqs.erase(std::remove_if(reqs.begin(), reqs.end(), [&req](const Request& r) { return r.kind == req.kind; }), reqs.end());
+            }
+            reqs.push_back(std::move(req));
+        }
+        _cv.notify_one();
+    }
 
 public:
 
@@ -49,68 +150,132 @@ public:
 
     ~AssetMaker() {
         {
-            std::lock_guard<std::mutex> g(_lock);
+            std::lock_guard<std::mutex> g(_queueLock);
             _stop = true;
         }
         _cv.notify_all();
         if (_runner.joinable()) _runner.join();
     }
 
+    qint64 duration() const { return _duration; }
+
     Q_INVOKABLE void _writeBuffer() {
-        {
-            std::lock_guard<std::mutex> g(_lock);
-            reqs.push(1);
-        }
-        _cv.notify_one();
+        post({RequestKind::WriteBuffer});
     }
 
     Q_INVOKABLE void _openAndWrite(QString f) {
-        {
-            std::lock_guard<std::mutex> g(_lock);
-            file = f.toStdString();
-            reqs.push(2);
-        }
-        _cv.notify_one();
+        post({RequestKind::Open, 0, f});
     }
 
     Q_INVOKABLE void _seekTo(long long t) {
-        {
-            std::lock_guard<std::mutex> g(_lock);
-            ts = t;
-            reqs.push(3);
-        }
-        _cv.notify_one();
+        post({RequestKind::Seek, t});
+    }
+
+    Q_INVOKABLE void _seekToFrame(long long f) {
+        post({RequestKind::SeekFrame, f});
     }
 
     Q_INVOKABLE void _readAndWriteNext() {
-        {
-            std::lock_guard<std::mutex> g(_lock);
-            reqs.push(4);
-        }
-        _cv.notify_one();
+        post({RequestKind::Next});
+    }
+
+    Q_INVOKABLE void _readAndWritePrev() {
+        post({RequestKind::Prev});
+    }
+
+    // Timeline drag started/ended
+    Q_INVOKABLE void _setScrubbing(bool scrubbing) {
+        post({RequestKind::Scrubbing, scrubbing});
+    }
+
+    // "keyframe", "nonref" or "exact"
+    Q_INVOKABLE void _setScrubPolicy(QString policy) {
+        post({RequestKind::ScrubPolicy, 0, policy});
     }
+
+    // rate 1 is real time
+    Q_INVOKABLE void _setPlayback(bool playing, bool reverse, double rate) {
+        post({RequestKind::Playback, playing ? (reverse ? -1 : 1) : 0, {}, rate});
+    }
+
+    // Size the view shows frames at, empty for full resolution
+    void _setOutputSize(QSize size) {
+        Request req{RequestKind::OutputSize};
+        req.size = size;
+        post(std::move(req));
+    }
+
+    // Partial colour settings, see _colorSettings
+    Q_INVOKABLE void _setColor(QVariantMap settings) {
+        Request req{RequestKind::Color};
+        req.settings = settings;
+        post(std::move(req));
+    }
+
     void handleReq() {
-        std::unique_lock<std::mutex> l(_lock);
+        std::unique_lock<std::mutex> l(_queueLock);
         for (;;) {
-            _cv.wait(l, [this]{ return _stop || !reqs.empty(); });
-            if (_stop && reqs.empty()) break;
-
-            int code = reqs.front();
-            reqs.pop();
+            Request req{RequestKind::Refine};
+            // A scrub with nothing newer for a while has settled: time for the exact frame
+            if (!_refinePending || _cv.wait_for(l, std::chrono::milliseconds(ScrubSettleMs), [this]{ return _stop || !reqs.empty(); })) {
+                _cv.wait(l, [this]{ return _stop || !reqs.empty(); });
+                if (_stop && reqs.empty()) break;
+                req = std::move(reqs.front());
+                reqs.pop_front();
+            }
+            _seeking = req.isSeek();
+            _seekCancel = false;
+            _inputTime = req.isSeek() && req.kind != RequestKind::Refine ? req.issued : Clock::time_point{};
 
             l.unlock();
-            switch(code) {
-            case 1: writeBuffer(); break;
-            case 2: openAndWrite(QString::fromStdString(file)); break;
-            case 3: seekTo(static_cast<float>(ts)); break;
-            case 4: readAndWriteNext(); break;
-            default: break;
+            switch(req.kind) {
+            case RequestKind::WriteBuffer: writeBuffer(); break;
+            case RequestKind::Open: openAndWrite(req.file); break;
+            case RequestKind::Seek: seekTo(static_cast<float>(req.value)); break;
+            case RequestKind::Next: readAndWriteNext(); break;
+            case RequestKind::SeekFrame: seekToFrame(req.value); break;
+            case RequestKind::Prev: readAndWritePrev(); break;
+            case RequestKind::Scrubbing: setScrubbing(req.value != 0); break;
+            case RequestKind::ScrubPolicy: setScrubPolicy(req.file); break;
+            case RequestKind::Refine: refineScrub(); break;
+            case RequestKind::Playback: setPlayback(int(req.value), req.rate); break;
+            case RequestKind::Present: present(req.value); break;
+            case RequestKind::OutputSize: setOutputSize(req.size); break;
+            case RequestKind::Color: setColor(req.settings); break;
             }
             l.lock();
+            _seeking = false;
         }
     }
 
-    std::unique_ptr<videoio::FFVideoReader> _reader;
+    // Called on the render thread after each swap, fresh when a new frame showing mediaMs came with it.
+    // Returns whether playing, i.e. the window should keep rendering every vsync.
+    bool swapped(bool fresh, qint64 mediaMs) {
+        std::optional<double> target = _scheduler.onSwap(fresh, mediaMs);
+        if (target)
+            post({RequestKind::Present, std::llround(*target)});
+        return target.has_value();
+    }
+
+    // Called on the render thread after each swap
+    void framePresented(qint64 inputNs) {
+        const double ms = (std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count() - inputNs) / 1e6;
+        std::lock_guard<std::mutex> g(_statsLock);
+        _latencies.push_back(ms);
+        if (++_presented % 30 != 0)
+            return;
+        // Percentiles over the last 30 seeks shown, enough to follow a drag as it happens
+        std::sort(_latencies.begin(), _latencies.end());
+        qInfo().nospace() << "main: seek input-to-photon p50 " << _latencies[_latencies.size() / 2] << " ms, p95 "
+                          << _latencies[_latencies.size() * 95 / 100] << " ms, max " << _latencies.back() << " ms ("
+                          << _presented << " shown, " << _coalesced << " coalesced, " << _cancelled << " cancelled)";
+        if (auto* item = qobject_cast<ExampleRhiItem*>(_view))
+            qInfo().nospace() << "main: frame mailbox " << item->mailbox().published() << " published, "
+                              << item->mailbox().replaced() << " replaced before drawn, " << item->mailbox().grown() << " allocating";
+        _latencies.clear();
+    }
+
+    std::unique_ptr<videoio::Reader> _reader;
     Q_INVOKABLE void writeBuffer() {
         std::unique_lock<std::mutex> l(_lock);
         static int count = 0;
@@ -142,12 +307,28 @@ public:
         std::unique_lock<std::mutex> l(_lock);
         if(file.contains("file:///"))
             file = file.replace("file:///", "");
-        _reader = std::make_unique<videoio::FFVideoReader>(file);
+        if (videoio::Reader::IsImageSequence(file)) {
+            _reader = std::make_unique<videoio::ImageSequenceReader>(file);
+        } else {
+            _reader = std::make_unique<videoio::FFVideoReader>(file);
+            _reader->updateInfo({{"decodeAhead", true}, {"reversePlayback", true}, {"lazyOpen", true},
+                                 {"scrubMode", _scrubPolicy}, {"scrubbing", _scrubbing},
+                                 {"audioSink", qEnvironmentVariable("QTPLAYER_AUDIO_SINK", "null")},
+                                 {"outputSize", _outputSize}});
+        }
+        _reader->updateInfo(_colorSettings);
+        _reader->setCancelFlag(&_seekCancel);
+        // A lazy open may only find the end later, announced on this thread while the reader is in use
+        videoio::Reader* reader = _reader.get();
+        connect(reader, &videoio::Reader::infoChanged, this, [this, reader] { publishDuration(reader->getInfo()); }, Qt::DirectConnection);
         _reader->open();
-        auto mat = _reader->getFrame();
-        const QString dir = sourceDirPath() + "/Assets";
-        //cv::imwrite((dir + "/buffer.tiff").toStdString(), mat);
-        pushMat(mat);
+        publishDuration(_reader->getInfo());
+        _scheduler.setMasterClock(_reader->audioOutput());
+        if (_scheduler.playing()) {
+            _scheduler.start(_reader->currentTimestamp(), _scheduler.rate(), _reader->getInfo()["timestep"].toDouble());
+            playAudio();
+        }
+        pushFrame();
     }
 
     Q_INVOKABLE void readAndWriteNext() {
@@ -161,11 +342,19 @@ public:
         auto end = std::chrono::high_resolution_clock::now();
         auto ms = std::chrono::duration<double, std::milli>(end - now).count();
         qInfo().nospace() << "main: nextframe() took " << ms << " ms";
-        std::cout << _reader->getCurrentFrame()->best_effort_timestamp << std::endl;
-        auto mat = _reader->getFrame();
-        const QString dir = sourceDirPath() + "/Assets";
-        pushMat(mat);
-        //cv::imwrite((dir + "/buffer.tiff").toStdString(), mat);
+        std::cout << _reader->currentPts() << std::endl;
+        pushFrame();
+    }
+
+    Q_INVOKABLE void readAndWritePrev() {
+        std::unique_lock<std::mutex> l(_lock);
+        if(!_reader) return;
+        auto now = std::chrono::high_resolution_clock::now();
+        _reader->prevFrame();
+        auto end = std::chrono::high_resolution_clock::now();
+        auto ms = std::chrono::duration<double, std::milli>(end - now).count();
+        qInfo().nospace() << "main: prevFrame() took " << ms << " ms";
+        pushFrame();
     }
 
     Q_INVOKABLE void seekTo(float seekToMs) {
@@ -178,61 +367,320 @@ public:
         _reader->seekTo(seekToMs);
         auto end = std::chrono::high_resolution_clock::now();
         auto ms = std::chrono::duration<double, std::milli>(end - now).count();
+        if (_scrubbing) {
+            _scrubTarget = seekToMs;
+            _refinePending = true;
+        }
+        if (_seekCancel) {
+            qInfo().nospace() << "main: seekTo(" << seekToMs << ") superseded after " << ms << " ms";
+            std::lock_guard<std::mutex> g(_statsLock);
+            _cancelled++;
+            return;
+        }
         qInfo().nospace() << "main: seekTo() took " << ms << " ms";
-        std::cout << _reader->getCurrentFrame()->best_effort_timestamp << std::endl;
-        auto mat = _reader->getFrame();
-        const QString dir = sourceDirPath() + "/Assets";
-        pushMat(mat);
-        //cv::imwrite((dir + "/buffer.tiff").toStdString(), mat);
+        if (_scheduler.playing())
+            _scheduler.rebase(_reader->currentTimestamp());
+        std::cout << _reader->currentPts() << std::endl;
+        pushFrame();
+    }
+
+    Q_INVOKABLE void seekToFrame(long long frameNumber) {
+        std::unique_lock<std::mutex> l(_lock);
+        if(!_reader) return;
+        auto now = std::chrono::high_resolution_clock::now();
+        _reader->seekToFrame(frameNumber);
+        auto end = std::chrono::high_resolution_clock::now();
+        auto ms = std::chrono::duration<double, std::milli>(end - now).count();
+        if (_seekCancel) {
+            std::lock_guard<std::mutex> g(_statsLock);
+            _cancelled++;
+            return;
+        }
+        qInfo().nospace() << "main: seekToFrame(" << frameNumber << ") took " << ms << " ms";
+        if (_scheduler.playing())
+            _scheduler.rebase(_reader->currentTimestamp());
+        pushFrame();
     }
 
+    void setScrubbing(bool scrubbing) {
+        {
+            std::unique_lock<std::mutex> l(_lock);
+            _scrubbing = scrubbing;
+            if (_reader)
+                _reader->updateInfo({{"scrubbing", scrubbing}});
+        }
+        // Released: no reason to wait for the settle timeout
+        if (!scrubbing && _refinePending)
+            refineScrub();
+    }
 
-    Q_INVOKABLE void setVideoView(QObject* obj) {
-        _view = obj;
+    void setScrubPolicy(const QString& policy) {
+        std::unique_lock<std::mutex> l(_lock);
+        _scrubPolicy = policy;
+        if (_reader)
+            _reader->updateInfo({{"scrubMode", policy}});
     }
-    QObject* _view;
 
+    void refineScrub() {
+        std::unique_lock<std::mutex> l(_lock);
+        _refinePending = false;
+        if (!_reader || _scrubPolicy == "exact") return;
+        auto now = std::chrono::high_resolution_clock::now();
+        _reader->updateInfo({{"scrubbing", false}});
+        _reader->seekTo(_scrubTarget);
+        _reader->updateInfo({{"scrubbing", _scrubbing}});
+        auto ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - now).count();
+        if (_seekCancel) return;
+        qInfo().nospace() << "main: exact frame after scrub took " << ms << " ms";
+        pushFrame();
+    }
 
-    Q_INVOKABLE void pushMat(const cv::Mat& mat) {
-        if (!_view) { qWarning() << "AssetMaker: no videoView set"; return; }
-        cv::Mat rgba;
-        switch (mat.type()) {
-        case CV_8UC3:
-            cv::cvtColor(mat, rgba, cv::COLOR_BGR2RGBA);
-            break;
-        case CV_8UC4:
-            cv::cvtColor(mat, rgba, cv::COLOR_BGRA2RGBA);
-            break;
-        case CV_16UC4: {
-            cv::Mat tmp8;
-            mat.convertTo(tmp8, CV_8UC4, 1.0/256.0);
-            rgba = std::move(tmp8);
-            break;
+    void setPlayback(int direction, double rate) {
+        std::unique_lock<std::mutex> l(_lock);
+        if (!_reader || direction == 0) {
+            _scheduler.stop();
+            if (_reader)
+                playAudio();
+            return;
         }
-        default:
-            // best effort fallback: try downconvert with scale if depth>8
-            double alpha = mat.depth() > CV_8U ? 1.0 / ((1 << (CV_MAT_DEPTH(mat.type())==CV_16U?16:8)) / 256.0) : 1.0;
-            mat.convertTo(rgba, CV_8UC4, alpha);
-            break;
+        _scheduler.start(_reader->currentTimestamp(), direction * rate, _reader->getInfo()["timestep"].toDouble());
+        playAudio();
+        // The swaps drive playback, make sure there is one
+        if (_view)
+            QMetaObject::invokeMethod(_view, "update", Qt::QueuedConnection);
+    }
+
+    void setOutputSize(QSize size) {
+        std::unique_lock<std::mutex> l(_lock);
+        _outputSize = size;
+        if (_reader && _reader->updateInfo({{"outputSize", size}}))
+            pushFrame();
+    }
+
+    void setColor(const QVariantMap& settings) {
+        std::unique_lock<std::mutex> l(_lock);
+        for (auto it = settings.begin(); it != settings.end(); ++it)
+            _colorSettings[it.key()] = it.value();
+        // The next frame pushed carries the new matrix and LUT; nothing else is touched
+        if (_reader) {
+            _reader->updateInfo(settings);
+            pushFrame();
         }
-        QByteArray bytes(reinterpret_cast<const char*>(rgba.data),
-                         int(rgba.total() * rgba.elemSize()));
+    }
 
-        const bool ok = QMetaObject::invokeMethod(
-            _view, "setFrameRGBA8",
-            Qt::QueuedConnection,
-            Q_ARG(QByteArray, bytes),
-            Q_ARG(int, rgba.cols),
-            Q_ARG(int, rgba.rows)
-            );
-        if (!ok) qWarning() << "AssetMaker: invoke setFrameRGBA8 failed (method missing?)";
+    // Colour LUT for the current frame's settings, see _colorSettings
+    std::shared_ptr<const ColorLut> colorLut() {
+        const int primaries = _reader->colorSetting("colorPrimaries");
+        const int trc = _reader->colorSetting("colorTrc");
+        const QString file = _colorSettings.value("colorLut").toString();
+        if (!_lutBuilt || primaries != _lutPrimaries || trc != _lutTrc || file != _lutFile) {
+            _lut = file.isEmpty() ? ColorLut::generate(primaries, trc) : ColorLut::load(file);
+            _lutBuilt = true;
+            _lutPrimaries = primaries;
+            _lutTrc = trc;
+            _lutFile = file;
+        }
+        return _lut;
+    }
 
+    // Hands the reader's duration to the GUI thread
+    void publishDuration(const QVariantMap& info) {
+        const qint64 ms = info.value("duration", -1).toLongLong();
+        QMetaObject::invokeMethod(this, [this, ms] {
+            if (_duration == ms)
+                return;
+            _duration = ms;
+            emit durationChanged();
+        }, Qt::QueuedConnection);
     }
-};
 
+    // Sound only at 1x forward; at other rates and in reverse the video runs on the scheduler's own clock
+    void playAudio() {
+        const double rate = _scheduler.rate();
+        _reader->updateInfo({{"audioPlaying", _scheduler.playing() && std::abs(rate - 1) < 0.01}});
+    }
+
+    // Moves the reader to the frame covering targetMs, the media time of the coming vsync. Frames stepped over
+    // on the way count as dropped; when the frame on screen still covers the target nothing is pushed.
+    void present(long long targetMs) {
+        std::unique_lock<std::mutex> l(_lock);
+        if (!_reader || !_scheduler.playing()) return;
+        const int direction = _scheduler.direction();
+        const double frameMs = _scheduler.frameMs();
+        long long shown = _reader->currentTimestamp();
+        // Too far behind to decode through in time: jump
+        if ((targetMs - shown) * direction > PresentationScheduler::CatchUpLimitMs) {
+            _scheduler.addDropped(std::llround(std::abs(targetMs - shown) / frameMs));
+            _reader->seekTo(targetMs);
+            pushFrame();
+            return;
+        }
+        int stepped = 0;
+        while (direction > 0 ? shown + frameMs <= targetMs : shown > targetMs) {
+            direction > 0 ? _reader->nextFrame() : _reader->prevFrame();
+            const long long next = _reader->currentTimestamp();
+            if (next == shown)
+                break;
+            shown = next;
+            stepped++;
+        }
+        if (direction > 0 && _reader->isEOF()) {
+            _reader->seekTo(0);
+            _scheduler.rebase(_reader->currentTimestamp());
+            stepped = 1;
+        }
+        if (stepped == 0)
+            return;
+        _scheduler.addDropped(stepped - 1);
+        pushFrame();
+    }
+
+    // Called from QML with the view frames go to. Installs its hooks: the output size, and the swap hook in
+    // whichever window it is in, now and after it moves.
+    Q_INVOKABLE void setVideoView(QObject* obj) {
+        if (_view)
+            _view->disconnect(this);
+        QObject::disconnect(_swapHook);
+        _view = obj;
+        if (obj == nullptr)
+            return;
+        connect(obj, &QObject::destroyed, this, [this] { setVideoView(nullptr); });
+        auto* item = qobject_cast<ExampleRhiItem*>(obj);
+        if (item == nullptr)
+            return;
+        // Frames are decoded and scaled for the size the view shows them at
+        connect(item, &ExampleRhiItem::outputSizeChanged, this, [this, item] { _setOutputSize(item->outputSize()); });
+        _setOutputSize(item->outputSize());
+        connect(item, &QQuickItem::windowChanged, this, [this, item](QQuickWindow* win) { hookWindow(item, win); });
+        hookWindow(item, item->window());
+    }
+    QObject* _view = nullptr;
+    QMetaObject::Connection _swapHook;
+
+    void hookWindow(ExampleRhiItem* item, QQuickWindow* win) {
+        QObject::disconnect(_swapHook);
+        if (win == nullptr)
+            return;
+        // On the render thread, right after the swap that put the item's frame on screen
+        _swapHook = connect(win, &QQuickWindow::frameSwapped, item, [this, item, win] {
+            if (qint64 input = item->takeRenderedInput())
+                framePresented(input);
+            qint64 media = -1;
+            const bool fresh = item->takeRenderedFrame(media);
+            // While playing the swaps are the clock, so keep them coming every vsync
+            if (swapped(fresh, media))
+                QMetaObject::invokeMethod(win, "update", Qt::QueuedConnection);
+        }, Qt::DirectConnection);
+    }
+
+
+    // Decoded pixel formats the view converts on the GPU.
+    static FrameFormat planarFormat(const QString& pixelFormat) {
+        if (pixelFormat == "yuv420p" || pixelFormat == "yuvj420p") return FrameFormat::YUV420P;
+        if (pixelFormat == "nv12") return FrameFormat::NV12;
+        if (pixelFormat == "p010le") return FrameFormat::P010;
+        return FrameFormat::RGBA8;
+    }
+
+    // Hands the current frame to the view: the decoded planes as-is when the view can convert them on the GPU,
+    // otherwise converted to RGBA8, or to RGB10A2 for sources deeper than 8 bits. Either way it is written
+    // straight into the view's mailbox.
+    void pushFrame() {
+        auto* item = qobject_cast<ExampleRhiItem*>(_view);
+        if (!item) { qWarning() << "AssetMaker: no videoView set"; return; }
+        // The input this frame answers travels with it, see framePresented()
+        const qint64 inputNs = _inputTime == Clock::time_point{} ? 0
+            : std::chrono::duration_cast<std::chrono::nanoseconds>(_inputTime.time_since_epoch()).count();
+        const qint64 mediaMs = _reader->currentTimestamp();
+        const QVariantMap& info = _reader->getInfo();
+        auto* ffReader = dynamic_cast<videoio::FFVideoReader*>(_reader.get());
+        AVFrame* pFrame = ffReader ? ffReader->getCurrentFrame() : nullptr;
+        const QString pixelFormat = pFrame ? QString(av_get_pix_fmt_name((AVPixelFormat)pFrame->format)) : QString();
+        const FrameFormat format = planarFormat(pixelFormat);
+        // Rotation still goes through the CPU path
+        const bool planar = _planarUpload && format != FrameFormat::RGBA8 && item->supportsFormat(format) && info["rotation"].toInt() >= 3;
+        const AVPixFmtDescriptor* desc = pFrame ? av_pix_fmt_desc_get((AVPixelFormat)pFrame->format) : nullptr;
+        const bool deep = !planar && _highBitDepth && desc && desc->comp[0].depth > 8 && item->supportsFormat(FrameFormat::RGB10A2)
+                          && videoio::FrameConverter::supportsOutput(videoio::PixelLayout::RGB10A2);
+        const FrameFormat slotFormat = planar ? format : deep ? FrameFormat::RGB10A2 : FrameFormat::RGBA8;
+        const std::shared_ptr<const ColorLut> lut = colorLut();
+        const int colorRange = _reader->colorSetting("colorRange");
+        const Clock::time_point start = Clock::now();
+        const bool ok = item->mailbox().write([&](FrameSlot& slot) {
+            const videoio::PixelLayout layout = planar ? videoio::PixelLayout::YUVPlanar
+                                              : deep ? videoio::PixelLayout::RGB10A2 : videoio::PixelLayout::RGBA8;
+            const QSize size = planar ? QSize(pFrame->width, pFrame->height) : _reader->frameSize();
+            slot.pixels.resize(qsizetype(_reader->frameBufferSize(layout)));
+            if (slot.pixels.isEmpty() || !_reader->getFrameInto(reinterpret_cast<uchar*>(slot.pixels.data()), planar ? 0 : size.width() * 4, layout))
+                return false;
+            slot.size = size;
+            slot.format = slotFormat;
+            slot.colorSpace = _reader->colorSetting("colorSpace");
+            slot.colorRange = colorRange == 0 && pixelFormat.startsWith("yuvj") ? 2 : colorRange;
+            slot.lut = lut;
+            slot.inputNs = inputNs;
+            slot.mediaMs = mediaMs;
+            return true;
+        });
+        if (ok) {
+            notePrep(slotFormat, start);
+            item->requestFrameUpdate();
+        }
+    }
+
+    Q_INVOKABLE void pushMat(const cv::Mat& mat) {
+        auto* item = qobject_cast<ExampleRhiItem*>(_view);
+        if (!item) { qWarning() << "AssetMaker: no videoView set"; return; }
+        // 16-bit frames keep their depth as half floats when the view takes them
+        const bool half = mat.type() == CV_16UC4 && _highBitDepth && item->supportsFormat(FrameFormat::RGBA16F);
+        const FrameFormat slotFormat = half ? FrameFormat::RGBA16F : FrameFormat::RGBA8;
+        const Clock::time_point start = Clock::now();
+        const bool ok = item->mailbox().write([&](FrameSlot& slot) {
+            slot.pixels.resize(qsizetype(mat.total()) * (half ? 8 : 4));
+            if (slot.pixels.isEmpty())
+                return false;
+            slot.size = QSize(mat.cols, mat.rows);
+            slot.format = slotFormat;
+            slot.lut.reset();
+            slot.inputNs = 0;
+            slot.mediaMs = -1;
+            if (half) {
+                cv::Mat rgba(mat.rows, mat.cols, CV_16FC4, slot.pixels.data());
+                mat.convertTo(rgba, CV_16F, 1.0 / 65535.0);
+                return rgba.data == reinterpret_cast<uchar*>(slot.pixels.data());
+            }
+            // Converted straight into the slot; the target matches, so OpenCV does not reallocate
+            cv::Mat rgba(mat.rows, mat.cols, CV_8UC4, slot.pixels.data());
+            switch (mat.type()) {
+            case CV_8UC3:
+                cv::cvtColor(mat, rgba, cv::COLOR_BGR2RGBA);
+                break;
+            case CV_8UC4:
+                cv::cvtColor(mat, rgba, cv::COLOR_BGRA2RGBA);
+                break;
+            case CV_16UC4:
+                mat.convertTo(rgba, CV_8UC4, 1.0/256.0);
+                break;
+            default: {
+                // best effort fallback: try downconvert with scale if depth>8
+                double alpha = mat.depth() > CV_8U ? 1.0 / ((1 << (CV_MAT_DEPTH(mat.type())==CV_16U?16:8)) / 256.0) : 1.0;
+                mat.convertTo(rgba, CV_8UC4, alpha);
+                break;
+            }
+            }
+            return rgba.data == reinterpret_cast<uchar*>(slot.pixels.data());
+        });
+        if (ok) {
+            notePrep(slotFormat, start);
+            item->requestFrameUpdate();
+        }
+    }
+
+signals:
+    void durationChanged();
+};
 
 
-#include "rhitextureitem.h"
 int main(int argc, char *argv[]) {
     std::cout << "App dir path: " << sourceDirPath().toStdString() << std::endl;
     AssetMaker maker;
@@ -242,22 +690,14 @@ int main(int argc, char *argv[]) {
     QQmlApplicationEngine engine;
     engine.rootContext()->setContextProperty("AssetMaker", &maker);
     engine.rootContext()->setContextProperty("AssetsDir", QString::fromUtf8(sourceDirPath().toStdString()) + "/Assets");
+    // Before the window is exposed: that is when its QRhi, and with it the pipeline cache, gets set up
     QObject::connect(
-        &engine, &QQmlApplicationEngine::objectCreated,
-        &app,
-        [&](QObject *obj, const QUrl &) {
-            auto *win = qobject_cast<QQuickWindow*>(obj);
-            if (!win) return;
-            if (QObject *rhiItem = win->findChild<QObject*>("videoView")) {
-                maker.setVideoView(rhiItem);
-                QObject::connect(rhiItem, &QObject::destroyed, &maker, [&]{
-                    maker.setVideoView(nullptr);
-                });
-            } else {
-                qWarning() << "videoView not found";
-            }
+        &engine, &QQmlApplicationEngine::objectCreated, &app,
+        [](QObject *obj, const QUrl &) {
+            if (auto *win = qobject_cast<QQuickWindow*>(obj))
+                RhiResourceCache::configure(win);
         },
-    Qt::QueuedConnection);
+    Qt::DirectConnection);
     engine.loadFromModule("QtPlayer", "Main");
     if (engine.rootObjects().isEmpty()) return -1;
 
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <QString>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QDir>
+#include <QStandardPaths>
+#include <QCryptographicHash>
+
+namespace videoio {
+
+// Identity of a media file on disk. Anything cached for a file is keyed by path, size and mtime,
+// so editing or replacing the file invalidates it.
+struct FileIdentity {
+    QString path;
+    qint64 size = -1;
+    qint64 mtime = 0;
+
+    bool isValid() const { return size >= 0; }
+    bool operator==(const FileIdentity& o) const { return path == o.path && size == o.size && mtime == o.mtime; }
+    bool operator!=(const FileIdentity& o) const { return !(*this == o); }
+
+    static FileIdentity of(const QString& path) {
+        FileIdentity id;
+        QFileInfo fi(path);
+        id.path = fi.absoluteFilePath();
+        if (fi.exists()) {
+            id.size = fi.size();
+            id.mtime = fi.lastModified().toMSecsSinceEpoch();
+        }
+        return id;
+    }
+
+    QString key() const {
+        QByteArray raw = path.toUtf8() + '|' + QByteArray::number(size) + '|' + QByteArray::number(mtime);
+        return QString::fromLatin1(QCryptographicHash::hash(raw, QCryptographicHash::Sha1).toHex());
+    }
+};
+
+// Location of a cache artifact: <cache dir>/<category>/<identity key><suffix>
+inline QString mediaCachePath(const QString& category, const FileIdentity& id, const QString& suffix) {
+    QString root = QStandardPaths::writableLocation(QStandardPaths::CacheLocation);
+    if (root.isEmpty())
+        root = QDir::tempPath() + "/QtPlayer";
+    QDir dir(root + "/" + category);
+    if (!dir.exists())
+        dir.mkpath(".");
+    return dir.filePath(id.key() + suffix);
+}
+}
@@ -0,0 +1,142 @@
+#include "mmapio.h"
+#include <QFile>
+#include <QFileInfo>
+#include <algorithm>
+#include <cstring>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace videoio {
+
+unique_ptr<MappedInput> MappedInput::open(const QString& path) {
+    QFileInfo fi(path);
+    if (!fi.isFile() || fi.size() <= 0)
+        return nullptr;
+    unique_ptr<MappedInput> input(new MappedInput());
+#ifdef _WIN32
+    HANDLE file = CreateFileW(reinterpret_cast<LPCWSTR>(path.utf16()), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                              OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        return nullptr;
+    input->_file = file;
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size) || size.QuadPart <= 0)
+        return nullptr;
+    input->_size = size.QuadPart;
+    input->_mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (input->_mapping == nullptr)
+        return nullptr;
+    input->_data = static_cast<const uint8_t*>(MapViewOfFile(input->_mapping, FILE_MAP_READ, 0, 0, 0));
+    if (input->_data == nullptr)
+        return nullptr;
+#else
+    input->_fd = ::open(QFile::encodeName(path).constData(), O_RDONLY | O_CLOEXEC);
+    if (input->_fd < 0)
+        return nullptr;
+    struct stat st;
+    if (fstat(input->_fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size <= 0)
+        return nullptr;
+    input->_size = st.st_size;
+    void* data = mmap(nullptr, input->_size, PROT_READ, MAP_SHARED, input->_fd, 0);
+    if (data == MAP_FAILED)
+        return nullptr;
+    input->_data = static_cast<const uint8_t*>(data);
+    madvise(data, input->_size, MADV_SEQUENTIAL);
+#endif
+    auto buffer = static_cast<uint8_t*>(av_malloc(BufferSize));
+    input->_pContext = avio_alloc_context(buffer, BufferSize, 0, input.get(), &MappedInput::readPacket, nullptr, &MappedInput::seekTo);
+    if (input->_pContext == nullptr) {
+        av_free(buffer);
+        return nullptr;
+    }
+    input->advise();
+    return input;
+}
+
+MappedInput::~MappedInput() {
+    if (_pContext != nullptr) {
+        av_freep(&_pContext->buffer);
+        avio_context_free(&_pContext);
+    }
+#ifdef _WIN32
+    if (_data != nullptr)
+        UnmapViewOfFile(_data);
+    if (_mapping != nullptr)
+        CloseHandle(_mapping);
+    if (_file != nullptr)
+        CloseHandle(_file);
+#else
+    if (_data != nullptr)
+        munmap(const_cast<uint8_t*>(_data), _size);
+    if (_fd >= 0)
+        ::close(_fd);
+#endif
+}
+
+void MappedInput::advise() {
+    if (_advisedBackward != _backward) {
+        _advisedBackward = _backward;
+#ifndef _WIN32
+        // Sequential readahead only helps going forward; backwards the window hints do the work alone
+        madvise(const_cast<uint8_t*>(_data), _size, _advisedBackward ? MADV_NORMAL : MADV_SEQUENTIAL);
+#endif
+        _advisedBegin = _advisedEnd = -1;
+    }
+    // Re-advise once the read position has used up half of the current window (or left it, after a seek)
+    int64_t half = ReadaheadWindow / 2;
+    if (_advisedBegin >= 0 && _pos >= _advisedBegin && _pos <= _advisedEnd) {
+        bool ahead = _advisedBackward ? _pos - half >= _advisedBegin || _advisedBegin == 0
+                               : _pos + half <= _advisedEnd || _advisedEnd == _size;
+        if (ahead)
+            return;
+    }
+    int64_t page = 4096;
+    int64_t begin = _advisedBackward ? std::max<int64_t>(0, _pos - ReadaheadWindow) : _pos;
+    int64_t end = _advisedBackward ? _pos : std::min(_size, _pos + ReadaheadWindow);
+    begin &= ~(page - 1);
+    if (end <= begin)
+        return;
+    _advisedBegin = begin;
+    _advisedEnd = end;
+#ifdef _WIN32
+    WIN32_MEMORY_RANGE_ENTRY range{const_cast<uint8_t*>(_data) + begin, size_t(end - begin)};
+    PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+#else
+    madvise(const_cast<uint8_t*>(_data) + begin, end - begin, MADV_WILLNEED);
+#endif
+}
+
+int MappedInput::readPacket(void* opaque, uint8_t* buf, int size) {
+    auto input = static_cast<MappedInput*>(opaque);
+    int64_t n = std::min<int64_t>(size, input->_size - input->_pos);
+    if (n <= 0)
+        return AVERROR_EOF;
+    memcpy(buf, input->_data + input->_pos, n);
+    input->_pos += n;
+    input->advise();
+    return int(n);
+}
+
+int64_t MappedInput::seekTo(void* opaque, int64_t offset, int whence) {
+    auto input = static_cast<MappedInput*>(opaque);
+    switch (whence & ~AVSEEK_FORCE) {
+    case AVSEEK_SIZE: return input->_size;
+    case SEEK_SET: break;
+    case SEEK_CUR: offset += input->_pos; break;
+    case SEEK_END: offset += input->_size; break;
+    default: return AVERROR(EINVAL);
+    }
+    if (offset < 0 || offset > input->_size)
+        return AVERROR(EINVAL);
+    input->_pos = offset;
+    input->advise();
+    return offset;
+}
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+extern "C" {
+#include "libavformat/avformat.h"
+}
+
+#include <QString>
+#include <atomic>
+#include <memory>
+
+namespace videoio {
+using namespace std;
+
+// Local file read through a memory mapping instead of libavformat's file protocol. The AVIOContext fills one
+// large buffer straight from the mapping, so there are no read() syscalls, and packets are cut from that buffer
+// as usual (libavformat owns packet memory, they cannot point into the mapping itself). Readahead is left to
+// madvise(): sequential access for the whole mapping plus WILLNEED on a window ahead of the read position,
+// behind it while playing backwards.
+class MappedInput {
+    const uint8_t* _data = nullptr;
+    int64_t _size = 0, _pos = 0;
+    int64_t _advisedBegin = -1, _advisedEnd = -1;
+    std::atomic<bool> _backward{false}; // set by the reader, applied by whichever thread reads next
+    bool _advisedBackward = false;
+    AVIOContext* _pContext = nullptr;
+#ifdef _WIN32
+    void* _file = nullptr;
+    void* _mapping = nullptr;
+#else
+    int _fd = -1;
+#endif
+
+    MappedInput() = default;
+    void advise();
+    static int readPacket(void* opaque, uint8_t* buf, int size);
+    static int64_t seekTo(void* opaque, int64_t offset, int whence);
+
+public:
+    static constexpr int BufferSize = 1 << 20;
+    static constexpr int64_t ReadaheadWindow = 16 << 20;
+
+    // nullptr when the path is not a regular local file that can be mapped
+    static unique_ptr<MappedInput> open(const QString& path);
+    ~MappedInput();
+    MappedInput(const MappedInput&) = delete;
+    MappedInput& operator=(const MappedInput&) = delete;
+
+    // Owned by this object: install as AVFormatContext::pb (with AVFMT_FLAG_CUSTOM_IO) and close the
+    // format context before destroying it.
+    AVIOContext* context() const { return _pContext; }
+    int64_t size() const { return _size; }
+    void setBackward(bool backward) { _backward = backward; }
+};
+}
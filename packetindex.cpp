@@ -0,0 +1,138 @@
+#include "packetindex.h"
+#include <QFile>
+#include <QDataStream>
+#include <QDebug>
+#include <algorithm>
+
+namespace videoio {
+using namespace std;
+
+static const quint32 IndexMagic = 0x51504958; // "QPIX"
+static const quint32 IndexVersion = 1;
+
+bool PacketIndex::build(const QString& path, int streamIndex, const std::atomic<bool>& cancel) {
+    clear();
+    AVFormatContext* pFormat = nullptr;
+    auto p = path.toStdString();
+    if (avformat_open_input(&pFormat, p.c_str(), nullptr, nullptr) != 0) {
+        qCritical() << "Index: unable to open file" << path;
+        return false;
+    }
+    if (avformat_find_stream_info(pFormat, nullptr) < 0 || streamIndex < 0 || streamIndex >= (int)pFormat->nb_streams) {
+        qCritical() << "Index: unable to find stream" << streamIndex << "in file" << path;
+        avformat_close_input(&pFormat);
+        return false;
+    }
+    for (unsigned i = 0; i < pFormat->nb_streams; i++)
+        pFormat->streams[i]->discard = (int)i == streamIndex ? AVDISCARD_DEFAULT : AVDISCARD_ALL;
+
+    AVPacket* pPacket = av_packet_alloc();
+    while (!cancel && av_read_frame(pFormat, pPacket) >= 0) {
+        if (pPacket->stream_index == streamIndex && (pPacket->pts != AV_NOPTS_VALUE || pPacket->dts != AV_NOPTS_VALUE))
+            _packets.push_back({pPacket->pts, pPacket->dts, pPacket->pos, !!(pPacket->flags & AV_PKT_FLAG_KEY)});
+        av_packet_unref(pPacket);
+    }
+    av_packet_free(&pPacket);
+    avformat_close_input(&pFormat);
+    if (cancel) {
+        clear();
+        return false;
+    }
+    _streamIndex = streamIndex;
+    finalize();
+    qInfo() << "Index: built" << _packets.size() << "packets," << _keyFrames.size() << "keyframes for" << path;
+    return !isEmpty();
+}
+
+void PacketIndex::finalize() {
+    _presentation.clear();
+    _keyFrames.clear();
+    _presentation.reserve(_packets.size());
+    for (size_t i = 0; i < _packets.size(); i++) {
+        auto& e = _packets[i];
+        if (e.pts == AV_NOPTS_VALUE)
+            e.pts = e.dts;
+        _presentation.push_back(e.pts);
+        if (e.key)
+            _keyFrames.push_back(i);
+    }
+    sort(_presentation.begin(), _presentation.end());
+    stable_sort(_keyFrames.begin(), _keyFrames.end(), [this](size_t a, size_t b) { return _packets[a].pts < _packets[b].pts; });
+}
+
+bool PacketIndex::load(const FileIdentity& id, int streamIndex) {
+    clear();
+    QFile f(mediaCachePath("index", id, ".pidx"));
+    if (!id.isValid() || !f.open(QIODevice::ReadOnly))
+        return false;
+    QDataStream in(&f);
+    quint32 magic, version;
+    QString path;
+    qint64 size, mtime;
+    qint32 stream;
+    quint64 count;
+    in >> magic >> version >> path >> size >> mtime >> stream >> count;
+    if (in.status() != QDataStream::Ok || magic != IndexMagic || version != IndexVersion
+        || path != id.path || size != id.size || mtime != id.mtime || stream != streamIndex) {
+        return false;
+    }
+    if (count > (quint64)f.size() / 25) {
+        qWarning() << "Index: corrupt sidecar for" << id.path;
+        return false;
+    }
+    _packets.resize(count);
+    for (auto& e : _packets) {
+        qint64 pts, dts, pos;
+        bool key;
+        in >> pts >> dts >> pos >> key;
+        e = {pts, dts, pos, key};
+    }
+    if (in.status() != QDataStream::Ok) {
+        qWarning() << "Index: truncated sidecar for" << id.path;
+        clear();
+        return false;
+    }
+    _streamIndex = streamIndex;
+    finalize();
+    return !isEmpty();
+}
+
+bool PacketIndex::save(const FileIdentity& id) const {
+    if (!id.isValid() || isEmpty())
+        return false;
+    QFile f(mediaCachePath("index", id, ".pidx"));
+    if (!f.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        qWarning() << "Index: unable to write sidecar" << f.fileName();
+        return false;
+    }
+    QDataStream out(&f);
+    out << IndexMagic << IndexVersion << id.path << id.size << id.mtime << (qint32)_streamIndex << (quint64)_packets.size();
+    for (const auto& e : _packets)
+        out << (qint64)e.pts << (qint64)e.dts << (qint64)e.pos << e.key;
+    return out.status() == QDataStream::Ok;
+}
+
+const PacketIndexEntry* PacketIndex::keyFrameBefore(int64_t pts) const {
+    if (_keyFrames.empty())
+        return nullptr;
+    auto it = upper_bound(_keyFrames.begin(), _keyFrames.end(), pts, [this](int64_t v, size_t i) { return v < _packets[i].pts; });
+    return &_packets[it == _keyFrames.begin() ? *it : *prev(it)];
+}
+
+const PacketIndexEntry* PacketIndex::keyFrameAfter(int64_t pts) const {
+    auto it = upper_bound(_keyFrames.begin(), _keyFrames.end(), pts, [this](int64_t v, size_t i) { return v < _packets[i].pts; });
+    return it == _keyFrames.end() ? nullptr : &_packets[*it];
+}
+
+int64_t PacketIndex::framePts(long long n) const {
+    if (_presentation.empty())
+        return AV_NOPTS_VALUE;
+    n = n < 0 ? 0 : std::min(n, (long long)_presentation.size() - 1);
+    return _presentation[n];
+}
+
+long long PacketIndex::frameNumber(int64_t pts) const {
+    auto it = upper_bound(_presentation.begin(), _presentation.end(), pts);
+    return it == _presentation.begin() ? 0 : (it - _presentation.begin()) - 1;
+}
+}
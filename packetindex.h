@@ -0,0 +1,49 @@
+#pragma once
+
+extern "C" {
+#include "libavformat/avformat.h"
+}
+
+#include <QString>
+#include <atomic>
+#include <vector>
+#include "mediacache.h"
+
+namespace videoio {
+using namespace std;
+
+struct PacketIndexEntry {
+    int64_t pts, dts, pos;
+    bool key;
+};
+
+// Per-packet index of one video stream, built by demuxing only (no decoding).
+// Lets seeks go straight to the right keyframe and maps frame numbers to pts exactly on VFR content.
+class PacketIndex {
+    vector<PacketIndexEntry> _packets; // decode order
+    vector<int64_t> _presentation;     // pts of every frame in presentation order
+    vector<size_t> _keyFrames;         // indices into _packets, ordered by pts
+    int _streamIndex = -1;
+
+    void finalize();
+
+public:
+    bool build(const QString& path, int streamIndex, const std::atomic<bool>& cancel);
+    bool load(const FileIdentity& id, int streamIndex);
+    bool save(const FileIdentity& id) const;
+    void clear() { _packets.clear(); _presentation.clear(); _keyFrames.clear(); _streamIndex = -1; }
+
+    bool isEmpty() const { return _keyFrames.empty(); }
+    size_t frameCount() const { return _presentation.size(); }
+    size_t keyFrameCount() const { return _keyFrames.size(); }
+
+    // Last keyframe with pts <= pts (the first one when pts precedes all of them), nullptr when empty.
+    const PacketIndexEntry* keyFrameBefore(int64_t pts) const;
+    // First keyframe with pts > pts, nullptr when there is none.
+    const PacketIndexEntry* keyFrameAfter(int64_t pts) const;
+    // pts of frame n in presentation order (clamped), AV_NOPTS_VALUE when empty.
+    int64_t framePts(long long n) const;
+    // Presentation order number of the last frame with pts <= pts.
+    long long frameNumber(int64_t pts) const;
+};
+}
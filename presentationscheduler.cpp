@@ -0,0 +1,123 @@
+#include "presentationscheduler.h"
+#include "audioout.h"
+#include <algorithm>
+#include <cmath>
+
+void PresentationScheduler::start(double mediaMs, double rate, double frameMs) {
+    std::lock_guard<std::mutex> g(_lock);
+    _playing = true;
+    _rate = rate;
+    _frameMs = frameMs > 0 ? frameMs : _frameMs;
+    _mediaOrigin = mediaMs;
+    _wallOrigin = Clock::now();
+    _lastReport = _wallOrigin;
+    _held = 0;
+    _shown = false;
+}
+
+void PresentationScheduler::stop() {
+    std::lock_guard<std::mutex> g(_lock);
+    if (_playing)
+        report(Clock::now());
+    _playing = false;
+}
+
+void PresentationScheduler::rebase(double mediaMs) {
+    std::lock_guard<std::mutex> g(_lock);
+    _mediaOrigin = mediaMs;
+    _wallOrigin = Clock::now();
+}
+
+bool PresentationScheduler::playing() {
+    std::lock_guard<std::mutex> g(_lock);
+    return _playing;
+}
+
+int PresentationScheduler::direction() {
+    std::lock_guard<std::mutex> g(_lock);
+    return _rate < 0 ? -1 : 1;
+}
+
+double PresentationScheduler::rate() {
+    std::lock_guard<std::mutex> g(_lock);
+    return _rate;
+}
+
+double PresentationScheduler::frameMs() {
+    std::lock_guard<std::mutex> g(_lock);
+    return _frameMs;
+}
+
+void PresentationScheduler::setMasterClock(std::shared_ptr<videoio::AudioOutput> master) {
+    std::lock_guard<std::mutex> g(_lock);
+    _master = std::move(master);
+}
+
+void PresentationScheduler::addDropped(long long frames) {
+    std::lock_guard<std::mutex> g(_lock);
+    _dropped += frames;
+}
+
+std::optional<double> PresentationScheduler::onSwap(bool fresh, long long mediaMs) {
+    const Clock::time_point now = Clock::now();
+    std::lock_guard<std::mutex> g(_lock);
+    // Swaps further apart than this were idle time, not vsync
+    if (_lastSwap != Clock::time_point{}) {
+        const double dt = std::chrono::duration<double, std::milli>(now - _lastSwap).count();
+        if (dt > 2 && dt < 100)
+            _periodMs += (dt - _periodMs) * 0.05;
+    }
+    _lastSwap = now;
+    if (!_playing)
+        return std::nullopt;
+
+    double masterMs;
+    if (_master && std::abs(_rate - 1) < 0.01 && _master->clock(masterMs)) {
+        _mediaOrigin = masterMs;
+        _wallOrigin = now;
+        _mastered++;
+    }
+    _swaps++;
+    _held++;
+    if (fresh) {
+        if (_shown) {
+            _holds[std::min(_held, 5)]++;
+            // Holding a frame for the cadence (2 or 3 swaps for 24 on 60) is expected, any swap beyond is a repeat
+            const int expected = std::max(1, int(std::ceil(_frameMs / std::abs(_rate) / _periodMs - 0.05)));
+            if (_held > expected)
+                _repeated += _held - expected;
+        }
+        _shown = true;
+        _fresh++;
+        _held = 0;
+        if (mediaMs >= 0) {
+            // How far the clock has moved past the start of the frame now on screen, ideally [0, frame)
+            const double error = (mediaAt(now) - mediaMs) * (_rate < 0 ? -1 : 1);
+            _errorSum += error;
+            _errorSqSum += error * error;
+            _errorCount++;
+        }
+    }
+    if (std::chrono::duration<double>(now - _lastReport).count() >= 5)
+        report(now);
+    // What is pushed now reaches the screen with the next swap
+    return mediaAt(now + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double, std::milli>(_periodMs)));
+}
+
+void PresentationScheduler::report(Clock::time_point now) {
+    if (_swaps > 0) {
+        const double ideal = _frameMs / std::abs(_rate) / _periodMs;
+        const double mean = _errorCount > 0 ? _errorSum / _errorCount : 0;
+        const double jitter = _errorCount > 0 ? std::sqrt(std::max(0.0, _errorSqSum / _errorCount - mean * mean)) : 0;
+        qInfo().nospace() << "PresentationScheduler: " << _fresh << " frames over " << _swaps << " swaps ("
+                          << 1000 / _periodMs << " Hz), dropped " << _dropped << ", repeated " << _repeated
+                          << "; holds 1:" << _holds[1] << " 2:" << _holds[2] << " 3:" << _holds[3] << " 4:" << _holds[4]
+                          << " 5+:" << _holds[5] << " (ideal " << ideal << "); clock lead " << mean << " ms, jitter "
+                          << jitter << " ms; " << _mastered << " swaps on the audio clock";
+    }
+    _lastReport = now;
+    _swaps = _fresh = _repeated = _dropped = _mastered = 0;
+    std::fill(std::begin(_holds), std::end(_holds), 0);
+    _errorSum = _errorSqSum = 0;
+    _errorCount = 0;
+}
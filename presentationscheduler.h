@@ -0,0 +1,69 @@
+#pragma once
+
+#include <QDebug>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <optional>
+
+namespace videoio { class AudioOutput; }
+
+// Paces playback off the window's frame swaps instead of a timer. A monotonic media clock (steady clock times
+// rate, rebased on start) says which media time the next vsync should show; the reader is then advanced to the
+// frame covering it, frames that went by in the meantime are dropped instead of shown late. The swaps also feed
+// the statistics: how many swaps each frame was held for (a 23.976 fps source on a 60 Hz display alternates
+// 2 and 3), how far the frame on screen is from the clock, frames dropped and swaps held beyond the cadence,
+// logged every few seconds. With a master clock set (the reader's audio), the clock follows it whenever it is
+// valid at 1x forward, so the picture waits for or skips ahead to the sound rather than the other way round.
+// onSwap() runs on the render thread, the rest on whichever thread drives the reader.
+class PresentationScheduler {
+public:
+    using Clock = std::chrono::steady_clock;
+
+private:
+    std::mutex _lock;
+    bool _playing = false;
+    double _rate = 1;              // media ms per wall ms, negative in reverse
+    double _mediaOrigin = 0;       // media ms at _wallOrigin
+    Clock::time_point _wallOrigin;
+    double _frameMs = 1000 / 24.0; // nominal frame duration of the source
+    std::shared_ptr<videoio::AudioOutput> _master;
+
+    // Vsync estimate
+    Clock::time_point _lastSwap{};
+    double _periodMs = 1000 / 60.0;
+
+    // Statistics since the last report
+    Clock::time_point _lastReport{};
+    long long _swaps = 0, _fresh = 0, _repeated = 0, _dropped = 0, _mastered = 0;
+    bool _shown = false;         // a frame has reached the screen since start()
+    int _held = 0;               // swaps the frame on screen has been held for
+    long long _holds[6] = {};    // frames by hold length, the last bucket is 5 and longer
+    double _errorSum = 0, _errorSqSum = 0;
+    long long _errorCount = 0;
+
+    double mediaAt(Clock::time_point t) const {
+        return _mediaOrigin + std::chrono::duration<double, std::milli>(t - _wallOrigin).count() * _rate;
+    }
+    void report(Clock::time_point now);
+
+public:
+    static constexpr double CatchUpLimitMs = 1000; // behind by more than this, seek rather than decode through
+
+    void start(double mediaMs, double rate, double frameMs);
+    void stop();
+    // Restarts the clock at mediaMs, e.g. after looping or a seek while playing
+    void rebase(double mediaMs);
+    bool playing();
+    int direction();
+    double rate();
+    double frameMs();
+    // nullptr for none
+    void setMasterClock(std::shared_ptr<videoio::AudioOutput> master);
+
+    // Called for every swap of the window. fresh: a new frame reached the screen with it, showing mediaMs
+    // (negative when unknown). Returns the media time the next vsync should show while playing.
+    std::optional<double> onSwap(bool fresh, long long mediaMs);
+    // Frames the reader stepped over without them ever being shown
+    void addDropped(long long frames);
+};
@@ -0,0 +1,41 @@
+#include "probecache.h"
+#include <QDataStream>
+#include <QDebug>
+#include <QFile>
+
+namespace videoio {
+
+static const quint32 ProbeMagic = 0x51505052; // "QPPR"
+static const quint32 ProbeVersion = 1;
+
+bool ProbeRecord::load(const FileIdentity& id, ProbeRecord& record) {
+    QFile f(mediaCachePath("probe", id, ".ppr"));
+    if (!id.isValid() || !f.open(QIODevice::ReadOnly))
+        return false;
+    QDataStream in(&f);
+    quint32 magic, version;
+    QString path;
+    qint64 size, mtime;
+    ProbeRecord r;
+    in >> magic >> version >> path >> size >> mtime >> r.streamIndex >> r.probeBytes >> r.start >> r.duration;
+    if (in.status() != QDataStream::Ok || magic != ProbeMagic || version != ProbeVersion
+        || path != id.path || size != id.size || mtime != id.mtime || !r.isValid()) {
+        return false;
+    }
+    record = r;
+    return true;
+}
+
+bool ProbeRecord::save(const FileIdentity& id) const {
+    if (!id.isValid() || !isValid())
+        return false;
+    QFile f(mediaCachePath("probe", id, ".ppr"));
+    if (!f.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        qWarning() << "Probe: unable to write cache" << f.fileName();
+        return false;
+    }
+    QDataStream out(&f);
+    out << ProbeMagic << ProbeVersion << id.path << id.size << id.mtime << streamIndex << probeBytes << start << duration;
+    return out.status() == QDataStream::Ok;
+}
+}
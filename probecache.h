@@ -0,0 +1,20 @@
+#pragma once
+
+#include <QString>
+#include "mediacache.h"
+
+namespace videoio {
+
+// What open() found out about a file last time: how many bytes probing took and where the stream starts and
+// ends. With a record at hand a reopen probes only that much and skips the start/end discovery entirely.
+struct ProbeRecord {
+    qint32 streamIndex = -1;
+    qint64 probeBytes = 0;          // consumed by avformat_find_stream_info
+    qint64 start = 0, duration = 0; // first frame pts and end of stream, in stream time base
+
+    bool isValid() const { return streamIndex >= 0 && duration > start; }
+
+    static bool load(const FileIdentity& id, ProbeRecord& record);
+    bool save(const FileIdentity& id) const;
+};
+}
@@ -0,0 +1,153 @@
+#include "rhiresourcecache.h"
+#include "mediacache.h"
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QQuickGraphicsConfiguration>
+#include <atomic>
+#include <mutex>
+
+static std::mutex s_registryLock;
+static std::map<QRhi*, std::weak_ptr<RhiResourceCache>> s_registry;
+// Set by configure(), before any render thread runs
+static bool s_warm = false;
+static QElapsedTimer s_sinceConfigure;
+static std::atomic<bool> s_reported{false};
+
+static constexpr float R = 0.75f;
+//ccw
+static float vertexData[] = {
+    -R,   -R,   0.0f, 1.0f,
+    R,   -R,   1.0f, 1.0f,
+    R,    R,   1.0f, 0.0f,
+
+    R,    R,   1.0f, 0.0f,
+    -R,   -R,   0.0f, 1.0f,
+    -R,    R,   0.0f, 0.0f,
+};
+
+static QShader getShader(const QString &name) {
+    QFile f(name);
+    return f.open(QIODevice::ReadOnly) ? QShader::fromSerialized(f.readAll()) : QShader();
+}
+
+std::shared_ptr<RhiResourceCache> RhiResourceCache::forRhi(QRhi *rhi) {
+    std::lock_guard<std::mutex> g(s_registryLock);
+    std::weak_ptr<RhiResourceCache> &entry = s_registry[rhi];
+    std::shared_ptr<RhiResourceCache> cache = entry.lock();
+    if (cache) {
+        qInfo() << "RhiResourceCache:" << cache.use_count() - 1 << "more view(s) sharing on" << rhi->backendName();
+    } else {
+        cache = std::make_shared<RhiResourceCache>(rhi);
+        entry = cache;
+    }
+    return cache;
+}
+
+void RhiResourceCache::configure(QQuickWindow *window) {
+    // Keyed by the executable, so a rebuild (possibly with other shaders) starts over; Qt also drops data that
+    // came from another driver or device
+    const QString path = videoio::mediaCachePath("rhi", videoio::FileIdentity::of(QCoreApplication::applicationFilePath()), ".pipelines");
+    s_warm = QFile::exists(path);
+    QQuickGraphicsConfiguration config = window->graphicsConfiguration();
+    config.setPipelineCacheLoadFile(path);
+    config.setPipelineCacheSaveFile(path);
+    window->setGraphicsConfiguration(config);
+    s_sinceConfigure.start();
+}
+
+RhiResourceCache::RhiResourceCache(QRhi *rhi) : m_rhi(rhi) {
+    m_vbuf.reset(m_rhi->newBuffer(QRhiBuffer::Immutable, QRhiBuffer::VertexBuffer, sizeof(vertexData)));
+    m_vbuf->create();
+
+    m_sampler.reset(m_rhi->newSampler(QRhiSampler::Linear, QRhiSampler::Linear, QRhiSampler::None,
+                                      QRhiSampler::ClampToEdge, QRhiSampler::ClampToEdge));
+    m_sampler->create();
+
+    m_layoutUbuf.reset(m_rhi->newBuffer(QRhiBuffer::Dynamic, QRhiBuffer::UniformBuffer, UniformBufferSize));
+    m_layoutUbuf->create();
+    m_layoutTex.reset(m_rhi->newTexture(QRhiTexture::RGBA8, QSize(1, 1), 1));
+    m_layoutTex->create();
+    m_layout.reset(m_rhi->newShaderResourceBindings());
+    m_layout->setBindings({
+        QRhiShaderResourceBinding::uniformBuffer(0, QRhiShaderResourceBinding::VertexStage | QRhiShaderResourceBinding::FragmentStage, m_layoutUbuf.get()),
+        QRhiShaderResourceBinding::sampledTexture(1, QRhiShaderResourceBinding::FragmentStage, m_layoutTex.get(), m_sampler.get()),
+        QRhiShaderResourceBinding::sampledTexture(2, QRhiShaderResourceBinding::FragmentStage, m_layoutTex.get(), m_sampler.get()),
+        QRhiShaderResourceBinding::sampledTexture(3, QRhiShaderResourceBinding::FragmentStage, m_layoutTex.get(), m_sampler.get()),
+        QRhiShaderResourceBinding::sampledTexture(4, QRhiShaderResourceBinding::FragmentStage, m_layoutTex.get(), m_sampler.get()),
+    });
+    m_layout->create();
+}
+
+RhiResourceCache::~RhiResourceCache() {
+    std::lock_guard<std::mutex> g(s_registryLock);
+    auto it = s_registry.find(m_rhi);
+    // A new cache for the same QRhi may already have taken the entry over
+    if (it != s_registry.end() && it->second.expired())
+        s_registry.erase(it);
+}
+
+void RhiResourceCache::prepare(QRhiCommandBuffer *cb) {
+    if (m_vbufUploaded)
+        return;
+    QRhiResourceUpdateBatch *resourceUpdates = m_rhi->nextResourceUpdateBatch();
+    resourceUpdates->uploadStaticBuffer(m_vbuf.get(), vertexData);
+    cb->resourceUpdate(resourceUpdates);
+    m_vbufUploaded = true;
+}
+
+QRhiGraphicsPipeline *RhiResourceCache::pipeline(QRhiRenderPassDescriptor *rp, int sampleCount) {
+    const auto key = std::make_pair(rp->serializedFormat(), sampleCount);
+    auto it = m_pipelines.find(key);
+    if (it != m_pipelines.end())
+        return it->second.pipeline.get();
+
+    QElapsedTimer timer;
+    timer.start();
+    if (!m_vs.isValid()) {
+        m_vs = getShader(":/scenegraph/rhitextureitem/shaders/frame.vert.qsb");
+        m_fs = getShader(":/scenegraph/rhitextureitem/shaders/frame.frag.qsb");
+        if (!m_vs.isValid() || !m_fs.isValid()) {
+            qFatal("QSB shader(s) missing or invalid. Check resource path & qsb output.");
+        }
+    }
+    const qint64 shaderNs = timer.nsecsElapsed();
+
+    Pipeline entry;
+    entry.rp.reset(rp->newCompatibleRenderPassDescriptor());
+    entry.pipeline.reset(m_rhi->newGraphicsPipeline());
+    entry.pipeline->setShaderStages({
+       { QRhiShaderStage::Vertex, m_vs },
+       { QRhiShaderStage::Fragment, m_fs }
+    });
+
+    //strides
+    QRhiVertexInputLayout inputLayout;
+    inputLayout.setBindings({
+        { 4 * sizeof(float) }
+    });
+    inputLayout.setAttributes({
+        { 0, 0, QRhiVertexInputAttribute::Float2, 0 },
+        { 0, 1, QRhiVertexInputAttribute::Float2, 2 * sizeof(float) }
+    });
+    entry.pipeline->setSampleCount(sampleCount);
+    entry.pipeline->setVertexInputLayout(inputLayout);
+    entry.pipeline->setShaderResourceBindings(m_layout.get());
+    entry.pipeline->setRenderPassDescriptor(entry.rp.get());
+    if (!entry.pipeline->create()) {
+        qWarning() << "RhiResourceCache: could not create the frame pipeline on" << m_rhi->backendName();
+        return nullptr;
+    }
+
+    const double ms = timer.nsecsElapsed() / 1e6;
+    if (!s_reported.exchange(true)) {
+        qInfo().nospace() << "RhiResourceCache: first pipeline on " << m_rhi->backendName() << " in " << ms
+                          << " ms (shaders " << shaderNs / 1e6 << " ms), " << (s_warm ? "warm" : "cold")
+                          << " start; " << (s_sinceConfigure.isValid() ? s_sinceConfigure.elapsed() : -1)
+                          << " ms since the window was configured";
+    } else {
+        qInfo().nospace() << "RhiResourceCache: pipeline for another render target (" << sampleCount
+                          << "x) on " << m_rhi->backendName() << " in " << ms << " ms";
+    }
+    return m_pipelines.emplace(key, std::move(entry)).first->second.pipeline.get();
+}
@@ -0,0 +1,60 @@
+#ifndef RHIRESOURCECACHE_H
+#define RHIRESOURCECACHE_H
+
+#include <QQuickWindow>
+#include <rhi/qrhi.h>
+#include <map>
+#include <memory>
+#include <utility>
+
+// GPU resources every RhiTextureItem drawing with one QRhi can share: the frame shaders, the quad's vertex
+// buffer, the sampler and the graphics pipelines, one per render target layout and sample count. Renderers
+// hold it through forRhi(), so it lives as long as the last of them; each keeps only its uniform buffer,
+// textures and bindings, which are layout-compatible with the pipelines'. Render thread only, apart from
+// forRhi() and configure().
+// Across runs the pipelines come from a disk cache: configure() points the window's graphics configuration at
+// it, Qt Quick restores QRhi::pipelineCacheData() from there when the QRhi is created and saves it back when
+// the scene graph goes away. The first pipeline logs how long it took and whether that cache was there.
+class RhiResourceCache
+{
+public:
+    // mat4 mvp, mat4 yuvToRgb, int format, float levels, float lutSize (padded to 16 bytes), see frame.vert/frame.frag
+    static constexpr int UniformBufferSize = 64 + 64 + 16;
+    static constexpr int VertexCount = 6;
+
+    static std::shared_ptr<RhiResourceCache> forRhi(QRhi *rhi);
+    // Before the window is exposed
+    static void configure(QQuickWindow *window);
+
+    explicit RhiResourceCache(QRhi *rhi);
+    ~RhiResourceCache();
+    RhiResourceCache(const RhiResourceCache &) = delete;
+    RhiResourceCache &operator=(const RhiResourceCache &) = delete;
+
+    // Records the vertex upload into cb the first time round
+    void prepare(QRhiCommandBuffer *cb);
+    QRhiBuffer *vertexBuffer() const { return m_vbuf.get(); }
+    QRhiSampler *sampler() const { return m_sampler.get(); }
+    // Created on first use for this render pass layout; nullptr when creation failed
+    QRhiGraphicsPipeline *pipeline(QRhiRenderPassDescriptor *rp, int sampleCount);
+
+private:
+    struct Pipeline {
+        std::unique_ptr<QRhiRenderPassDescriptor> rp; // ours, the renderer's one may go first
+        std::unique_ptr<QRhiGraphicsPipeline> pipeline;
+    };
+
+    QRhi *m_rhi;
+    std::unique_ptr<QRhiBuffer> m_vbuf;
+    bool m_vbufUploaded = false;
+    std::unique_ptr<QRhiSampler> m_sampler;
+    QShader m_vs, m_fs;
+    // Layout the pipelines are created against: the renderers' bindings (uniforms, three planes, colour LUT),
+    // with placeholders behind them
+    std::unique_ptr<QRhiBuffer> m_layoutUbuf;
+    std::unique_ptr<QRhiTexture> m_layoutTex;
+    std::unique_ptr<QRhiShaderResourceBindings> m_layout;
+    std::map<std::pair<QList<quint32>, int>, Pipeline> m_pipelines;
+};
+
+#endif // RHIRESOURCECACHE_H
@@ -1,26 +1,29 @@
 #include "rhitextureitem.h"
-#include <QFile>
+#include "rhiresourcecache.h"
+#include <QFloat16>
+#include <QQuickWindow>
+#include <algorithm>
+#include <cstring>
 
 QQuickRhiItemRenderer *ExampleRhiItem::createRenderer() {
     return new ExampleRhiItemRenderer;
 }
 void ExampleRhiItem::setFrameRGBA8(const QByteArray &pixels, int w, int h) {
-    // Called on GUI thread , maybeuse QMetaObject::invokeMethod with QueuedConnection
-    setProperty("_px", pixels);
-    setProperty("_sz", QSize(w, h));
-    update();
+    setFrame(pixels, w, h, int(FrameFormat::RGBA8));
 }
 
-bool ExampleRhiItem::takePendingFrame(QByteArray &out, QSize &outSize)
-{
-    auto px = property("_px");
-    auto sz = property("_sz");
-    if (!px.isValid() || !sz.isValid()) return false;
-    out = px.toByteArray();
-    outSize = sz.toSize();
-    setProperty("_px", QVariant());
-    setProperty("_sz", QVariant());
-    return !out.isEmpty() && outSize.isValid();
+void ExampleRhiItem::setFrame(const QByteArray &pixels, int w, int h, int format) {
+    m_mailbox.write([&](FrameSlot &slot) {
+        slot.pixels.resize(pixels.size());
+        memcpy(slot.pixels.data(), pixels.constData(), pixels.size());
+        slot.size = QSize(w, h);
+        slot.format = FrameFormat(format);
+        slot.lut.reset();
+        slot.inputNs = 0;
+        slot.mediaMs = -1;
+        return !pixels.isEmpty();
+    });
+    requestFrameUpdate();
 }
 
 void ExampleRhiItem::setAngle(float a) {
@@ -41,155 +44,191 @@ void ExampleRhiItem::setBackgroundAlpha(float a) {
     update();
 }
 
+QSize ExampleRhiItem::outputSize() const {
+    if (m_oneToOne)
+        return QSize();
+    const qreal dpr = window() ? window()->effectiveDevicePixelRatio() : 1.0;
+    return (size() * dpr).toSize();
+}
+
+void ExampleRhiItem::setOneToOne(bool oneToOne) {
+    if (m_oneToOne == oneToOne)
+        return;
+    m_oneToOne = oneToOne;
+    emit oneToOneChanged();
+    emit outputSizeChanged();
+}
+
+void ExampleRhiItem::geometryChange(const QRectF &newGeometry, const QRectF &oldGeometry) {
+    QQuickRhiItem::geometryChange(newGeometry, oldGeometry);
+    if (newGeometry.size() != oldGeometry.size())
+        emit outputSizeChanged();
+}
+
+void ExampleRhiItem::itemChange(ItemChange change, const ItemChangeData &value) {
+    QQuickRhiItem::itemChange(change, value);
+    if (change == ItemDevicePixelRatioHasChanged || change == ItemSceneChange)
+        emit outputSizeChanged();
+}
+
 void ExampleRhiItemRenderer::synchronize(QQuickRhiItem *rhiItem) {
     // may need more thread shit here tbh
     //From a non-GUI thread: convert your cv::Mat to RGBA8, wrap in QByteArray, then
     //QMetaObject::invokeMethod(rhiItem, "setFrameRGBA8", Qt::QueuedConnection, Q_ARG(QByteArray, payload), Q_ARG(int, w), Q_ARG(int, h));
 
     auto *item = static_cast<ExampleRhiItem *>(rhiItem);
+    m_item = item;
     if (item->angle() != m_angle) m_angle = item->angle();
     if (item->backgroundAlpha() != m_alpha) m_alpha = item->backgroundAlpha();
+    if (m_rhi) item->setSupportedFormats(m_supportedFormats);
 
-    QByteArray px;
-    QSize sz;
-    if (item->takePendingFrame(px, sz)) {
-        m_pendingPixels = std::move(px);
-        m_pendingSize = sz;
-        m_hasPending = true;
-        //qDebug() << "We have now digested a " << m_pendingSize.width() << "x" << m_pendingSize.height() << " new cv mat bruh\n";
+    // A frame taken earlier but never rendered is superseded by this one, its slot went back to the producer
+    if (const FrameSlot *slot = item->mailbox().take())
+        m_pending = slot;
+}
+
+
+int planeCount(FrameFormat format) {
+    switch (format) {
+    case FrameFormat::YUV420P: return 3;
+    case FrameFormat::NV12:
+    case FrameFormat::P010: return 2;
+    default: return 1;
     }
+}
 
+QRhiTexture::Format planeFormat(FrameFormat format, int plane) {
+    switch (format) {
+    case FrameFormat::YUV420P: return QRhiTexture::R8;
+    case FrameFormat::NV12: return plane == 0 ? QRhiTexture::R8 : QRhiTexture::RG8;
+    case FrameFormat::P010: return plane == 0 ? QRhiTexture::R16 : QRhiTexture::RG16;
+    case FrameFormat::RGBA16F: return QRhiTexture::RGBA16F;
+    case FrameFormat::RGB10A2: return QRhiTexture::RGB10A2;
+    default: return QRhiTexture::RGBA8;
+    }
+}
 
+int planeBytesPerPixel(FrameFormat format, int plane) {
+    switch (format) {
+    case FrameFormat::YUV420P: return 1;
+    case FrameFormat::NV12: return plane == 0 ? 1 : 2;
+    case FrameFormat::P010: return plane == 0 ? 2 : 4;
+    case FrameFormat::RGBA16F: return 8;
+    default: return 4;
+    }
 }
 
-static QShader getShader(const QString &name) {
-    QFile f(name);
-    return f.open(QIODevice::ReadOnly) ? QShader::fromSerialized(f.readAll()) : QShader();
+QSize planeSize(FrameFormat format, QSize size, int plane) {
+    // All planar formats here are 4:2:0
+    if (plane == 0 || planeCount(format) == 1)
+        return size;
+    return QSize((size.width() + 1) / 2, (size.height() + 1) / 2);
+}
+
+// Bits per channel a frame carries, what frame.frag has to dither away on a shallower target
+static int frameDepth(FrameFormat format) {
+    switch (format) {
+    case FrameFormat::P010:
+    case FrameFormat::RGB10A2: return 10;
+    case FrameFormat::RGBA16F: return 16;
+    default: return 8;
+    }
+}
+
+// Bits per channel of the render target, 0 for float targets that need no quantizing
+static int targetDepth(QRhiTexture::Format format) {
+    switch (format) {
+    case QRhiTexture::RGB10A2: return 10;
+    case QRhiTexture::RGBA16F:
+    case QRhiTexture::RGBA32F: return 0;
+    default: return 8;
+    }
+}
+
+// Maps normalized (Y, Cb, Cr, 1) samples to RGB, folding in the range expansion.
+// colorSpace/colorRange are AVColorSpace/AVColorRange values.
+QMatrix4x4 yuvToRgbMatrix(int colorSpace, int colorRange, FrameFormat format, int height) {
+    float kr, kb;
+    switch (colorSpace) {
+    case 1: kr = 0.2126f; kb = 0.0722f; break;          // BT.709
+    case 4: kr = 0.30f; kb = 0.11f; break;              // FCC
+    case 5: case 6: kr = 0.299f; kb = 0.114f; break;    // BT.470BG, SMPTE 170M
+    case 7: kr = 0.212f; kb = 0.087f; break;            // SMPTE 240M
+    case 9: case 10: kr = 0.2627f; kb = 0.0593f; break; // BT.2020
+    default:
+        // unspecified: guess from the resolution like most players do
+        kr = height >= 720 ? 0.2126f : 0.299f;
+        kb = height >= 720 ? 0.0722f : 0.114f;
+        break;
+    }
+    const float kg = 1.0f - kr - kb;
+
+    // 8-bit planes sample as v/255, P010 keeps 10 bits at the top of 16 so it samples as v*64/65535.
+    const int depth = format == FrameFormat::P010 ? 10 : 8;
+    const float toCode = format == FrameFormat::P010 ? 65535.0f / 64.0f : 255.0f;
+    const float unit = float(1 << (depth - 8));
+    float ay, by, ac, bc;
+    if (colorRange == 2) { // full
+        const float maxCode = float((1 << depth) - 1);
+        ay = toCode / maxCode; by = 0.0f;
+        ac = toCode / maxCode; bc = -128.0f * unit / maxCode;
+    } else {               // limited, also assumed when unspecified
+        ay = toCode / (219.0f * unit); by = -16.0f / 219.0f;
+        ac = toCode / (224.0f * unit); bc = -128.0f / 224.0f;
+    }
+
+    const float rv = 2.0f * (1.0f - kr);
+    const float bu = 2.0f * (1.0f - kb);
+    const float gu = 2.0f * kb * (1.0f - kb) / kg;
+    const float gv = 2.0f * kr * (1.0f - kr) / kg;
+    return QMatrix4x4(ay, 0.0f,     rv * ac,   by + rv * bc,
+                      ay, -gu * ac, -gv * ac,  by - (gu + gv) * bc,
+                      ay, bu * ac,  0.0f,      by + bu * bc,
+                      0.0f, 0.0f,   0.0f,      1.0f);
 }
-static constexpr int NUM_VERTS = 6;
-static constexpr float R = 0.75f;
-//ccw
-static float vertexData[] = {
-    -R,   -R,   0.0f, 1.0f,
-    R,   -R,   1.0f, 1.0f,
-    R,    R,   1.0f, 0.0f,
 
-    R,    R,   1.0f, 0.0f,
-    -R,   -R,   0.0f, 1.0f,
-    -R,    R,   0.0f, 0.0f,
-};
 void ExampleRhiItemRenderer::initialize(QRhiCommandBuffer *cb) {
     if (m_rhi != rhi()) {
         m_rhi = rhi();
-        m_pipeline.reset();
+        m_pipeline = nullptr;
+        m_ubuf.reset();
     }
 
     if (m_sampleCount != renderTarget()->sampleCount()) {
         m_sampleCount = renderTarget()->sampleCount();
-        m_pipeline.reset();
+        m_pipeline = nullptr;
     }
 
     QRhiTexture *finalTex = m_sampleCount > 1 ? resolveTexture() : colorTexture();
     if (m_textureFormat != finalTex->format()) {
         m_textureFormat = finalTex->format();
-        m_pipeline.reset();
+        m_pipeline = nullptr;
     }
-    if (!m_pipeline) {
-        m_vbuf.reset(m_rhi->newBuffer(QRhiBuffer::Immutable, QRhiBuffer::VertexBuffer, sizeof(vertexData)));
-        m_vbuf->create();
+    if (!m_ubuf) {
+        // Shaders, vertex buffer, sampler and pipelines are shared with the other views on this QRhi
+        m_shared = RhiResourceCache::forRhi(m_rhi);
 
-        m_ubuf.reset(m_rhi->newBuffer(QRhiBuffer::Dynamic, QRhiBuffer::UniformBuffer, 64));
+        m_ubuf.reset(m_rhi->newBuffer(QRhiBuffer::Dynamic, QRhiBuffer::UniformBuffer, RhiResourceCache::UniformBufferSize));
         m_ubuf->create();
 
-
-        m_sampler.reset(m_rhi->newSampler(QRhiSampler::Linear, QRhiSampler::Linear, QRhiSampler::None,
-                                          QRhiSampler::ClampToEdge, QRhiSampler::ClampToEdge));
-        m_sampler->create();
-
-        QSize texSize = {1, 1};
-        m_tex.reset(m_rhi->newTexture(QRhiTexture::RGBA8, texSize, 1));
-        m_tex->create();
-
-        {
-            QRhiResourceUpdateBatch *u = m_rhi->nextResourceUpdateBatch();
-            const quint32 px = 0xFFFFF000u;
-            QRhiTextureSubresourceUploadDescription sub(
-                QByteArray(reinterpret_cast<const char*>(&px), 4)
-                );
-            QRhiTextureUploadDescription desc(QRhiTextureUploadEntry(0, 0, sub));
-            u->uploadTexture(m_tex.get(), desc);
-            cb->resourceUpdate(u);
-        }
-        if(false){
-            auto *u = m_rhi->nextResourceUpdateBatch();
-            const quint32 px = 0xFF000000u; // RGBA8 black
-            QRhiTextureSubresourceUploadDescription sub(QByteArray(reinterpret_cast<const char*>(&px), 4));
-            QRhiTextureUploadDescription desc(QRhiTextureUploadEntry(0, 0, sub));
-            u->uploadTexture(m_tex.get(), desc);
-            cb->resourceUpdate(u);
-        }
-
-        m_srb.reset(m_rhi->newShaderResourceBindings());
-        m_srb->setBindings({
-            QRhiShaderResourceBinding::uniformBuffer(0, QRhiShaderResourceBinding::VertexStage, m_ubuf.get()),
-            QRhiShaderResourceBinding::sampledTexture(1, QRhiShaderResourceBinding::FragmentStage, m_tex.get(), m_sampler.get()),
-        });
-        m_srb->create();
-
-        m_pipeline.reset(m_rhi->newGraphicsPipeline());
-        const QShader vs = getShader(":/scenegraph/rhitextureitem/shaders/frame.vert.qsb");
-        const QShader fs = getShader(":/scenegraph/rhitextureitem/shaders/frame.frag.qsb");
-        if (!vs.isValid() || !fs.isValid()) {
-            qFatal("QSB shader(s) missing or invalid. Check resource path & qsb output.");
-        }
-        Q_ASSERT(vs.isValid());
-        Q_ASSERT(fs.isValid());
-        m_pipeline->setShaderStages({
-           { QRhiShaderStage::Vertex, vs },
-           { QRhiShaderStage::Fragment, fs }
-        });
-
-        //strides
-        QRhiVertexInputLayout inputLayout;
-        inputLayout.setBindings({
-            { 4 * sizeof(float) }
-        });
-        inputLayout.setAttributes({
-            { 0, 0, QRhiVertexInputAttribute::Float2, 0 },
-            { 0, 1, QRhiVertexInputAttribute::Float2, 2 * sizeof(float) }
-        });
-        m_pipeline->setSampleCount(m_sampleCount);
-        m_pipeline->setVertexInputLayout(inputLayout);
-        m_pipeline->setShaderResourceBindings(m_srb.get());
-        m_pipeline->setRenderPassDescriptor(renderTarget()->renderPassDescriptor());
-        m_pipeline->create();
-
-
-        const bool isOpenGL =
-            (m_rhi->backend() == QRhi::OpenGLES2) ||
-                              (m_rhi->backend() == QRhi::Null);
-        qCritical() << "OpenGL backend? " << isOpenGL << " ; " << m_rhi->backendName();
-
-        auto Vflip = [isOpenGL](float v) -> float {
-            return isOpenGL ? (1.0f - v) : v;
-        };
-
-        static constexpr float R = 0.75f;
-        //ccw
-        float verts[] = {
-            -R,   -R,    0.0f, Vflip(0.0f),
-            R,   -R,    1.0f, Vflip(0.0f),
-            R,    R,    1.0f, Vflip(1.0f),
-
-            R,    R,    1.0f, Vflip(1.0f),
-            -R,   -R,    0.0f, Vflip(0.0f),
-            -R,    R,    0.0f, Vflip(1.0f),
-        };
-
-        QRhiResourceUpdateBatch *resourceUpdates = m_rhi->nextResourceUpdateBatch();
-        resourceUpdates->uploadStaticBuffer(m_vbuf.get(), vertexData);
-        cb->resourceUpdate(resourceUpdates);
+        m_frameFormat = FrameFormat::RGBA8;
+        const bool yuvSupported = m_rhi->isTextureFormatSupported(QRhiTexture::R8) && m_rhi->isTextureFormatSupported(QRhiTexture::RG8)
+                                  && m_rhi->isTextureFormatSupported(QRhiTexture::R16) && m_rhi->isTextureFormatSupported(QRhiTexture::RG16);
+        m_supportedFormats = 1u << int(FrameFormat::RGBA8);
+        if (yuvSupported)
+            m_supportedFormats |= 1u << int(FrameFormat::YUV420P) | 1u << int(FrameFormat::NV12) | 1u << int(FrameFormat::P010);
+        if (m_rhi->isTextureFormatSupported(QRhiTexture::RGBA16F))
+            m_supportedFormats |= 1u << int(FrameFormat::RGBA16F);
+        if (m_rhi->isTextureFormatSupported(QRhiTexture::RGB10A2))
+            m_supportedFormats |= 1u << int(FrameFormat::RGB10A2);
+
+        m_lutData.reset();
+        m_lutSize = 0;
+        createTextureSets(cb);
     }
+    m_shared->prepare(cb);
+    if (!m_pipeline)
+        m_pipeline = m_shared->pipeline(renderTarget()->renderPassDescriptor(), m_sampleCount);
 
     const QSize outputSize = renderTarget()->pixelSize();
     m_viewProjection = m_rhi->clipSpaceCorrMatrix();
@@ -197,37 +236,173 @@ void ExampleRhiItemRenderer::initialize(QRhiCommandBuffer *cb) {
     m_viewProjection.translate(0, 0, -2);
 }
 
-void ExampleRhiItemRenderer::render(QRhiCommandBuffer *cb) {
-    if (m_hasPending) {
-        if (!m_tex || m_tex->pixelSize() != m_pendingSize) {
-            m_tex.reset();
-            m_tex.reset(m_rhi->newTexture(QRhiTexture::RGBA8, m_pendingSize, 1));
-            m_tex->create();
-
-            // Rebuild 8SRB with the real texture
-            m_srb.reset(m_rhi->newShaderResourceBindings());
-            m_srb->setBindings({
-                QRhiShaderResourceBinding::uniformBuffer(0, QRhiShaderResourceBinding::VertexStage, m_ubuf.get()),
-                QRhiShaderResourceBinding::sampledTexture(1, QRhiShaderResourceBinding::FragmentStage, m_tex.get(), m_sampler.get())
-            });
-            m_srb->create();
-            m_pipeline->setShaderResourceBindings(m_srb.get());
+void ExampleRhiItemRenderer::createTextureSets(QRhiCommandBuffer *cb) {
+    QRhiResourceUpdateBatch *u = m_rhi->nextResourceUpdateBatch();
+    const quint32 px = 0xFFFFF000u;
+    const QRhiTextureUploadDescription placeholder(QRhiTextureUploadEntry(0, 0, QRhiTextureSubresourceUploadDescription(
+        QByteArray(reinterpret_cast<const char*>(&px), 4))));
+    m_lut.reset(m_rhi->newTexture(QRhiTexture::RGBA8, QSize(1, 1), 1));
+    m_lut->create();
+    u->uploadTexture(m_lut.get(), placeholder);
+    for (TextureSet &set : m_sets) {
+        for (auto &tex : set.planes) {
+            tex.reset(m_rhi->newTexture(QRhiTexture::RGBA8, QSize(1, 1), 1));
+            tex->create();
+            u->uploadTexture(tex.get(), placeholder);
         }
+        set.srb.reset(m_rhi->newShaderResourceBindings());
+        set.srb->setBindings({
+            QRhiShaderResourceBinding::uniformBuffer(0, QRhiShaderResourceBinding::VertexStage | QRhiShaderResourceBinding::FragmentStage, m_ubuf.get()),
+            QRhiShaderResourceBinding::sampledTexture(1, QRhiShaderResourceBinding::FragmentStage, set.planes[0].get(), m_shared->sampler()),
+            QRhiShaderResourceBinding::sampledTexture(2, QRhiShaderResourceBinding::FragmentStage, set.planes[1].get(), m_shared->sampler()),
+            QRhiShaderResourceBinding::sampledTexture(3, QRhiShaderResourceBinding::FragmentStage, set.planes[2].get(), m_shared->sampler()),
+            QRhiShaderResourceBinding::sampledTexture(4, QRhiShaderResourceBinding::FragmentStage, m_lut.get(), m_shared->sampler()),
+        });
+        set.srb->create();
+    }
+    cb->resourceUpdate(u);
+    m_current = 0;
+}
 
-        QRhiResourceUpdateBatch *u = m_rhi->nextResourceUpdateBatch();
+void ExampleRhiItemRenderer::ensureTextures(TextureSet &set, FrameFormat format, QSize size) {
+    const int planes = planeCount(format);
+    for (int plane = 0; plane < 3; plane++) {
+        QRhiTexture *tex = set.planes[plane].get();
+        // unused chroma slots keep a 1x1 placeholder so the bindings stay valid
+        const QRhiTexture::Format texFormat = plane < planes ? planeFormat(format, plane) : QRhiTexture::RGBA8;
+        const QSize texSize = plane < planes ? planeSize(format, size, plane) : QSize(1, 1);
+        if (tex->pixelSize() == texSize && tex->format() == texFormat)
+            continue;
+        // Same object re-created, the set's bindings pick up the new native texture by themselves
+        tex->setPixelSize(texSize);
+        tex->setFormat(texFormat);
+        tex->create();
+        m_recreated++;
+    }
+}
 
-        QRhiTextureSubresourceUploadDescription sub(m_pendingPixels);
-        // tightly packed?
-        sub.setDataStride(static_cast<quint32>(m_pendingSize.width() * 4));  // RGBA8
+bool ExampleRhiItemRenderer::upload(QRhiCommandBuffer *cb) {
+    const FrameSlot &frame = *m_pending;
+    QElapsedTimer timer;
+    timer.start();
+    const int next = (m_current + 1) % TextureRing;
+    TextureSet &set = m_sets[next];
+    ensureTextures(set, frame.format, frame.size);
+
+    // Planes are raw views into the slot, which stays untouched until the next synchronize(), after this
+    // frame has been submitted. Sharing the QByteArray instead would make the producer's next write detach.
+    QRhiResourceUpdateBatch *u = m_rhi->nextResourceUpdateBatch();
+    qsizetype offset = 0;
+    for (int plane = 0; plane < planeCount(frame.format); plane++) {
+        const QSize size = planeSize(frame.format, frame.size, plane);
+        const quint32 stride = quint32(size.width() * planeBytesPerPixel(frame.format, plane));
+        const qsizetype bytes = qsizetype(stride) * size.height();
+        if (offset + bytes > frame.pixels.size()) {
+            qWarning() << "Frame too small for" << frame.size;
+            u->release();
+            return false;
+        }
+        QRhiTextureSubresourceUploadDescription sub(QByteArray::fromRawData(frame.pixels.constData() + offset, bytes));
+        sub.setDataStride(stride);
+        u->uploadTexture(set.planes[plane].get(), QRhiTextureUploadDescription(QRhiTextureUploadEntry(0, 0, sub)));
+        offset += bytes;
+    }
+    updateLut(u, frame.lut);
+    cb->resourceUpdate(u);
+    m_current = next;
+
+    const double ms = timer.nsecsElapsed() / 1e6;
+    m_uploads++;
+    m_uploadBytes += offset;
+    m_uploadMs += ms;
+    m_uploadMaxMs = std::max(m_uploadMaxMs, ms);
+    return true;
+}
 
-        QRhiTextureUploadEntry entry(0, 0, sub);
-        QRhiTextureUploadDescription desc(entry);
-        u->uploadTexture(m_tex.get(), desc);
-        cb->resourceUpdate(u);
+void ExampleRhiItemRenderer::updateLut(QRhiResourceUpdateBatch *u, const std::shared_ptr<const ColorLut> &lut) {
+    if (lut == m_lutData)
+        return;
+    m_lutData = lut;
+    m_lutSize = 0;
+    if (!lut)
+        return;
+    const int n = lut->size;
+    const QSize size(n * n, n);
+    if (size.width() > m_rhi->resourceLimit(QRhi::TextureSizeMax)) {
+        qWarning() << "Colour LUT of size" << n << "does not fit a texture on this backend, not applied";
+        return;
+    }
+    const bool half = m_rhi->isTextureFormatSupported(QRhiTexture::RGBA16F);
+    QByteArray texels(qsizetype(size.width()) * size.height() * (half ? 8 : 4), Qt::Uninitialized);
+    // .cube order (red fastest, then green, then blue) into the atlas: blue picks the slice, green the row
+    for (int b = 0; b < n; b++) {
+        for (int g = 0; g < n; g++) {
+            for (int r = 0; r < n; r++) {
+                const float *in = &lut->rgb[3 * ((size_t(b) * n + g) * n + r)];
+                const size_t texel = size_t(g) * size.width() + size_t(b) * n + r;
+                if (half) {
+                    qfloat16 *out = reinterpret_cast<qfloat16 *>(texels.data()) + 4 * texel;
+                    out[0] = qfloat16(in[0]);
+                    out[1] = qfloat16(in[1]);
+                    out[2] = qfloat16(in[2]);
+                    out[3] = qfloat16(1.0f);
+                } else {
+                    uchar *out = reinterpret_cast<uchar *>(texels.data()) + 4 * texel;
+                    for (int c = 0; c < 3; c++)
+                        out[c] = uchar(std::clamp(in[c], 0.0f, 1.0f) * 255.0f + 0.5f);
+                    out[3] = 255;
+                }
+            }
+        }
+    }
+    const QRhiTexture::Format format = half ? QRhiTexture::RGBA16F : QRhiTexture::RGBA8;
+    if (m_lut->pixelSize() != size || m_lut->format() != format) {
+        m_lut->setPixelSize(size);
+        m_lut->setFormat(format);
+        m_lut->create();
+        m_recreated++;
+    }
+    u->uploadTexture(m_lut.get(), QRhiTextureUploadDescription(QRhiTextureUploadEntry(0, 0, QRhiTextureSubresourceUploadDescription(texels))));
+    m_lutSize = float(n);
+}
+
+void ExampleRhiItemRenderer::reportUploads(QRhiCommandBuffer *cb) {
+    // Seconds the GPU spent on the last completed frame, 0 without timestamps
+    const double gpu = m_rhi->isFeatureSupported(QRhi::Timestamps) ? cb->lastCompletedGpuTime() : 0;
+    if (gpu > 0) {
+        m_gpuMs += gpu * 1000;
+        m_gpuFrames++;
+    }
+    if (!m_reportTimer.isValid())
+        m_reportTimer.start();
+    if (m_reportTimer.elapsed() < 5000)
+        return;
+    if (m_uploads > 0) {
+        QDebug log = qInfo().nospace();
+        log << "RhiTextureItem: " << m_uploads << " uploads, " << m_uploadBytes / m_uploads / 1024 << " KiB each, recorded in "
+            << m_uploadMs / m_uploads << " ms (max " << m_uploadMaxMs << "), " << m_recreated << " textures re-created";
+        if (m_gpuFrames > 0)
+            log << "; GPU " << m_gpuMs / m_gpuFrames << " ms per frame";
+    }
+    m_reportTimer.restart();
+    m_uploads = m_recreated = m_gpuFrames = 0;
+    m_uploadBytes = 0;
+    m_uploadMs = m_uploadMaxMs = m_gpuMs = 0;
+}
 
-        m_hasPending = false;
-        m_pendingPixels.clear();
+void ExampleRhiItemRenderer::render(QRhiCommandBuffer *cb) {
+    if (m_pending && !(m_supportedFormats & (1u << int(m_pending->format)))) {
+        qWarning() << "Frame dropped, backend cannot sample format" << int(m_pending->format);
+        m_pending = nullptr;
     }
+    if (m_pending && upload(cb)) {
+        m_frameFormat = m_pending->format;
+        m_yuvToRgb = yuvToRgbMatrix(m_pending->colorSpace, m_pending->colorRange, m_frameFormat, m_pending->size.height());
+        if (m_item)
+            m_item->setRendered(m_pending->inputNs, m_pending->mediaMs);
+    }
+    m_pending = nullptr;
+    reportUploads(cb);
 
     QRhiResourceUpdateBatch *resourceUpdates = m_rhi->nextResourceUpdateBatch();
 
@@ -235,18 +410,29 @@ void ExampleRhiItemRenderer::render(QRhiCommandBuffer *cb) {
     QMatrix4x4 modelViewProjection = m_viewProjection;
     modelViewProjection.rotate(m_angle, 0, 1, 0);
     resourceUpdates->updateDynamicBuffer(m_ubuf.get(), 0, 64, modelViewProjection.constData());
+    // 0: RGBA, 1: three planes, 2: luma + interleaved chroma, 3: RGB without alpha
+    const qint32 shaderFormat = m_frameFormat == FrameFormat::RGB10A2 ? 3
+        : planeCount(m_frameFormat) == 1 ? 0 : (planeCount(m_frameFormat) == 3 ? 1 : 2);
+    // Levels to quantize to with dithering, 0 when the target holds everything the frame has
+    const int depth = targetDepth(m_textureFormat);
+    const float levels = depth > 0 && frameDepth(m_frameFormat) > depth ? float((1 << depth) - 1) : 0.0f;
+    resourceUpdates->updateDynamicBuffer(m_ubuf.get(), 64, 64, m_yuvToRgb.constData());
+    resourceUpdates->updateDynamicBuffer(m_ubuf.get(), 128, 4, &shaderFormat);
+    resourceUpdates->updateDynamicBuffer(m_ubuf.get(), 132, 4, &levels);
+    resourceUpdates->updateDynamicBuffer(m_ubuf.get(), 136, 4, &m_lutSize);
 
     // Qt Quick expects premultiplied alpha
     const QColor clearColor = QColor::fromRgbF(0.5f * m_alpha, 0.5f * m_alpha, 0.7f * m_alpha, m_alpha);
     cb->beginPass(renderTarget(), clearColor, { 1.0f, 0 }, resourceUpdates);
 
-    cb->setGraphicsPipeline(m_pipeline.get());
-    const QSize outputSize = renderTarget()->pixelSize();
-    cb->setViewport(QRhiViewport(0, 0, outputSize.width(), outputSize.height()));
-    cb->setShaderResources(m_srb.get());
-    const QRhiCommandBuffer::VertexInput vbufBinding(m_vbuf.get(), 0);
-    cb->setVertexInput(0, 1, &vbufBinding);
-    cb->draw(NUM_VERTS);
-
+    if (m_pipeline) {
+        cb->setGraphicsPipeline(m_pipeline);
+        const QSize outputSize = renderTarget()->pixelSize();
+        cb->setViewport(QRhiViewport(0, 0, outputSize.width(), outputSize.height()));
+        cb->setShaderResources(m_sets[m_current].srb.get());
+        const QRhiCommandBuffer::VertexInput vbufBinding(m_shared->vertexBuffer(), 0);
+        cb->setVertexInput(0, 1, &vbufBinding);
+        cb->draw(RhiResourceCache::VertexCount);
+    }
     cb->endPass();
 }
@@ -2,7 +2,89 @@
 #define RHITEXTUREITEM_H
 
 #include <QQuickRhiItem>
+#include <QElapsedTimer>
 #include <rhi/qrhi.h>
+#include <atomic>
+#include <memory>
+#include "colorlut.h"
+#include <mutex>
+
+// Pixel layouts accepted by ExampleRhiItem::setFrame. Planar layouts are tightly packed planes, as written by
+// av_image_copy_to_buffer() with align 1, and get converted to RGB in frame.frag. RGBA16F is half floats,
+// RGB10A2 little-endian 32-bit words with R in the low bits (AV_PIX_FMT_X2BGR10LE), alpha ignored; frame.frag
+// dithers these down to the render target's depth instead of the CPU truncating them to 8 bits.
+enum class FrameFormat { RGBA8 = 0, YUV420P = 1, NV12 = 2, P010 = 3, RGBA16F = 4, RGB10A2 = 5 };
+
+// How the renderer lays a FrameFormat out in textures: planes, their texture format, bytes per texel and size
+// for a frame of the given size. Also used by the offscreen render test.
+int planeCount(FrameFormat format);
+QRhiTexture::Format planeFormat(FrameFormat format, int plane);
+int planeBytesPerPixel(FrameFormat format, int plane);
+QSize planeSize(FrameFormat format, QSize size, int plane);
+// Maps normalized (Y, Cb, Cr, 1) samples of a planar frame to RGB; AVColorSpace/AVColorRange values
+QMatrix4x4 yuvToRgbMatrix(int colorSpace, int colorRange, FrameFormat format, int height);
+
+// One frame on its way to the renderer, with what is needed to draw and track it.
+struct FrameSlot {
+    QByteArray pixels; // written in place; grows to the largest frame seen and stays there
+    QSize size;
+    FrameFormat format = FrameFormat::RGBA8;
+    int colorSpace = 2; // AVColorSpace of planar frames, unspecified
+    int colorRange = 0; // AVColorRange of planar frames, unspecified
+    std::shared_ptr<const ColorLut> lut; // applied after conversion to RGB, none when null; only compared by pointer
+    qint64 inputNs = 0; // see ExampleRhiItem::takeRenderedInput
+    qint64 mediaMs = -1;
+};
+
+// Triple buffer between the thread producing frames and the render thread. The producer fills its back slot
+// and publishes it by swapping it with the middle slot; synchronize() takes the middle slot by swapping it with
+// its front slot. Neither side waits for the other and, once the slots have grown to frame size, nothing is
+// allocated. A frame published before the renderer took the previous one replaces it. Producers are serialised
+// among themselves, the render thread takes no lock.
+class FrameMailbox {
+    static constexpr int Fresh = 4; // set on m_middle between publish and take
+
+    FrameSlot m_slots[3];
+    std::mutex m_writeLock;
+    int m_back = 0;  // producer's slot
+    int m_front = 1; // render thread's slot
+    std::atomic<int> m_middle{2};
+    std::atomic<long long> m_published{0}, m_replaced{0}, m_grown{0};
+
+public:
+    // Fills the back slot with fill(FrameSlot&) and publishes it, unless fill returns false.
+    template<typename Fill>
+    bool write(Fill &&fill) {
+        std::lock_guard<std::mutex> g(m_writeLock);
+        FrameSlot &slot = m_slots[m_back];
+        const qsizetype capacity = slot.pixels.capacity();
+        if (!fill(slot))
+            return false;
+        if (slot.pixels.capacity() != capacity)
+            m_grown++;
+        const int previous = m_middle.exchange(m_back | Fresh, std::memory_order_acq_rel);
+        if (previous & Fresh)
+            m_replaced++;
+        m_back = previous & ~Fresh;
+        m_published++;
+        return true;
+    }
+
+    // Render thread: the newest published frame, nullptr when nothing new came. Valid until the next take().
+    const FrameSlot *take() {
+        if (!(m_middle.load(std::memory_order_acquire) & Fresh))
+            return nullptr;
+        m_front = m_middle.exchange(m_front, std::memory_order_acq_rel) & ~Fresh;
+        return &m_slots[m_front];
+    }
+
+    long long published() const { return m_published; }
+    long long replaced() const { return m_replaced; } // published, never drawn
+    long long grown() const { return m_grown; }       // writes that had to allocate
+};
+
+class ExampleRhiItem;
+class RhiResourceCache;
 
 class ExampleRhiItemRenderer : public QQuickRhiItemRenderer
 {
@@ -12,24 +94,56 @@ public:
     void render(QRhiCommandBuffer *cb) override;
 
 private:
+    // Textures and bindings for one frame. Each new frame goes to the next set of the ring, so its upload never
+    // waits for the previous frame to be sampled; textures are only re-created in place (same objects, so the
+    // bindings stay) when the format or size changes.
+    struct TextureSet {
+        std::unique_ptr<QRhiTexture> planes[3]; // RGBA or luma, then U/V or interleaved UV; 1x1 placeholders when unused
+        std::unique_ptr<QRhiShaderResourceBindings> srb;
+    };
+    static constexpr int TextureRing = 3;
+
+    void createTextureSets(QRhiCommandBuffer *cb);
+    void ensureTextures(TextureSet &set, FrameFormat format, QSize size);
+    bool upload(QRhiCommandBuffer *cb);
+    void reportUploads(QRhiCommandBuffer *cb);
+    void updateLut(QRhiResourceUpdateBatch *u, const std::shared_ptr<const ColorLut> &lut);
+
     QRhi *m_rhi = nullptr;
     int m_sampleCount = 1;
     QRhiTexture::Format m_textureFormat = QRhiTexture::RGBA8;
 
-    std::unique_ptr<QRhiBuffer> m_vbuf;
+    std::shared_ptr<RhiResourceCache> m_shared; // first, so it goes after the bindings using its sampler
     std::unique_ptr<QRhiBuffer> m_ubuf;
-    std::unique_ptr<QRhiSampler> m_sampler;
-    std::unique_ptr<QRhiTexture> m_tex;
-    std::unique_ptr<QRhiShaderResourceBindings> m_srb;
-    std::unique_ptr<QRhiGraphicsPipeline> m_pipeline;
+    TextureSet m_sets[TextureRing];
+    int m_current = 0; // set drawn from
+    QRhiGraphicsPipeline *m_pipeline = nullptr; // owned by m_shared
 
     QMatrix4x4 m_viewProjection;
     float m_angle = 0.0f;
     float m_alpha = 1.0f;
 
-    QByteArray m_pendingPixels;
-    QSize m_pendingSize;
-    bool m_hasPending = false;
+    // Taken from the item's mailbox, uploaded straight from there: the slot stays ours until the next take()
+    const FrameSlot *m_pending = nullptr;
+    FrameFormat m_frameFormat = FrameFormat::RGBA8;
+    unsigned m_supportedFormats = 0; // 1 << FrameFormat the backend can sample
+    ExampleRhiItem *m_item = nullptr;
+
+    QMatrix4x4 m_yuvToRgb;
+
+    // The colour LUT in use, as a size^2 x size atlas of its blue slices (frame.frag interpolates between
+    // slices itself, 3D textures are not everywhere). Shared by all texture sets and only uploaded when a
+    // frame brings a different table.
+    std::unique_ptr<QRhiTexture> m_lut;
+    std::shared_ptr<const ColorLut> m_lutData;
+    float m_lutSize = 0; // 0 for none
+
+    // Upload statistics since the last report: CPU time recording the uploads, GPU time of whole frames from
+    // QRhi timestamps (only when the QRhi has them, e.g. QSG_RHI_PROFILE=1), textures re-created
+    QElapsedTimer m_reportTimer;
+    int m_uploads = 0, m_recreated = 0, m_gpuFrames = 0;
+    qint64 m_uploadBytes = 0;
+    double m_uploadMs = 0, m_uploadMaxMs = 0, m_gpuMs = 0;
 };
 
 class ExampleRhiItem : public QQuickRhiItem {
@@ -37,6 +151,7 @@ class ExampleRhiItem : public QQuickRhiItem {
     QML_NAMED_ELEMENT(RhiTextureItem)
     Q_PROPERTY(float angle READ angle WRITE setAngle NOTIFY angleChanged)
     Q_PROPERTY(float backgroundAlpha READ backgroundAlpha WRITE setBackgroundAlpha NOTIFY backgroundAlphaChanged)
+    Q_PROPERTY(bool oneToOne READ oneToOne WRITE setOneToOne NOTIFY oneToOneChanged)
 
 public:
     QQuickRhiItemRenderer *createRenderer() override;
@@ -45,21 +160,66 @@ public:
         setImplicitHeight(360);
     }
 
+    // Frames go through mailbox() from any thread: write a slot, then requestFrameUpdate(). The render thread
+    // picks the newest one up in synchronize(); all the GUI thread sees is a coalesced update().
+    FrameMailbox &mailbox() { return m_mailbox; }
+    void requestFrameUpdate() {
+        if (!m_updatePosted.exchange(true))
+            QMetaObject::invokeMethod(this, [this] { m_updatePosted = false; update(); }, Qt::QueuedConnection);
+    }
+    // Convenience for callers holding a QByteArray already (QML, tests); copies it into the mailbox.
     Q_INVOKABLE void setFrameRGBA8(const QByteArray &pixels, int w, int h);
-    bool takePendingFrame(QByteArray &out, QSize &outSize);
+    Q_INVOKABLE void setFrame(const QByteArray &pixels, int w, int h, int format);
+    // Presentation tracking: a slot carries the input it answers (inputNs, steady clock, 0 for none) and the
+    // media time it shows (mediaMs, -1 when unknown). Once that frame has been drawn takeRenderedInput() returns the
+    // input time and takeRenderedFrame() the media time, once each; read them on QQuickWindow::frameSwapped.
+    void setRendered(qint64 inputNs, qint64 mediaMs) {
+        if (inputNs != 0)
+            m_renderedInput = inputNs;
+        m_renderedMedia = mediaMs;
+        m_renderedFresh = true;
+    }
+    qint64 takeRenderedInput() { return m_renderedInput.exchange(0); }
+    bool takeRenderedFrame(qint64 &mediaMs) {
+        mediaMs = m_renderedMedia;
+        return m_renderedFresh.exchange(false);
+    }
+    // Set by the renderer once it knows which textures the backend can sample (R8/RG8/R16/RG16 planes,
+    // RGBA16F, RGB10A2); only RGBA8, which every backend samples, until then.
+    bool supportsFormat(FrameFormat format) const { return m_supportedFormats & (1u << int(format)); }
+    void setSupportedFormats(unsigned formats) { m_supportedFormats = formats; }
     float angle() const { return m_angle; }
     void setAngle(float a);
 
     float backgroundAlpha() const { return m_alpha; }
     void setBackgroundAlpha(float a);
 
+    // Size frames are worth producing at: the item in device pixels, or empty (full resolution) at 1:1.
+    // Follows geometry and device pixel ratio, announced with outputSizeChanged().
+    QSize outputSize() const;
+    bool oneToOne() const { return m_oneToOne; }
+    void setOneToOne(bool oneToOne);
+
 signals:
     void angleChanged();
     void backgroundAlphaChanged();
+    void oneToOneChanged();
+    void outputSizeChanged();
+
+protected:
+    void geometryChange(const QRectF &newGeometry, const QRectF &oldGeometry) override;
+    void itemChange(ItemChange change, const ItemChangeData &value) override;
 
 private:
     float m_angle = 0.0f;
     float m_alpha = 1.0f;
+    bool m_oneToOne = false;
+    std::atomic<unsigned> m_supportedFormats{1u << int(FrameFormat::RGBA8)};
+    FrameMailbox m_mailbox;
+    std::atomic<bool> m_updatePosted{false};
+    std::atomic<qint64> m_renderedInput{0};
+    std::atomic<qint64> m_renderedMedia{-1};
+    std::atomic<bool> m_renderedFresh{false};
 };
 
 #endif
@@ -0,0 +1,141 @@
+#include "rotatekernelsimpl.h"
+#include <opencv2/opencv.hpp>
+#include <QDebug>
+#include <vector>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define QTPLAYER_X86 1
+#include <emmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+namespace videoio {
+using namespace std;
+
+namespace {
+const detail::RotateKernels ScalarKernels = {
+    "scalar",
+    transposeTiled<ScalarOps<uint32_t>>, transposeTiled<ScalarOps<uint64_t>>,
+    reverseRows<ScalarOps<uint32_t>>, reverseRows<ScalarOps<uint64_t>>,
+};
+
+#ifdef QTPLAYER_X86
+// SSE2 is part of x86-64, so these need no runtime check.
+struct Sse2Ops32 {
+    using Pixel = uint32_t;
+    static constexpr int Block = 4, Lanes = 4;
+    static void transpose(const uint8_t* src, ptrdiff_t ss, uint8_t* dst, ptrdiff_t ds) {
+        __m128i r0 = _mm_loadu_si128((const __m128i*)(src));
+        __m128i r1 = _mm_loadu_si128((const __m128i*)(src + ss));
+        __m128i r2 = _mm_loadu_si128((const __m128i*)(src + 2 * ss));
+        __m128i r3 = _mm_loadu_si128((const __m128i*)(src + 3 * ss));
+        __m128i t0 = _mm_unpacklo_epi32(r0, r1), t1 = _mm_unpacklo_epi32(r2, r3);
+        __m128i t2 = _mm_unpackhi_epi32(r0, r1), t3 = _mm_unpackhi_epi32(r2, r3);
+        _mm_storeu_si128((__m128i*)(dst), _mm_unpacklo_epi64(t0, t1));
+        _mm_storeu_si128((__m128i*)(dst + ds), _mm_unpackhi_epi64(t0, t1));
+        _mm_storeu_si128((__m128i*)(dst + 2 * ds), _mm_unpacklo_epi64(t2, t3));
+        _mm_storeu_si128((__m128i*)(dst + 3 * ds), _mm_unpackhi_epi64(t2, t3));
+    }
+    static void reverse(const uint8_t* src, uint8_t* dst) {
+        _mm_storeu_si128((__m128i*)dst, _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)src), 0x1B));
+    }
+};
+
+struct Sse2Ops64 {
+    using Pixel = uint64_t;
+    static constexpr int Block = 2, Lanes = 2;
+    static void transpose(const uint8_t* src, ptrdiff_t ss, uint8_t* dst, ptrdiff_t ds) {
+        __m128i r0 = _mm_loadu_si128((const __m128i*)(src));
+        __m128i r1 = _mm_loadu_si128((const __m128i*)(src + ss));
+        _mm_storeu_si128((__m128i*)(dst), _mm_unpacklo_epi64(r0, r1));
+        _mm_storeu_si128((__m128i*)(dst + ds), _mm_unpackhi_epi64(r0, r1));
+    }
+    static void reverse(const uint8_t* src, uint8_t* dst) {
+        _mm_storeu_si128((__m128i*)dst, _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)src), 0x4E));
+    }
+};
+
+const detail::RotateKernels Sse2Kernels = {
+    "sse2",
+    transposeTiled<Sse2Ops32>, transposeTiled<Sse2Ops64>,
+    reverseRows<Sse2Ops32>, reverseRows<Sse2Ops64>,
+};
+
+bool cpuHasAvx2() {
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 1);
+    const bool osxsave = info[2] & (1 << 27), avx = info[2] & (1 << 28);
+    if (!osxsave || !avx || (_xgetbv(0) & 6) != 6)
+        return false;
+    __cpuidex(info, 7, 0);
+    return info[1] & (1 << 5);
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+#endif
+
+const detail::RotateKernels& selectKernels() {
+    static const detail::RotateKernels* selected = [] {
+        auto sets = detail::availableRotateKernels();
+        const QByteArray forced = qgetenv("QTPLAYER_ROTATE_KERNEL");
+        if (!forced.isEmpty()) {
+            auto it = find_if(sets.begin(), sets.end(), [&](const detail::RotateKernels* set) { return forced == set->name; });
+            if (it != sets.end())
+                return *it;
+            qWarning() << "Rotate kernel" << forced << "not available, using" << sets.front()->name;
+        }
+        return sets.front();
+    }();
+    return *selected;
+}
+}
+
+namespace detail {
+vector<const RotateKernels*> availableRotateKernels() {
+    vector<const RotateKernels*> sets;
+#ifdef QTPLAYER_X86
+    if (avx2RotateKernels() && cpuHasAvx2())
+        sets.push_back(avx2RotateKernels());
+    sets.push_back(&Sse2Kernels);
+#endif
+    sets.push_back(&ScalarKernels);
+    return sets;
+}
+
+void rotateWith(const RotateKernels& kernels, const uint8_t* src, ptrdiff_t srcStride, int width, int height,
+                uint8_t* dst, ptrdiff_t dstStride, int bytesPerPixel, int rotate) {
+    const bool wide = bytesPerPixel == 8;
+    switch (rotate) {
+    case cv::ROTATE_90_CLOCKWISE:
+        // dst(y, x) = src(height - 1 - x, y): a transpose reading the source bottom-up
+        (wide ? kernels.transpose64 : kernels.transpose32)(src + (height - 1) * srcStride, -srcStride, width, height, dst, dstStride);
+        break;
+    case cv::ROTATE_90_COUNTERCLOCKWISE:
+        // dst(y, x) = src(x, width - 1 - y): a transpose writing the destination bottom-up
+        (wide ? kernels.transpose64 : kernels.transpose32)(src, srcStride, width, height, dst + (width - 1) * dstStride, -dstStride);
+        break;
+    case cv::ROTATE_180:
+        (wide ? kernels.reverse64 : kernels.reverse32)(src + (height - 1) * srcStride, -srcStride, width, height, dst, dstStride);
+        break;
+    default:
+        for (int y = 0; y < height; y++)
+            memcpy(dst + y * dstStride, src + y * srcStride, size_t(width) * bytesPerPixel);
+        break;
+    }
+}
+}
+
+void rotatePixels(const uint8_t* src, ptrdiff_t srcStride, int width, int height,
+                  uint8_t* dst, ptrdiff_t dstStride, int bytesPerPixel, int rotate) {
+    detail::rotateWith(selectKernels(), src, srcStride, width, height, dst, dstStride, bytesPerPixel, rotate);
+}
+
+const char* rotateKernelName() {
+    return selectKernels().name;
+}
+}
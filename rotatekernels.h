@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace videoio {
+
+// Rotates a width x height image of 4 or 8 byte pixels by a cv::RotateFlags value (>= 3 copies) into dst,
+// which must hold height x width pixels for the 90 degree rotations. Strides are in bytes and may be negative.
+// Works in cache-sized tiles with SSE2/AVX2 micro-kernels picked at runtime; the output is bit-identical to cv::rotate.
+void rotatePixels(const uint8_t* src, ptrdiff_t srcStride, int width, int height,
+                  uint8_t* dst, ptrdiff_t dstStride, int bytesPerPixel, int rotate);
+
+// Name of the kernel set rotatePixels() dispatches to: "avx2", "sse2" or "scalar".
+// QTPLAYER_ROTATE_KERNEL can force a lower level.
+const char* rotateKernelName();
+
+namespace detail {
+using TransposeFn = void (*)(const uint8_t*, ptrdiff_t, int, int, uint8_t*, ptrdiff_t);
+using ReverseFn = void (*)(const uint8_t*, ptrdiff_t, int, int, uint8_t*, ptrdiff_t);
+
+struct RotateKernels {
+    const char* name;
+    TransposeFn transpose32, transpose64;
+    ReverseFn reverse32, reverse64;
+};
+
+// nullptr when the build has no AVX2 kernels (non-x86 targets)
+const RotateKernels* avx2RotateKernels();
+// Every set this CPU can run, best first; rotatePixels() uses the first unless QTPLAYER_ROTATE_KERNEL says otherwise
+std::vector<const RotateKernels*> availableRotateKernels();
+// rotatePixels() with the given set
+void rotateWith(const RotateKernels& kernels, const uint8_t* src, ptrdiff_t srcStride, int width, int height,
+                uint8_t* dst, ptrdiff_t dstStride, int bytesPerPixel, int rotate);
+}
+}
@@ -0,0 +1,74 @@
+// Built with AVX2 enabled (see CMakeLists.txt); only called after a runtime CPU check.
+#include "rotatekernelsimpl.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+namespace videoio {
+namespace detail {
+#if defined(__AVX2__)
+namespace {
+struct Avx2Ops32 {
+    using Pixel = uint32_t;
+    static constexpr int Block = 8, Lanes = 8;
+    static void transpose(const uint8_t* src, ptrdiff_t ss, uint8_t* dst, ptrdiff_t ds) {
+        __m256i r[8];
+        for (int i = 0; i < 8; i++)
+            r[i] = _mm256_loadu_si256((const __m256i*)(src + i * ss));
+        __m256i t0 = _mm256_unpacklo_epi32(r[0], r[1]), t1 = _mm256_unpackhi_epi32(r[0], r[1]);
+        __m256i t2 = _mm256_unpacklo_epi32(r[2], r[3]), t3 = _mm256_unpackhi_epi32(r[2], r[3]);
+        __m256i t4 = _mm256_unpacklo_epi32(r[4], r[5]), t5 = _mm256_unpackhi_epi32(r[4], r[5]);
+        __m256i t6 = _mm256_unpacklo_epi32(r[6], r[7]), t7 = _mm256_unpackhi_epi32(r[6], r[7]);
+        __m256i u0 = _mm256_unpacklo_epi64(t0, t2), u1 = _mm256_unpackhi_epi64(t0, t2);
+        __m256i u2 = _mm256_unpacklo_epi64(t1, t3), u3 = _mm256_unpackhi_epi64(t1, t3);
+        __m256i u4 = _mm256_unpacklo_epi64(t4, t6), u5 = _mm256_unpackhi_epi64(t4, t6);
+        __m256i u6 = _mm256_unpacklo_epi64(t5, t7), u7 = _mm256_unpackhi_epi64(t5, t7);
+        _mm256_storeu_si256((__m256i*)(dst), _mm256_permute2x128_si256(u0, u4, 0x20));
+        _mm256_storeu_si256((__m256i*)(dst + ds), _mm256_permute2x128_si256(u1, u5, 0x20));
+        _mm256_storeu_si256((__m256i*)(dst + 2 * ds), _mm256_permute2x128_si256(u2, u6, 0x20));
+        _mm256_storeu_si256((__m256i*)(dst + 3 * ds), _mm256_permute2x128_si256(u3, u7, 0x20));
+        _mm256_storeu_si256((__m256i*)(dst + 4 * ds), _mm256_permute2x128_si256(u0, u4, 0x31));
+        _mm256_storeu_si256((__m256i*)(dst + 5 * ds), _mm256_permute2x128_si256(u1, u5, 0x31));
+        _mm256_storeu_si256((__m256i*)(dst + 6 * ds), _mm256_permute2x128_si256(u2, u6, 0x31));
+        _mm256_storeu_si256((__m256i*)(dst + 7 * ds), _mm256_permute2x128_si256(u3, u7, 0x31));
+    }
+    static void reverse(const uint8_t* src, uint8_t* dst) {
+        const __m256i order = _mm256_setr_epi32(7, 6, 5, 4, 3, 2, 1, 0);
+        _mm256_storeu_si256((__m256i*)dst, _mm256_permutevar8x32_epi32(_mm256_loadu_si256((const __m256i*)src), order));
+    }
+};
+
+struct Avx2Ops64 {
+    using Pixel = uint64_t;
+    static constexpr int Block = 4, Lanes = 4;
+    static void transpose(const uint8_t* src, ptrdiff_t ss, uint8_t* dst, ptrdiff_t ds) {
+        __m256i r0 = _mm256_loadu_si256((const __m256i*)(src));
+        __m256i r1 = _mm256_loadu_si256((const __m256i*)(src + ss));
+        __m256i r2 = _mm256_loadu_si256((const __m256i*)(src + 2 * ss));
+        __m256i r3 = _mm256_loadu_si256((const __m256i*)(src + 3 * ss));
+        __m256i t0 = _mm256_unpacklo_epi64(r0, r1), t1 = _mm256_unpackhi_epi64(r0, r1);
+        __m256i t2 = _mm256_unpacklo_epi64(r2, r3), t3 = _mm256_unpackhi_epi64(r2, r3);
+        _mm256_storeu_si256((__m256i*)(dst), _mm256_permute2x128_si256(t0, t2, 0x20));
+        _mm256_storeu_si256((__m256i*)(dst + ds), _mm256_permute2x128_si256(t1, t3, 0x20));
+        _mm256_storeu_si256((__m256i*)(dst + 2 * ds), _mm256_permute2x128_si256(t0, t2, 0x31));
+        _mm256_storeu_si256((__m256i*)(dst + 3 * ds), _mm256_permute2x128_si256(t1, t3, 0x31));
+    }
+    static void reverse(const uint8_t* src, uint8_t* dst) {
+        _mm256_storeu_si256((__m256i*)dst, _mm256_permute4x64_epi64(_mm256_loadu_si256((const __m256i*)src), 0x1B));
+    }
+};
+
+const RotateKernels Avx2Kernels = {
+    "avx2",
+    transposeTiled<Avx2Ops32>, transposeTiled<Avx2Ops64>,
+    reverseRows<Avx2Ops32>, reverseRows<Avx2Ops64>,
+};
+}
+
+const RotateKernels* avx2RotateKernels() { return &Avx2Kernels; }
+#else
+const RotateKernels* avx2RotateKernels() { return nullptr; }
+#endif
+}
+}
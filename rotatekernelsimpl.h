@@ -0,0 +1,74 @@
+#pragma once
+
+// Tile loops shared by the per-ISA kernel sets. Everything here has internal linkage on purpose: the
+// translation units including it are built with different instruction set flags, and a merged template
+// instance could otherwise leak AVX2 code into the baseline path.
+
+#include <algorithm>
+#include <cstring>
+#include "rotatekernels.h"
+
+namespace videoio {
+namespace {
+
+// 64x64 tiles of 4 byte pixels, 32x32 of 8 byte pixels: source and destination tile fit in L1 together.
+constexpr int TileBytes = 256;
+
+template <typename Pixel>
+inline void copyPixel(const uint8_t* src, uint8_t* dst) {
+    memcpy(dst, src, sizeof(Pixel));
+}
+
+// dst(x, y) = src(y, x); Ops::transpose handles one Block x Block square.
+template <class Ops>
+void transposeTiled(const uint8_t* src, ptrdiff_t srcStride, int width, int height, uint8_t* dst, ptrdiff_t dstStride) {
+    using Pixel = typename Ops::Pixel;
+    constexpr int B = Ops::Block;
+    constexpr int T = TileBytes / sizeof(Pixel);
+    constexpr ptrdiff_t P = sizeof(Pixel);
+    for (int ty = 0; ty < height; ty += T) {
+        const int th = std::min(T, height - ty);
+        for (int tx = 0; tx < width; tx += T) {
+            const int tw = std::min(T, width - tx);
+            int y = ty;
+            for (; y + B <= ty + th; y += B) {
+                int x = tx;
+                for (; x + B <= tx + tw; x += B)
+                    Ops::transpose(src + y * srcStride + x * P, srcStride, dst + x * dstStride + y * P, dstStride);
+                for (; x < tx + tw; x++)
+                    for (int k = 0; k < B; k++)
+                        copyPixel<Pixel>(src + (y + k) * srcStride + x * P, dst + x * dstStride + (y + k) * P);
+            }
+            for (; y < ty + th; y++)
+                for (int x = tx; x < tx + tw; x++)
+                    copyPixel<Pixel>(src + y * srcStride + x * P, dst + x * dstStride + y * P);
+        }
+    }
+}
+
+// dst(y, x) = src(y, width - 1 - x); Ops::reverse mirrors Lanes pixels.
+template <class Ops>
+void reverseRows(const uint8_t* src, ptrdiff_t srcStride, int width, int height, uint8_t* dst, ptrdiff_t dstStride) {
+    using Pixel = typename Ops::Pixel;
+    constexpr int L = Ops::Lanes;
+    constexpr ptrdiff_t P = sizeof(Pixel);
+    for (int y = 0; y < height; y++) {
+        const uint8_t* s = src + y * srcStride;
+        uint8_t* d = dst + y * dstStride;
+        int x = 0;
+        for (; x + L <= width; x += L)
+            Ops::reverse(s + (width - x - L) * P, d + x * P);
+        for (; x < width; x++)
+            copyPixel<Pixel>(s + (width - 1 - x) * P, d + x * P);
+    }
+}
+
+template <typename T>
+struct ScalarOps {
+    using Pixel = T;
+    static constexpr int Block = 1, Lanes = 1;
+    static void transpose(const uint8_t* src, ptrdiff_t, uint8_t* dst, ptrdiff_t) { copyPixel<Pixel>(src, dst); }
+    static void reverse(const uint8_t* src, uint8_t* dst) { copyPixel<Pixel>(src, dst); }
+};
+}
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <atomic>
+#include <vector>
+#include <cstddef>
+
+namespace videoio {
+
+// Bounded single-producer/single-consumer ring.
+// push() must only be called from one thread and pop()/front() from one other thread;
+// neither side blocks, locks or allocates. Waiting for space/data is left to the caller.
+template<typename T>
+class SPSCQueue {
+    std::vector<T> _slots;
+    size_t _slotCount;
+    alignas(64) std::atomic<size_t> _head{0}; // next slot to pop, written by the consumer
+    alignas(64) std::atomic<size_t> _tail{0}; // next slot to push, written by the producer
+
+    size_t next(size_t i) const { return i + 1 == _slotCount ? 0 : i + 1; }
+
+public:
+    explicit SPSCQueue(size_t capacity = 8) : _slots(capacity + 1), _slotCount(capacity + 1) {}
+
+    // Not thread safe: only call while neither side is running.
+    void reset(size_t capacity) {
+        _slots.clear();
+        _slots.resize(capacity + 1);
+        _slotCount = capacity + 1;
+        _head = 0;
+        _tail = 0;
+    }
+
+    bool push(T value) {
+        const size_t tail = _tail.load(std::memory_order_relaxed);
+        const size_t n = next(tail);
+        if (n == _head.load(std::memory_order_acquire))
+            return false;
+        _slots[tail] = std::move(value);
+        _tail.store(n, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(T& out) {
+        const size_t head = _head.load(std::memory_order_relaxed);
+        if (head == _tail.load(std::memory_order_acquire))
+            return false;
+        out = std::move(_slots[head]);
+        _slots[head] = T();
+        _head.store(next(head), std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side only. Returns nullptr when empty.
+    const T* front() const {
+        const size_t head = _head.load(std::memory_order_relaxed);
+        return head == _tail.load(std::memory_order_acquire) ? nullptr : &_slots[head];
+    }
+
+    size_t size() const {
+        const size_t head = _head.load(std::memory_order_acquire);
+        const size_t tail = _tail.load(std::memory_order_acquire);
+        return tail >= head ? tail - head : tail + _slotCount - head;
+    }
+    size_t capacity() const { return _slotCount - 1; }
+    bool empty() const { return size() == 0; }
+    bool full() const { return size() == capacity(); }
+};
+}
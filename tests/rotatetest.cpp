@@ -0,0 +1,107 @@
+// Rotation must not change a single pixel: every rotate kernel set this CPU can run against cv::rotate, and
+// FrameConverter's rotated conversions against the unrotated conversion rotated by cv::rotate. Exits non-zero
+// on any difference.
+
+#include <QCoreApplication>
+#include <QDebug>
+#include <vector>
+
+#include "frameconverter.h"
+#include "rotatekernels.h"
+
+using namespace videoio;
+using namespace cv;
+
+static const int Rotations[] = {ROTATE_90_CLOCKWISE, ROTATE_180, ROTATE_90_COUNTERCLOCKWISE};
+
+static Size rotatedSize(Size size, int rotate) {
+    return rotate == ROTATE_180 ? size : Size(size.height, size.width);
+}
+
+static bool kernelSets() {
+    const Size sizes[] = {{1, 1}, {7, 3}, {67, 131}, {130, 65}, {257, 97}};
+    theRNG().state = 1234;
+    bool ok = true;
+    for (const auto* kernels : detail::availableRotateKernels()) {
+        for (int type : {CV_8UC4, CV_16UC4}) {
+            for (const auto& size : sizes) {
+                Mat src(size, type);
+                randu(src, Scalar::all(0), Scalar::all(type == CV_8UC4 ? 256 : 65536));
+                for (int rotate : Rotations) {
+                    Mat expected, actual(rotatedSize(size, rotate), type);
+                    cv::rotate(src, expected, rotate);
+                    detail::rotateWith(*kernels, src.data, src.step, src.cols, src.rows, actual.data, actual.step, (int)src.elemSize(), rotate);
+                    if (norm(expected, actual, NORM_INF) != 0) {
+                        qCritical() << "Rotate kernel" << kernels->name << "differs from cv::rotate for" << size.width << "x" << size.height
+                                    << "elemSize" << src.elemSize() << "rotate" << rotate;
+                        ok = false;
+                    }
+                }
+            }
+        }
+    }
+    return ok;
+}
+
+// Sliced (height kept) and single-context (height scaled) conversions of a synthetic yuv420p frame. Outputs
+// start out filled with different sentinels, so rows no slice wrote never compare equal by accident.
+static bool converter(int frameWidth, int frameHeight, int threads) {
+    AVFrame* pFrame = av_frame_alloc();
+    pFrame->format = AV_PIX_FMT_YUV420P;
+    pFrame->width = frameWidth;
+    pFrame->height = frameHeight;
+    if (av_frame_get_buffer(pFrame, 0) < 0) {
+        av_frame_free(&pFrame);
+        qCritical() << "Unable to allocate the test frame";
+        return false;
+    }
+    for (int plane = 0; plane < 3; plane++) {
+        const int w = plane ? (pFrame->width + 1) / 2 : pFrame->width;
+        const int h = plane ? (pFrame->height + 1) / 2 : pFrame->height;
+        for (int y = 0; y < h; y++)
+            for (int x = 0; x < w; x++)
+                pFrame->data[plane][y * pFrame->linesize[plane] + x] = uchar((x * 7 + y * (plane + 3)) & 0xff);
+    }
+    const Size outputs[] = {{pFrame->width, pFrame->height}, {pFrame->width / 2, pFrame->height / 2}};
+    bool ok = true;
+    for (PixelLayout layout : {PixelLayout::RGBA8, PixelLayout::RGBA16}) {
+        for (const auto& output : outputs) {
+            FrameConverter converter;
+            converter.setThreads(threads);
+            Mat converted(output, FrameConverter::matType(layout), Scalar::all(0xAB));
+            if (!converter.convert(pFrame, output.width, output.height, converted.data, converted.step, layout, 3)) {
+                qCritical() << "Conversion failed for" << output.width << "x" << output.height;
+                ok = false;
+                continue;
+            }
+            // Every pixel is opaque, so a sentinel left in alpha means a row no slice converted
+            std::vector<Mat> channels;
+            split(converted, channels);
+            if (countNonZero(channels[3] != (layout == PixelLayout::RGBA8 ? 0xff : 0xffff)) != 0) {
+                qCritical() << "Conversion left pixels unwritten for" << output.width << "x" << output.height
+                            << "layout" << int(layout) << "threads" << threads;
+                ok = false;
+            }
+            for (int rotate : Rotations) {
+                Mat expected, actual(rotatedSize(output, rotate), converted.type(), Scalar::all(0xCD));
+                cv::rotate(converted, expected, rotate);
+                if (!converter.convert(pFrame, output.width, output.height, actual.data, actual.step, layout, rotate)
+                    || norm(expected, actual, NORM_INF) != 0) {
+                    qCritical() << "Rotated conversion differs from cv::rotate for" << output.width << "x" << output.height
+                                << "layout" << int(layout) << "threads" << threads << "rotate" << rotate << "kernel" << rotateKernelName();
+                    ok = false;
+                }
+            }
+        }
+    }
+    av_frame_free(&pFrame);
+    return ok;
+}
+
+int main(int argc, char* argv[]) {
+    QCoreApplication app(argc, argv);
+    // Heights that do not split evenly into the slices: 362 rows in 4, 1080 rows in 7
+    const bool ok = kernelSets() & converter(646, 362, 4) & converter(480, 1080, 7);
+    qInfo() << "rotatetest:" << (ok ? "passed" : "FAILED");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,249 @@
+// The planar YUV upload must look like the RGBA8 path it replaces. Renders synthetic yuv420p, nv12 and p010
+// frames offscreen through QRhi with the view's pipeline and frame.frag, once as planes converted on the GPU
+// and once converted to RGBA8 by FrameConverter, and compares the two. Usage: yuvrendertest <gl|null>.
+// The Null backend runs the whole path without rasterizing, so it checks that everything gets created and
+// recorded but compares nothing. Exits 77 (skipped) when the backend cannot be created, e.g. no OpenGL.
+
+#include <QGuiApplication>
+#include <QDebug>
+#include <QOffscreenSurface>
+#include <rhi/qrhi.h>
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+#include "frameconverter.h"
+#include "rhiresourcecache.h"
+#include "rhitextureitem.h"
+
+using namespace videoio;
+
+static constexpr int Skipped = 77;
+// In 8-bit steps: swscale and the sampler upsample chroma differently, and P010 is dithered to the target
+static constexpr int Tolerance = 8;
+
+struct Source {
+    const char* name;
+    AVPixelFormat avFormat;
+    FrameFormat format;
+};
+
+// Smooth gradients, so the two chroma upsamplers stay close, over most of the code range
+static AVFrame* makeFrame(AVPixelFormat format, int width, int height) {
+    AVFrame* pFrame = av_frame_alloc();
+    pFrame->format = format;
+    pFrame->width = width;
+    pFrame->height = height;
+    pFrame->colorspace = AVCOL_SPC_BT709;
+    pFrame->color_range = AVCOL_RANGE_MPEG;
+    if (av_frame_get_buffer(pFrame, 0) < 0) {
+        av_frame_free(&pFrame);
+        return nullptr;
+    }
+    const bool deep = format == AV_PIX_FMT_P010LE;
+    auto code = [&](double t, int lo, int hi) { return lo + int(t * (hi - lo)); };
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            const int luma = code((x + y) / double(width + height), 16, 235);
+            if (deep)
+                reinterpret_cast<uint16_t*>(pFrame->data[0] + y * pFrame->linesize[0])[x] = uint16_t((luma << 2) << 6);
+            else
+                pFrame->data[0][y * pFrame->linesize[0] + x] = uchar(luma);
+        }
+    }
+    for (int y = 0; y < (height + 1) / 2; y++) {
+        for (int x = 0; x < (width + 1) / 2; x++) {
+            const int cb = code(x / double(width / 2), 64, 192), cr = code(y / double(height / 2), 192, 64);
+            if (format == AV_PIX_FMT_YUV420P) {
+                pFrame->data[1][y * pFrame->linesize[1] + x] = uchar(cb);
+                pFrame->data[2][y * pFrame->linesize[2] + x] = uchar(cr);
+            } else if (deep) {
+                uint16_t* row = reinterpret_cast<uint16_t*>(pFrame->data[1] + y * pFrame->linesize[1]);
+                row[2 * x] = uint16_t((cb << 2) << 6);
+                row[2 * x + 1] = uint16_t((cr << 2) << 6);
+            } else {
+                pFrame->data[1][y * pFrame->linesize[1] + 2 * x] = uchar(cb);
+                pFrame->data[1][y * pFrame->linesize[1] + 2 * x + 1] = uchar(cr);
+            }
+        }
+    }
+    return pFrame;
+}
+
+class OffscreenRenderer {
+    QRhi* m_rhi;
+    std::shared_ptr<RhiResourceCache> m_shared;
+    std::unique_ptr<QRhiTexture> m_target, m_placeholder;
+    std::unique_ptr<QRhiTextureRenderTarget> m_rt;
+    std::unique_ptr<QRhiRenderPassDescriptor> m_rp;
+    std::unique_ptr<QRhiBuffer> m_ubuf;
+
+public:
+    OffscreenRenderer(QRhi* rhi, QSize size) : m_rhi(rhi), m_shared(RhiResourceCache::forRhi(rhi)) {
+        m_target.reset(rhi->newTexture(QRhiTexture::RGBA8, size, 1, QRhiTexture::RenderTarget | QRhiTexture::UsedAsTransferSource));
+        m_target->create();
+        m_placeholder.reset(rhi->newTexture(QRhiTexture::RGBA8, QSize(1, 1), 1));
+        m_placeholder->create();
+        m_rt.reset(rhi->newTextureRenderTarget({m_target.get()}));
+        m_rp.reset(m_rt->newCompatibleRenderPassDescriptor());
+        m_rt->setRenderPassDescriptor(m_rp.get());
+        m_rt->create();
+        m_ubuf.reset(rhi->newBuffer(QRhiBuffer::Dynamic, QRhiBuffer::UniformBuffer, RhiResourceCache::UniformBufferSize));
+        m_ubuf->create();
+    }
+
+    // Draws tightly packed planes of format with the view's pipeline and reads the target back; empty on failure
+    QByteArray render(const QByteArray& pixels, FrameFormat format, QSize size) {
+        QRhiGraphicsPipeline* pipeline = m_shared->pipeline(m_rp.get(), 1);
+        if (pipeline == nullptr)
+            return QByteArray();
+        QRhiCommandBuffer* cb = nullptr;
+        if (m_rhi->beginOffscreenFrame(&cb) != QRhi::FrameOpSuccess)
+            return QByteArray();
+        m_shared->prepare(cb);
+
+        QRhiResourceUpdateBatch* u = m_rhi->nextResourceUpdateBatch();
+        std::vector<std::unique_ptr<QRhiTexture>> planes;
+        qsizetype offset = 0;
+        for (int plane = 0; plane < planeCount(format); plane++) {
+            const QSize planeSz = planeSize(format, size, plane);
+            const quint32 stride = quint32(planeSz.width() * planeBytesPerPixel(format, plane));
+            const qsizetype bytes = qsizetype(stride) * planeSz.height();
+            planes.emplace_back(m_rhi->newTexture(planeFormat(format, plane), planeSz, 1));
+            planes.back()->create();
+            QRhiTextureSubresourceUploadDescription sub(pixels.mid(offset, bytes));
+            sub.setDataStride(stride);
+            u->uploadTexture(planes.back().get(), QRhiTextureUploadDescription(QRhiTextureUploadEntry(0, 0, sub)));
+            offset += bytes;
+        }
+        QRhiTexture* bound[3];
+        for (int plane = 0; plane < 3; plane++)
+            bound[plane] = plane < (int)planes.size() ? planes[plane].get() : m_placeholder.get();
+        std::unique_ptr<QRhiShaderResourceBindings> srb(m_rhi->newShaderResourceBindings());
+        srb->setBindings({
+            QRhiShaderResourceBinding::uniformBuffer(0, QRhiShaderResourceBinding::VertexStage | QRhiShaderResourceBinding::FragmentStage, m_ubuf.get()),
+            QRhiShaderResourceBinding::sampledTexture(1, QRhiShaderResourceBinding::FragmentStage, bound[0], m_shared->sampler()),
+            QRhiShaderResourceBinding::sampledTexture(2, QRhiShaderResourceBinding::FragmentStage, bound[1], m_shared->sampler()),
+            QRhiShaderResourceBinding::sampledTexture(3, QRhiShaderResourceBinding::FragmentStage, bound[2], m_shared->sampler()),
+            QRhiShaderResourceBinding::sampledTexture(4, QRhiShaderResourceBinding::FragmentStage, m_placeholder.get(), m_shared->sampler()),
+        });
+        srb->create();
+
+        // Uniforms as ExampleRhiItemRenderer::render() sets them, with the quad stretched over the whole target
+        QMatrix4x4 mvp = m_rhi->clipSpaceCorrMatrix();
+        mvp.scale(1 / 0.75f);
+        const QMatrix4x4 yuvToRgb = yuvToRgbMatrix(AVCOL_SPC_BT709, AVCOL_RANGE_MPEG, format, size.height());
+        const qint32 shaderFormat = planeCount(format) == 1 ? 0 : (planeCount(format) == 3 ? 1 : 2);
+        const float levels = format == FrameFormat::P010 ? 255.0f : 0.0f;
+        const float lutSize = 0;
+        u->updateDynamicBuffer(m_ubuf.get(), 0, 64, mvp.constData());
+        u->updateDynamicBuffer(m_ubuf.get(), 64, 64, yuvToRgb.constData());
+        u->updateDynamicBuffer(m_ubuf.get(), 128, 4, &shaderFormat);
+        u->updateDynamicBuffer(m_ubuf.get(), 132, 4, &levels);
+        u->updateDynamicBuffer(m_ubuf.get(), 136, 4, &lutSize);
+
+        cb->beginPass(m_rt.get(), Qt::black, {1.0f, 0}, u);
+        cb->setGraphicsPipeline(pipeline);
+        cb->setViewport(QRhiViewport(0, 0, size.width(), size.height()));
+        cb->setShaderResources(srb.get());
+        const QRhiCommandBuffer::VertexInput vbufBinding(m_shared->vertexBuffer(), 0);
+        cb->setVertexInput(0, 1, &vbufBinding);
+        cb->draw(RhiResourceCache::VertexCount);
+        QRhiReadbackResult readback;
+        QRhiResourceUpdateBatch* rb = m_rhi->nextResourceUpdateBatch();
+        rb->readBackTexture({m_target.get()}, &readback);
+        cb->endPass(rb);
+        if (m_rhi->endOffscreenFrame() != QRhi::FrameOpSuccess)
+            return QByteArray();
+        return readback.data;
+    }
+};
+
+// Largest per-channel difference, leaving out a 2 pixel border where the chroma upsamplers see the edge
+static int maxDifference(const QByteArray& a, const QByteArray& b, QSize size) {
+    int worst = 0;
+    for (int y = 2; y < size.height() - 2; y++) {
+        for (int x = 2 * 4; x < (size.width() - 2) * 4; x++) {
+            const qsizetype i = qsizetype(y) * size.width() * 4 + x;
+            worst = std::max(worst, std::abs(int(uchar(a[i])) - int(uchar(b[i]))));
+        }
+    }
+    return worst;
+}
+
+int main(int argc, char* argv[]) {
+    QGuiApplication app(argc, argv);
+    const QString backend = app.arguments().value(1, "gl");
+
+    std::unique_ptr<QOffscreenSurface> surface;
+    std::unique_ptr<QRhi> rhi;
+    if (backend == "null") {
+        QRhiNullInitParams params;
+        rhi.reset(QRhi::create(QRhi::Null, &params));
+    } else {
+#if QT_CONFIG(opengl)
+        surface.reset(QRhiGles2InitParams::newFallbackSurface());
+        QRhiGles2InitParams params;
+        params.fallbackSurface = surface.get();
+        rhi.reset(QRhi::create(QRhi::OpenGLES2, &params));
+#endif
+    }
+    if (!rhi) {
+        qInfo() << "yuvrendertest: no" << backend << "QRhi here, skipped";
+        return Skipped;
+    }
+    const bool compare = rhi->backend() != QRhi::Null;
+    qInfo() << "yuvrendertest: on" << rhi->backendName() << rhi->driverInfo().deviceName;
+
+    const QSize size(96, 64);
+    const Source sources[] = {
+        {"yuv420p", AV_PIX_FMT_YUV420P, FrameFormat::YUV420P},
+        {"nv12", AV_PIX_FMT_NV12, FrameFormat::NV12},
+        {"p010", AV_PIX_FMT_P010LE, FrameFormat::P010},
+    };
+    bool ok = true;
+    {
+        OffscreenRenderer renderer(rhi.get(), size);
+        FrameConverter converter;
+        for (const Source& source : sources) {
+            if (!rhi->isTextureFormatSupported(planeFormat(source.format, 0)) || !rhi->isTextureFormatSupported(planeFormat(source.format, 1))) {
+                qInfo() << "yuvrendertest:" << source.name << "planes not supported on" << rhi->backendName() << ", skipped";
+                continue;
+            }
+            AVFrame* pFrame = makeFrame(source.avFormat, size.width(), size.height());
+            if (pFrame == nullptr) {
+                qCritical() << "yuvrendertest: unable to allocate a" << source.name << "frame";
+                ok = false;
+                continue;
+            }
+            // What getFrameInto(YUVPlanar) and the RGBA8 fallback hand the view
+            QByteArray planes(av_image_get_buffer_size(source.avFormat, size.width(), size.height(), 1), Qt::Uninitialized);
+            av_image_copy_to_buffer(reinterpret_cast<uint8_t*>(planes.data()), planes.size(), pFrame->data, pFrame->linesize,
+                                    source.avFormat, size.width(), size.height(), 1);
+            QByteArray rgba(qsizetype(size.width()) * size.height() * 4, Qt::Uninitialized);
+            const bool converted = converter.convert(pFrame, size.width(), size.height(), reinterpret_cast<uchar*>(rgba.data()),
+                                                     size.width() * 4, PixelLayout::RGBA8, 3);
+            av_frame_free(&pFrame);
+
+            const QByteArray planar = renderer.render(planes, source.format, size);
+            const QByteArray reference = converted ? renderer.render(rgba, FrameFormat::RGBA8, size) : QByteArray();
+            if (planar.isEmpty() || reference.isEmpty()) {
+                qCritical() << "yuvrendertest:" << source.name << "could not be rendered on" << rhi->backendName();
+                ok = false;
+                continue;
+            }
+            if (!compare) {
+                qInfo() << "yuvrendertest:" << source.name << "rendered, nothing to compare on" << rhi->backendName();
+                continue;
+            }
+            const int difference = maxDifference(planar, reference, size);
+            qInfo() << "yuvrendertest:" << source.name << "differs from RGBA8 by at most" << difference;
+            if (difference > Tolerance) {
+                qCritical() << "yuvrendertest:" << source.name << "planar path is off by" << difference << ", more than" << Tolerance;
+                ok = false;
+            }
+        }
+    }
+    qInfo() << "yuvrendertest:" << (ok ? "passed" : "FAILED");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,93 @@
+#include "workerpool.h"
+#include <algorithm>
+#include <atomic>
+#include <memory>
+
+namespace videoio {
+using namespace std;
+
+WorkerPool::WorkerPool(size_t threads) {
+    _threads.reserve(threads);
+    for (size_t i = 0; i < threads; i++)
+        _threads.emplace_back(&WorkerPool::run, this);
+}
+
+WorkerPool::~WorkerPool() {
+    {
+        std::lock_guard<std::mutex> g(_lock);
+        _stop = true;
+    }
+    _cv.notify_all();
+    for (auto& thread : _threads)
+        thread.join();
+}
+
+WorkerPool& WorkerPool::shared() {
+    static WorkerPool pool(std::max(2u, std::thread::hardware_concurrency()) - 1);
+    return pool;
+}
+
+void WorkerPool::run() {
+    for (;;) {
+        function<void()> task;
+        {
+            std::unique_lock<std::mutex> l(_lock);
+            _cv.wait(l, [this] { return _stop || !_tasks.empty(); });
+            if (_stop && _tasks.empty())
+                return;
+            task = std::move(_tasks.front());
+            _tasks.pop_front();
+        }
+        task();
+    }
+}
+
+void WorkerPool::post(function<void()> task) {
+    {
+        std::lock_guard<std::mutex> g(_lock);
+        _tasks.push_back(std::move(task));
+    }
+    _cv.notify_one();
+}
+
+void WorkerPool::parallelFor(int count, const function<void(int)>& fn) {
+    if (count <= 0)
+        return;
+    if (count == 1 || _threads.empty()) {
+        for (int i = 0; i < count; i++)
+            fn(i);
+        return;
+    }
+
+    // Helpers may only get scheduled after the caller already drained every item, so the shared
+    // state outlives this call and helpers never touch fn once all items are claimed.
+    struct State {
+        std::atomic<int> next{0};
+        int done = 0;
+        std::mutex lock;
+        std::condition_variable cv;
+    };
+    auto state = make_shared<State>();
+    auto work = [state, count, &fn] {
+        int finished = 0;
+        for (int i = state->next++; i < count; i = state->next++) {
+            fn(i);
+            finished++;
+        }
+        if (finished == 0)
+            return;
+        std::lock_guard<std::mutex> g(state->lock);
+        state->done += finished;
+        if (state->done == count)
+            state->cv.notify_all();
+    };
+
+    int helpers = std::min<int>(count - 1, (int)_threads.size());
+    for (int i = 0; i < helpers; i++)
+        post(work);
+    work();
+
+    std::unique_lock<std::mutex> l(state->lock);
+    state->cv.wait(l, [&] { return state->done == count; });
+}
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace videoio {
+using namespace std;
+
+// Small fixed-size thread pool shared by the CPU-heavy per-frame work (pixel conversion, prefetching).
+class WorkerPool {
+    vector<std::thread> _threads;
+    std::mutex _lock;
+    std::condition_variable _cv;
+    deque<function<void()>> _tasks;
+    bool _stop = false;
+
+    void run();
+
+public:
+    explicit WorkerPool(size_t threads);
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+    ~WorkerPool();
+
+    // Process-wide pool sized to the hardware concurrency.
+    static WorkerPool& shared();
+
+    size_t size() const { return _threads.size(); }
+    void post(function<void()> task);
+
+    // Runs fn(0) .. fn(count - 1) and returns once all of them finished. The calling thread works on
+    // the items too, so this is safe to call from inside a pool task.
+    void parallelFor(int count, const function<void(int)>& fn);
+};
+}